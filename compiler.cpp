@@ -1,15 +1,40 @@
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <limits>
 #include <vector>
 #include <memory>
 #include <unordered_map>
 #include <sstream>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <stdexcept>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <unordered_set>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
 // LLVM JIT includes
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
@@ -18,16 +43,28 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Target/TargetMachine.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Object/SymbolSize.h>
 #include <llvm/Support/raw_ostream.h>
 #include <map>
+#include <set>
+#include <array>
 
 // Token types for our enhanced language
 enum class TokenType {
@@ -45,6 +82,7 @@ enum class TokenType {
     FOR,
     FUNCTION,
     RETURN,
+    PARALLEL,
     
     // Operators
     PLUS,
@@ -85,10 +123,11 @@ struct Token {
     std::string value;
     int line;
     int column;
+    int length = 0;  // Characters of source the token spans
     
     Token() : type(TokenType::INVALID), value(""), line(0), column(0) {}
-    Token(TokenType t, const std::string& v, int l = 0, int c = 0) 
-        : type(t), value(v), line(l), column(c) {}
+    Token(TokenType t, std::string v, int l = 0, int c = 0)
+        : type(t), value(std::move(v)), line(l), column(c) {}
 };
 
 // Forward declarations
@@ -96,42 +135,377 @@ class Expression;
 class Statement;
 class FunctionDeclaration;
 
+// What the type inference pass can prove about an expression; see TypeInference. NEVER ("no
+// value yet") only exists while the pass is iterating.
+enum class StaticType { UNKNOWN, NUMBER, STRING, ARRAY, MAP, FUNCTION, NEVER };
+
+// Binary operators, resolved from tokens once by the parser's precedence table
+enum class BinaryOp : uint8_t { ADD, SUB, MUL, DIV, POW, EQ, NE, LT, GT, LE, GE };
+
+inline const char* binary_op_symbol(BinaryOp op) {
+    static const char* const symbols[] = {"+", "-", "*", "/", "**", "==", "!=", "<", ">", "<=", ">="};
+    return symbols[static_cast<int>(op)];
+}
+
+// The operator on two numbers; comparisons yield 1 or 0
+inline double apply_binary(BinaryOp op, double l, double r) {
+    switch (op) {
+        case BinaryOp::ADD: return l + r;
+        case BinaryOp::SUB: return l - r;
+        case BinaryOp::MUL: return l * r;
+        case BinaryOp::DIV: return l / r;
+        case BinaryOp::POW: return std::pow(l, r);
+        case BinaryOp::EQ: return l == r ? 1 : 0;
+        case BinaryOp::NE: return l != r ? 1 : 0;
+        case BinaryOp::LT: return l < r ? 1 : 0;
+        case BinaryOp::GT: return l > r ? 1 : 0;
+        case BinaryOp::LE: return l <= r ? 1 : 0;
+        case BinaryOp::GE: return l >= r ? 1 : 0;
+    }
+    return 0;
+}
+
+// --- Runtime statistics ---
+// Hot-path counters for finding allocation and lookup costs in the interpreter. The hooks compile
+// to nothing unless built with -DCOMPFOUNDATION_STATS. Counters are shared by every thread.
+class RuntimeStats {
+public:
+    enum Tier { INTERPRETER, NATIVE, COMPILE, TIER_COUNT };
+    enum Allocation { STRING_ALLOCATION, ARRAY_ALLOCATION, MAP_ALLOCATION, ALLOCATION_COUNT };
+    
+    std::atomic<uint64_t> value_copies{0};
+    std::atomic<uint64_t> allocations[ALLOCATION_COUNT] = {};
+    std::atomic<uint64_t> scope_pushes{0};
+    std::atomic<uint64_t> variable_lookups{0};
+    std::atomic<uint64_t> dispatches{0};       // Statements and expressions entered by the interpreter
+    std::atomic<uint64_t> quickened{0};        // ...of which ran a quickened form
+    std::atomic<uint64_t> deoptimizations{0};  // Quickened forms abandoned after a type change
+    std::atomic<int64_t> tier_ns[TIER_COUNT] = {};
+    
+private:
+    mutable std::mutex mutex;  // Guards the per-name tables
+    std::map<std::string, uint64_t> builtin_calls;
+    std::map<std::string, double> compile_ms;
+    
+public:
+    void record_builtin(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        builtin_calls[name]++;
+    }
+    
+    void record_compile(const std::string& function, std::chrono::nanoseconds elapsed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        compile_ms[function] += std::chrono::duration<double, std::milli>(elapsed).count();
+    }
+    
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        value_copies = 0;
+        for (auto& count : allocations) count = 0;
+        scope_pushes = 0;
+        variable_lookups = 0;
+        dispatches = 0;
+        quickened = 0;
+        deoptimizations = 0;
+        for (auto& ns : tier_ns) ns = 0;
+        builtin_calls.clear();
+        compile_ms.clear();
+    }
+    
+    void write_report(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+#ifndef COMPFOUNDATION_STATS
+        out << "runtime statistics are disabled; rebuild with -DCOMPFOUNDATION_STATS" << std::endl;
+#else
+        static const char* tier_names[TIER_COUNT] = {"interpreter", "native", "jit compile"};
+        out << "value copies       " << value_copies << std::endl;
+        out << "string allocations " << allocations[STRING_ALLOCATION] << std::endl;
+        out << "array allocations  " << allocations[ARRAY_ALLOCATION] << std::endl;
+        out << "map allocations    " << allocations[MAP_ALLOCATION] << std::endl;
+        out << "scope pushes       " << scope_pushes << std::endl;
+        out << "variable lookups   " << variable_lookups << std::endl;
+        out << "dispatches         " << dispatches << " (" << quickened << " quickened, "
+            << deoptimizations << " deoptimized)" << std::endl;
+        out << std::fixed << std::setprecision(3);
+        for (int tier = 0; tier < TIER_COUNT; tier++) {
+            out << "time in " << tier_names[tier] << ": " << tier_ns[tier] / 1e6 << " ms" << std::endl;
+        }
+        for (const auto& entry : builtin_calls) {
+            out << "builtin " << entry.first << ": " << entry.second << " calls" << std::endl;
+        }
+        for (const auto& entry : compile_ms) {
+            out << "jit compile " << entry.first << ": " << entry.second << " ms" << std::endl;
+        }
+#endif
+    }
+};
+
+inline RuntimeStats& runtime_stats() {
+    static RuntimeStats stats;
+    return stats;
+}
+
+// Times a stretch of execution in one tier. Time spent in nested timers counts toward their own
+// tier only, so the tiers add up to the total.
+class TierTimer {
+private:
+    typedef std::chrono::steady_clock Clock;
+    RuntimeStats::Tier tier;
+    Clock::time_point start;
+    std::chrono::nanoseconds nested{0};
+    TierTimer* enclosing;
+    
+    static TierTimer*& current() {
+        thread_local TierTimer* timer = nullptr;
+        return timer;
+    }
+    
+public:
+    explicit TierTimer(RuntimeStats::Tier t) : tier(t), start(Clock::now()), enclosing(current()) {
+        current() = this;
+    }
+    ~TierTimer() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+        runtime_stats().tier_ns[tier] += (elapsed - nested).count();
+        if (enclosing) enclosing->nested += elapsed;
+        current() = enclosing;
+    }
+    TierTimer(const TierTimer&) = delete;
+    TierTimer& operator=(const TierTimer&) = delete;
+};
+
+// Compile time attributed to one function, also counted in the COMPILE tier
+class CompileTimer {
+private:
+    std::string function;
+    TierTimer tier_timer{RuntimeStats::COMPILE};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+public:
+    explicit CompileTimer(const std::string& name) : function(name) {}
+    ~CompileTimer() {
+        runtime_stats().record_compile(function, std::chrono::steady_clock::now() - start);
+    }
+};
+
+#ifdef COMPFOUNDATION_STATS
+#define COMPFOUNDATION_STAT(statement) do { RuntimeStats& stats = runtime_stats(); stats.statement; } while (0)
+#define COMPFOUNDATION_TIER(tier) TierTimer tier_timer(RuntimeStats::tier)
+#define COMPFOUNDATION_COMPILE_TIMER(name) CompileTimer compile_timer(name)
+#else
+#define COMPFOUNDATION_STAT(statement) do { } while (0)
+#define COMPFOUNDATION_TIER(tier) do { } while (0)
+#define COMPFOUNDATION_COMPILE_TIMER(name) do { } while (0)
+#endif
+
+// Contiguous numbers backing an ARRAY value without a Value per element. Either owns its
+// storage or borrows memory kept alive by `owner` (or, for embedder views, by the caller).
+struct PackedArray {
+    const double* data = nullptr;
+    size_t size = 0;
+    std::vector<double> storage;
+    std::shared_ptr<const void> owner;
+    
+    PackedArray() = default;
+    explicit PackedArray(std::vector<double> values) : storage(std::move(values)) {
+        data = storage.data();
+        size = storage.size();
+    }
+    PackedArray(const double* d, size_t n, std::shared_ptr<const void> keep_alive = nullptr)
+        : data(d), size(n), owner(std::move(keep_alive)) {}
+};
+
+// Appends a number formatted like std::to_string (printf's %f), without going through printf
+inline void append_number(std::string& out, double value) {
+    char buffer[400];  // The largest double has 309 integer digits
+    auto result = std::to_chars(buffer, buffer + sizeof buffer, value, std::chars_format::fixed, 6);
+    out.append(buffer, result.ptr);
+}
+
+// One distinct string text, shared by every interned string value and map key spelled that way.
+// Equal interned strings are the same object, so they compare by address and hash in O(1).
+struct InternedString {
+    std::string text;
+    size_t hash;
+};
+
+// Process-wide intern table for string literals and map keys. Entries are never freed, so besides
+// the names a program spells out it keeps every distinct key of maps built by embedders, read by
+// load and every load_csv column name until exit. Other strings built at run time are not interned.
+class StringTable {
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<const InternedString>> strings;
+
+public:
+    const InternedString* intern(const std::string& text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = strings[text];
+        if (!slot) slot.reset(new InternedString{text, std::hash<std::string>()(text)});
+        return slot.get();
+    }
+};
+
+inline StringTable& string_table() {
+    static StringTable table;
+    return table;
+}
+
+inline const InternedString* intern(const std::string& text) {
+    return string_table().intern(text);
+}
+
+struct Value;
+
+// Map keys are always interned, so lookups use the cached hash and compare pointers
+struct InternedHash {
+    size_t operator()(const InternedString* s) const { return s->hash; }
+};
+typedef std::unordered_map<const InternedString*, Value, InternedHash> MapEntries;
+
+class HeapObject;
+struct ArrayObject;
+struct MapObject;
+struct ClosureObject;
+
 struct Value {
     enum Type { NUMBER, ARRAY, STRING, MAP, FUNCTION } type;
     double number_value;
-    std::vector<Value> array_value;
-    std::string string_value;
-    std::unordered_map<std::string, Value> map_value;
-    FunctionDeclaration* function_value; // Pointer to function declaration
-    
-    Value() : type(NUMBER), number_value(0), function_value(nullptr) {}
-    explicit Value(int n) : type(NUMBER), number_value(static_cast<double>(n)), function_value(nullptr) {}
-    Value(double n) : type(NUMBER), number_value(n), function_value(nullptr) {}
-    Value(const std::vector<Value>& arr) : type(ARRAY), array_value(arr), function_value(nullptr) {}
-    Value(const std::string& str) : type(STRING), string_value(str), function_value(nullptr) {}
-    Value(const std::unordered_map<std::string, Value>& map) : type(MAP), map_value(map), function_value(nullptr) {}
-    Value(FunctionDeclaration* func) : type(FUNCTION), function_value(func) {}
+    // STRING contents: `string_size` bytes at `string_data`, kept alive by `string_owner`. Slices
+    // share their parent's owner, so substr, split and trim never copy. Interned strings need no
+    // owner; `interned` is their table entry.
+    const char* string_data = nullptr;
+    size_t string_size = 0;
+    std::shared_ptr<const void> string_owner;
+    const InternedString* interned = nullptr;
+    std::shared_ptr<const PackedArray> packed_value; // Packed numeric ARRAY; array_object is then null
+    // Array and map contents are immutable heap objects shared by every copy of the value; see Heap
+    std::shared_ptr<const ArrayObject> array_object;
+    std::shared_ptr<const MapObject> map_object;
+    std::shared_ptr<ClosureObject> closure_object;  // A FUNCTION and its captured variables
+    
+    Value() : type(NUMBER), number_value(0) {}
+    explicit Value(int n) : type(NUMBER), number_value(static_cast<double>(n)) {}
+    Value(double n) : type(NUMBER), number_value(n) {}
+    Value(const std::vector<Value>& arr) : Value(std::vector<Value>(arr)) {}
+    Value(std::vector<Value>&& arr);
+    Value(const std::string& str) : Value(std::string(str)) {}
+    Value(std::string&& str) : type(STRING), number_value(0) {
+        COMPFOUNDATION_STAT(allocations[RuntimeStats::STRING_ALLOCATION]++);
+        auto owned = std::make_shared<const std::string>(std::move(str));
+        string_data = owned->data();
+        string_size = owned->size();
+        string_owner = std::move(owned);
+    }
+    // Zero-copy string over bytes kept alive by `owner`
+    Value(const char* data, size_t size, std::shared_ptr<const void> owner)
+        : type(STRING), number_value(0), string_data(data), string_size(size), string_owner(std::move(owner)) {}
+    explicit Value(const InternedString* str)
+        : type(STRING), number_value(0), string_data(str->text.data()), string_size(str->text.size()), interned(str) {}
+    Value(const std::unordered_map<std::string, Value>& map);
+    Value(MapEntries&& map);
+    explicit Value(std::shared_ptr<ClosureObject> closure)
+        : type(FUNCTION), number_value(0), closure_object(std::move(closure)) {}
+    explicit Value(std::shared_ptr<const PackedArray> packed)
+        : type(ARRAY), number_value(0), packed_value(std::move(packed)) {}
+    
+#ifdef COMPFOUNDATION_STATS
+    // Counted copies; moves stay free and uncounted
+    Value(const Value& other)
+        : type(other.type), number_value(other.number_value), string_data(other.string_data),
+          string_size(other.string_size), string_owner(other.string_owner), interned(other.interned),
+          packed_value(other.packed_value), array_object(other.array_object), map_object(other.map_object),
+          closure_object(other.closure_object) {
+        count_copy();
+    }
+    Value(Value&&) = default;
+    Value& operator=(const Value& other) {
+        if (this != &other) {
+            type = other.type;
+            number_value = other.number_value;
+            string_data = other.string_data;
+            string_size = other.string_size;
+            string_owner = other.string_owner;
+            interned = other.interned;
+            packed_value = other.packed_value;
+            array_object = other.array_object;
+            map_object = other.map_object;
+            closure_object = other.closure_object;
+        }
+        count_copy();
+        return *this;
+    }
+    Value& operator=(Value&&) = default;
+    
+    // Arrays, maps and strings are shared on copy, so copying never allocates
+    void count_copy() const {
+        runtime_stats().value_copies++;
+    }
+#endif
+    
+    // Zero-copy array over caller-owned doubles; the memory must outlive every use of the value
+    static Value view(const double* data, size_t size) {
+        return Value(std::make_shared<const PackedArray>(data, size));
+    }
+#if __cplusplus >= 202002L
+    static Value view(std::span<const double> values) {
+        return view(values.data(), values.size());
+    }
+#endif
+    
+    size_t array_size() const;
+    Value array_element(size_t index) const;
+    // Elements of a non-packed array, entries of a map
+    const std::vector<Value>& array_elements() const;
+    const MapEntries& map_entries() const;
+    // The declaration a FUNCTION runs; valid for as long as this value is
+    const FunctionDeclaration* function() const;
+    // The array, map or closure object this value references, if any
+    HeapObject* heap_object() const;
+    
+    // Contents of a STRING
+    std::string_view text() const { return std::string_view(string_data, string_size); }
+    
+    // `length` bytes of a STRING from `offset`, sharing its storage
+    Value slice(size_t offset, size_t length) const {
+        Value part(*this);
+        part.string_data = string_data + offset;
+        part.string_size = length;
+        part.interned = nullptr;
+        return part;
+    }
+    
+    // Interned strings are equal exactly when they are the same entry; anything else compares contents
+    bool same_string(const Value& other) const {
+        if (interned && other.interned) return interned == other.interned;
+        return text() == other.text();
+    }
     
     bool is_truthy() const {
         switch (type) {
             case NUMBER: return number_value != 0;
-            case ARRAY: return !array_value.empty();
-            case STRING: return !string_value.empty();
-            case MAP: return !map_value.empty();
-            case FUNCTION: return function_value != nullptr;
+            case ARRAY: return array_size() != 0;
+            case STRING: return !text().empty();
+            case MAP: return !map_entries().empty();
+            case FUNCTION: return closure_object != nullptr;
         }
         return false;
     }
     
     std::string to_string() const {
         switch (type) {
-            case NUMBER: return std::to_string(number_value);
-            case STRING: return string_value;
+            case NUMBER: {
+                std::string result;
+                append_number(result, number_value);
+                return result;
+            }
+            case STRING: return std::string(text());
             case ARRAY: {
                 std::string result = "[";
-                for (size_t i = 0; i < array_value.size(); i++) {
-                    result += array_value[i].to_string();
-                    if (i < array_value.size() - 1) result += ", ";
+                size_t size = array_size();
+                for (size_t i = 0; i < size; i++) {
+                    result += array_element(i).to_string();
+                    if (i < size - 1) result += ", ";
                 }
                 result += "]";
                 return result;
@@ -139,9 +513,9 @@ struct Value {
             case MAP: {
                 std::string result = "{";
                 bool first = true;
-                for (const auto& pair : map_value) {
+                for (const auto& pair : map_entries()) {
                     if (!first) result += ", ";
-                    result += "\"" + pair.first + "\": " + pair.second.to_string();
+                    result += "\"" + pair.first->text + "\": " + pair.second.to_string();
                     first = false;
                 }
                 result += "}";
@@ -153,9 +527,327 @@ struct Value {
     }
 };
 
+// --- Garbage-collected heap for arrays and maps ---
+// Copying a Value shares its array or map instead of deep-copying it. Reference counting frees
+// most objects; a Heap also tracks every object an interpreter allocates, so that a collection can
+// free reference cycles as well. Collection is trial deletion, as in CPython: references held by
+// other tracked objects are subtracted from each object's count, and whatever remains is held from
+// outside the heap (interpreter scopes and globals, C++ temporaries, the embedder). Everything
+// reachable from those objects survives, so the roots never need enumerating. JIT-compiled code
+// only holds doubles and packed-array data that the interpreter keeps alive, so it needs no stack maps.
+class Heap;
+
+class HeapObject {
+private:
+    friend class Heap;
+    std::shared_ptr<Heap> heap;      // Null for objects created outside any interpreter
+    std::weak_ptr<HeapObject> self;  // Its count is the object's reference count
+    HeapObject* prev = nullptr;
+    HeapObject* next = nullptr;
+    size_t bytes = 0;
+    long gc_refs = 0;                // Collection scratch, guarded by the heap's mutex
+    bool reachable = false;
+    
+public:
+    virtual ~HeapObject();
+    // Appends the heap objects this one references
+    virtual void children(std::vector<HeapObject*>& out) const = 0;
+    // Drops every reference this object holds, to break a garbage cycle
+    virtual void clear() = 0;
+    virtual size_t size_in_bytes() const = 0;
+};
+
+struct ArrayObject : public HeapObject {
+    std::vector<Value> elements;
+    
+    explicit ArrayObject(std::vector<Value>&& values) : elements(std::move(values)) {}
+    
+    void children(std::vector<HeapObject*>& out) const override {
+        for (const auto& element : elements) {
+            if (HeapObject* object = element.heap_object()) out.push_back(object);
+        }
+    }
+    void clear() override { std::vector<Value>().swap(elements); }
+    size_t size_in_bytes() const override { return sizeof(*this) + elements.capacity() * sizeof(Value); }
+};
+
+struct MapObject : public HeapObject {
+    MapEntries entries;
+    
+    explicit MapObject(MapEntries&& map) : entries(std::move(map)) {}
+    
+    void children(std::vector<HeapObject*>& out) const override {
+        for (const auto& entry : entries) {
+            if (HeapObject* object = entry.second.heap_object()) out.push_back(object);
+        }
+    }
+    void clear() override { MapEntries().swap(entries); }
+    size_t size_in_bytes() const override {
+        size_t node = sizeof(MapEntries::value_type) + 2 * sizeof(void*);
+        return sizeof(*this) + entries.size() * node + entries.bucket_count() * sizeof(void*);
+    }
+};
+
+class CompiledProgram;
+
+// A local variable that a nested function captures. The frame that declares it and every closure
+// capturing it hold the same cell, so a write through any of them is seen by all the others.
+struct CellObject : public HeapObject {
+    Value value;
+    
+    void children(std::vector<HeapObject*>& out) const override {
+        if (HeapObject* object = value.heap_object()) out.push_back(object);
+    }
+    void clear() override { value = Value(); }
+    size_t size_in_bytes() const override { return sizeof(*this); }
+};
+
+// A function value: the declaration plus the cells of the enclosing-function locals it uses, in
+// the order of FunctionDeclaration::captures. A recursive local function captures the cell that
+// holds itself, which is the usual source of cycles.
+struct ClosureObject : public HeapObject {
+    std::shared_ptr<const CompiledProgram> program;  // Keeps `function` alive; null for ASTs owned elsewhere
+    const FunctionDeclaration* function;
+    std::vector<std::shared_ptr<CellObject>> captures;
+    
+    ClosureObject(std::shared_ptr<const CompiledProgram> owner, const FunctionDeclaration* func)
+        : program(std::move(owner)), function(func) {}
+    
+    void children(std::vector<HeapObject*>& out) const override {
+        for (const auto& capture : captures) out.push_back(capture.get());
+    }
+    void clear() override { std::vector<std::shared_ptr<CellObject>>().swap(captures); }
+    size_t size_in_bytes() const override {
+        return sizeof(*this) + captures.capacity() * sizeof(std::shared_ptr<CellObject>);
+    }
+};
+
+class Heap {
+private:
+    mutable std::mutex mutex;  // Parallel loop workers allocate and drop objects concurrently
+    std::weak_ptr<Heap> self;
+    HeapObject* objects = nullptr;  // Every live tracked object, doubly linked
+    size_t live_objects = 0;
+    size_t live_bytes = 0;
+    size_t limit = 0;  // 0 means unlimited
+    size_t threshold = 8 << 20;
+    size_t next_collection = 8 << 20;  // The threshold, or twice what survived the last collection
+    uint64_t collections = 0;
+    uint64_t freed_objects = 0;
+    double total_pause_ms = 0;
+    double max_pause_ms = 0;
+    
+    struct Activation {
+        Heap* heap;
+        bool may_collect;
+    };
+    static Activation& active() {
+        static thread_local Activation activation = {nullptr, false};
+        return activation;
+    }
+    
+    Heap() = default;
+    
+    void add(const std::shared_ptr<HeapObject>& object, bool may_collect) {
+        bool due;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            object->heap = self.lock();
+            object->self = object;
+            object->bytes = object->size_in_bytes();
+            object->next = objects;
+            if (objects) objects->prev = object.get();
+            objects = object.get();
+            live_objects++;
+            live_bytes += object->bytes;
+            due = live_bytes >= next_collection || (limit && live_bytes > limit);
+        }
+        if (!due) return;
+        if (may_collect) collect();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (limit && live_bytes > limit) {
+            throw std::runtime_error("Heap limit of " + std::to_string(limit) + " bytes exceeded");
+        }
+    }
+    
+public:
+    static std::shared_ptr<Heap> create() {
+        std::shared_ptr<Heap> heap(new Heap());
+        heap->self = heap;
+        return heap;
+    }
+    
+    // While in scope, arrays and maps created on this thread are tracked by `heap`. Parallel loop
+    // workers pass may_collect = false: other threads are using the same objects meanwhile.
+    class Scope {
+    private:
+        Activation saved;
+    public:
+        Scope(Heap* heap, bool may_collect) : saved(active()) { active() = {heap, may_collect}; }
+        ~Scope() { active() = saved; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+    
+    // Registers a new object with the active heap, collecting first if one is due
+    static void track(const std::shared_ptr<HeapObject>& object) {
+        Activation& activation = active();
+        if (activation.heap) activation.heap->add(object, activation.may_collect);
+    }
+    
+    void remove(HeapObject* object) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (object->prev) object->prev->next = object->next;
+        else objects = object->next;
+        if (object->next) object->next->prev = object->prev;
+        live_objects--;
+        live_bytes -= object->bytes;
+    }
+    
+    // Live bytes above which allocation fails with a runtime_error once a collection can't help
+    void set_limit(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = bytes;
+    }
+    
+    // Live bytes that trigger the first collection
+    void set_collection_threshold(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threshold = next_collection = bytes;
+    }
+    
+    // Frees every tracked object that is only reachable from other garbage
+    void collect() {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<HeapObject>> garbage;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<HeapObject*> children;
+            for (HeapObject* object = objects; object; object = object->next) {
+                object->gc_refs = object->self.use_count();
+                object->reachable = false;
+            }
+            // Objects already being destroyed have a count of 0; their references are ignored,
+            // which only ever keeps their children alive for another round
+            for (HeapObject* object = objects; object; object = object->next) {
+                if (object->self.expired()) continue;
+                children.clear();
+                object->children(children);
+                for (HeapObject* child : children) {
+                    if (child->heap.get() == this) child->gc_refs--;
+                }
+            }
+            std::vector<HeapObject*> worklist;
+            for (HeapObject* object = objects; object; object = object->next) {
+                if (object->gc_refs > 0) {
+                    object->reachable = true;
+                    worklist.push_back(object);
+                }
+            }
+            while (!worklist.empty()) {
+                HeapObject* object = worklist.back();
+                worklist.pop_back();
+                children.clear();
+                object->children(children);
+                for (HeapObject* child : children) {
+                    if (child->heap.get() == this && !child->reachable) {
+                        child->reachable = true;
+                        worklist.push_back(child);
+                    }
+                }
+            }
+            for (HeapObject* object = objects; object; object = object->next) {
+                if (object->reachable) continue;
+                if (std::shared_ptr<HeapObject> strong = object->self.lock()) garbage.push_back(std::move(strong));
+            }
+        }
+        // Clearing breaks the cycles; the objects unlink themselves once `garbage` lets go of them
+        for (const auto& object : garbage) object->clear();
+        size_t freed = garbage.size();
+        garbage.clear();
+        
+        double pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        collections++;
+        freed_objects += freed;
+        total_pause_ms += pause;
+        max_pause_ms = std::max(max_pause_ms, pause);
+        next_collection = std::max(threshold, live_bytes * 2);
+    }
+    
+    void write_report(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "heap objects       " << live_objects << " (" << live_bytes << " bytes)" << std::endl;
+        out << "gc collections     " << collections << " (" << freed_objects << " objects freed from cycles)"
+            << std::endl;
+        out << std::fixed << std::setprecision(3);
+        out << "gc pause           " << total_pause_ms << " ms total, " << max_pause_ms << " ms max" << std::endl;
+    }
+};
+
+inline HeapObject::~HeapObject() {
+    if (heap) heap->remove(this);
+}
+
+inline Value::Value(std::vector<Value>&& arr) : type(ARRAY), number_value(0) {
+    COMPFOUNDATION_STAT(allocations[RuntimeStats::ARRAY_ALLOCATION]++);
+    auto object = std::make_shared<ArrayObject>(std::move(arr));
+    Heap::track(object);
+    array_object = std::move(object);
+}
+
+// A map built by C++ code, with its keys interned
+inline MapEntries intern_keys(const std::unordered_map<std::string, Value>& map) {
+    MapEntries entries;
+    for (const auto& pair : map) entries.emplace(intern(pair.first), pair.second);
+    return entries;
+}
+
+inline Value::Value(const std::unordered_map<std::string, Value>& map) : Value(intern_keys(map)) {}
+
+inline Value::Value(MapEntries&& map) : type(MAP), number_value(0) {
+    COMPFOUNDATION_STAT(allocations[RuntimeStats::MAP_ALLOCATION]++);
+    auto object = std::make_shared<MapObject>(std::move(map));
+    Heap::track(object);
+    map_object = std::move(object);
+}
+
+inline size_t Value::array_size() const {
+    return packed_value ? packed_value->size : array_elements().size();
+}
+
+inline Value Value::array_element(size_t index) const {
+    return packed_value ? Value(packed_value->data[index]) : array_object->elements[index];
+}
+
+inline const std::vector<Value>& Value::array_elements() const {
+    static const std::vector<Value> empty;
+    return array_object ? array_object->elements : empty;
+}
+
+inline const MapEntries& Value::map_entries() const {
+    static const MapEntries empty;
+    return map_object ? map_object->entries : empty;
+}
+
+inline const FunctionDeclaration* Value::function() const {
+    return closure_object ? closure_object->function : nullptr;
+}
+
+inline HeapObject* Value::heap_object() const {
+    if (array_object) return const_cast<ArrayObject*>(array_object.get());
+    if (map_object) return const_cast<MapObject*>(map_object.get());
+    return closure_object.get();
+}
+
 // AST Node base class
 class ASTNode {
 public:
+    // Position of the node's first token (the operator for binary operations); 0 when synthesized
+    int line = 0;
+    int column = 0;
+    // Index into each interpreter's table of quickened forms; -1 when the node has none
+    int quick_slot = -1;
     virtual ~ASTNode() = default;
     virtual void print(int indent = 0) const = 0;
 };
@@ -164,6 +856,8 @@ public:
 class Expression : public ASTNode {
 public:
     virtual ~Expression() = default;
+    // Type every value of this expression has, filled in by TypeInference
+    StaticType static_type = StaticType::UNKNOWN;
 };
 
 // --- JIT Symbol Table Type ---
@@ -185,7 +879,8 @@ public:
     llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
         llvm::Value* initVal = initializer->codegen(jit, symbols);
         llvm::IRBuilder<>* builder = jit.builder.get();
-        llvm::AllocaInst* alloca = builder->CreateAlloca(llvm::Type::getDoubleTy(jit.context), nullptr, name);
+        // Allocate in the entry block so declarations inside loop bodies don't grow the stack per iteration
+        llvm::AllocaInst* alloca = jit.createEntryBlockAlloca(builder->GetInsertBlock()->getParent(), name);
         builder->CreateStore(initVal, alloca);
         symbols[name] = alloca;
         return alloca;
@@ -238,12 +933,12 @@ public:
 class BinaryOperation : public Expression {
 public:
     std::unique_ptr<Expression> left;
-    std::string operator_;
+    BinaryOp op;
     std::unique_ptr<Expression> right;
-    BinaryOperation(std::unique_ptr<Expression> l, const std::string& op, std::unique_ptr<Expression> r)
-        : left(std::move(l)), operator_(op), right(std::move(r)) {}
+    BinaryOperation(std::unique_ptr<Expression> l, BinaryOp o, std::unique_ptr<Expression> r)
+        : left(std::move(l)), op(o), right(std::move(r)) {}
     void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "BinaryOperation: " << operator_ << std::endl;
+        std::cout << std::string(indent, ' ') << "BinaryOperation: " << binary_op_symbol(op) << std::endl;
         left->print(indent + 2);
         right->print(indent + 2);
     }
@@ -251,12 +946,31 @@ public:
         llvm::Value* l = left->codegen(jit, symbols);
         llvm::Value* r = right->codegen(jit, symbols);
         if (!l || !r) return nullptr;
-        if (operator_ == "+") return jit.builder->CreateFAdd(l, r, "addtmp");
-        if (operator_ == "-") return jit.builder->CreateFSub(l, r, "subtmp");
-        if (operator_ == "*") return jit.builder->CreateFMul(l, r, "multmp");
-        if (operator_ == "/") return jit.builder->CreateFDiv(l, r, "divtmp");
-        if (operator_ == "**") return nullptr; // Not implemented
-        return nullptr;
+        return emit(jit, op, l, r);
+    }
+    
+    // The operator on two doubles; also used by the element-wise kernels
+    static llvm::Value* emit(JITEngine& jit, BinaryOp op, llvm::Value* l, llvm::Value* r) {
+        // Comparisons yield 1.0 / 0.0 like the interpreter
+        llvm::Value* cmp = nullptr;
+        switch (op) {
+            case BinaryOp::ADD: return jit.builder->CreateFAdd(l, r, "addtmp");
+            case BinaryOp::SUB: return jit.builder->CreateFSub(l, r, "subtmp");
+            case BinaryOp::MUL: return jit.builder->CreateFMul(l, r, "multmp");
+            case BinaryOp::DIV: return jit.builder->CreateFDiv(l, r, "divtmp");
+            case BinaryOp::POW: {
+                llvm::Function* pow = llvm::Intrinsic::getDeclaration(jit.module.get(), llvm::Intrinsic::pow,
+                                                                      {llvm::Type::getDoubleTy(jit.context)});
+                return jit.builder->CreateCall(pow, {l, r}, "powtmp");
+            }
+            case BinaryOp::EQ: cmp = jit.builder->CreateFCmpOEQ(l, r, "cmptmp"); break;
+            case BinaryOp::NE: cmp = jit.builder->CreateFCmpUNE(l, r, "cmptmp"); break;
+            case BinaryOp::LT: cmp = jit.builder->CreateFCmpOLT(l, r, "cmptmp"); break;
+            case BinaryOp::GT: cmp = jit.builder->CreateFCmpOGT(l, r, "cmptmp"); break;
+            case BinaryOp::LE: cmp = jit.builder->CreateFCmpOLE(l, r, "cmptmp"); break;
+            case BinaryOp::GE: cmp = jit.builder->CreateFCmpOGE(l, r, "cmptmp"); break;
+        }
+        return jit.builder->CreateUIToFP(cmp, llvm::Type::getDoubleTy(jit.context), "booltmp");
     }
 };
 // --- JIT codegen for FunctionCall (update signature) ---
@@ -276,14 +990,43 @@ public:
     }
     llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
         llvm::Function* calleeF = jit.module->getFunction(function_name);
+        if (!calleeF && function_name == "len" && arguments.size() == 1) {
+            const std::string& array = static_cast<const Identifier*>(arguments[0].get())->name;
+            return jit.builder->CreateSIToFP(symbols[array + ".len"], llvm::Type::getDoubleTy(jit.context), "lentmp");
+        }
+        if (!calleeF) calleeF = math_intrinsic(jit);
         if (!calleeF) return nullptr;
+        // An array argument is a (data, length) pair of parameters, as FunctionDeclaration declares it
         std::vector<llvm::Value*> argsV;
         for (const auto& arg : arguments) {
+            if (calleeF->getFunctionType()->getParamType(argsV.size())->isPointerTy()) {
+                const std::string& array = static_cast<const Identifier*>(arg.get())->name;
+                argsV.push_back(symbols[array]);
+                argsV.push_back(symbols[array + ".len"]);
+                continue;
+            }
             argsV.push_back(arg->codegen(jit, symbols));
             if (!argsV.back()) return nullptr;
         }
         return jit.builder->CreateCall(calleeF, argsV, "calltmp");
     }
+    
+    // Math builtins compile to LLVM intrinsics once type inference has resolved the call to them
+    static bool is_math_builtin(const std::string& name, size_t argc) {
+        return ((name == "sqrt" || name == "abs" || name == "exp" || name == "log") && argc == 1) ||
+               (name == "pow" && argc == 2);
+    }
+    
+private:
+    llvm::Function* math_intrinsic(JITEngine& jit) const {
+        if (static_type != StaticType::NUMBER || !is_math_builtin(function_name, arguments.size())) return nullptr;
+        llvm::Intrinsic::ID id = function_name == "sqrt" ? llvm::Intrinsic::sqrt
+                               : function_name == "abs" ? llvm::Intrinsic::fabs
+                               : function_name == "exp" ? llvm::Intrinsic::exp
+                               : function_name == "log" ? llvm::Intrinsic::log
+                               : llvm::Intrinsic::pow;
+        return llvm::Intrinsic::getDeclaration(jit.module.get(), id, {llvm::Type::getDoubleTy(jit.context)});
+    }
 };
 
 class ArrayLiteral : public Expression {
@@ -305,9 +1048,11 @@ public:
 class MapLiteral : public Expression {
 public:
     std::vector<std::pair<std::string, std::unique_ptr<Expression>>> pairs;
+    std::vector<const InternedString*> symbols;  // Interned key of each pair
     
     void addPair(const std::string& key, std::unique_ptr<Expression> value) {
         pairs.push_back({key, std::move(value)});
+        symbols.push_back(intern(key));
     }
     
     void print(int indent = 0) const override {
@@ -332,15 +1077,60 @@ public:
         array->print(indent + 2);
         index->print(indent + 2);
     }
+    // Indexes a packed array parameter: its data pointer is the symbol, its length `<name>.len`.
+    // Indices truncate like in the interpreter, and out-of-range ones call compfoundation_index_error,
+    // which raises the interpreter's error. Counters that loop range analysis proved in bounds for
+    // this array load without a check; see ForStatement::codegen_counted.
+    llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
+        const std::string& name = static_cast<const Identifier*>(array.get())->name;
+        llvm::IRBuilder<>& builder = *jit.builder;
+        llvm::Type* doubleTy = llvm::Type::getDoubleTy(jit.context);
+        llvm::Type* i64Ty = llvm::Type::getInt64Ty(jit.context);
+        llvm::Value* data = symbols[name];
+        llvm::Value* length = symbols[name + ".len"];
+        llvm::Value* position = nullptr;
+        llvm::Value* in_bounds = nullptr;
+        auto counter = jit.integer_counters.end();
+        if (auto id = dynamic_cast<const Identifier*>(index.get())) counter = jit.integer_counters.find(id->name);
+        if (counter != jit.integer_counters.end()) {
+            position = builder.CreateLoad(i64Ty, counter->second.slot, counter->first + ".int");
+            if (!counter->second.in_bounds.count(name)) in_bounds = builder.CreateICmpULT(position, length, "inbounds");
+        } else {
+            llvm::Value* value = index->codegen(jit, symbols);
+            if (!value) return nullptr;
+            llvm::Value* truncated = builder.CreateUnaryIntrinsic(llvm::Intrinsic::trunc, value);
+            in_bounds = builder.CreateAnd(
+                builder.CreateFCmpOGE(truncated, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0))),
+                builder.CreateFCmpOLT(truncated, builder.CreateSIToFP(length, doubleTy)), "inbounds");
+            position = truncated;
+        }
+        if (in_bounds) {
+            llvm::Function* function = builder.GetInsertBlock()->getParent();
+            llvm::BasicBlock* failBB = llvm::BasicBlock::Create(jit.context, "index.error", function);
+            llvm::BasicBlock* okBB = llvm::BasicBlock::Create(jit.context, "index.ok", function);
+            builder.CreateCondBr(in_bounds, okBB, failBB);
+            builder.SetInsertPoint(failBB);
+            llvm::FunctionCallee error = jit.module->getOrInsertFunction("compfoundation_index_error",
+                llvm::FunctionType::get(llvm::Type::getVoidTy(jit.context), false));
+            llvm::cast<llvm::Function>(error.getCallee())->setDoesNotReturn();
+            builder.CreateCall(error);
+            builder.CreateUnreachable();
+            builder.SetInsertPoint(okBB);
+        }
+        if (position->getType() != i64Ty) position = builder.CreateFPToSI(position, i64Ty);
+        llvm::Value* element = builder.CreateInBoundsGEP(doubleTy, data, position, name + ".elem");
+        return builder.CreateLoad(doubleTy, element, name + "_load");
+    }
 };
 
 class MapAccess : public Expression {
 public:
     std::unique_ptr<Expression> map;
     std::string key;
+    const InternedString* symbol;  // Interned key
     
     MapAccess(std::unique_ptr<Expression> m, const std::string& k)
-        : map(std::move(m)), key(k) {}
+        : map(std::move(m)), key(k), symbol(intern(k)) {}
     
     void print(int indent = 0) const override {
         std::cout << std::string(indent, ' ') << "MapAccess: key=\"" << key << "\"" << std::endl;
@@ -388,88 +1178,579 @@ public:
     llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
         llvm::Value* last = nullptr;
         for (const auto& stmt : statements) {
+            if (jit.builder->GetInsertBlock()->getTerminator()) break; // Unreachable after return
             last = stmt->codegen(jit, symbols);
         }
         return last;
     }
 };
 
-// --- JIT codegen for FunctionDeclaration ---
-class FunctionDeclaration : public Statement {
+class ForStatement;
+
+// Shape of a for loop whose iterations are proven independent
+struct ParallelLoopPlan {
+    std::string induction_variable;
+    const Expression* start = nullptr;
+    const Expression* bound = nullptr;
+    bool inclusive = false;  // i <= bound rather than i < bound
+    double step = 1;
+    std::vector<std::pair<std::string, char>> reductions;  // variable, '+' or '*'
+    std::vector<std::string> captures;  // Outer variables the loop only reads
+};
+
+// Integers up to 2^53 in magnitude are exact doubles
+static const double exact_integer_limit = 9007199254740992.0;
+
+// A for loop whose counter can be kept as an int64: `for (let i = a; i < b; i = i + c)`, or with
+// <=, > or >= and a step of matching sign, where a and c are integer constants, b is a constant or
+// a variable, and neither the body nor a closure writes i. While the counter stays within
+// exact_integer_limit it takes the same values the double loop would. Filled in by CountedLoops.
+struct CountedLoop {
+    int64_t start = 0;
+    int64_t step = 0;  // 0 when the loop isn't counted
+    bool invariant_bound = false;  // Nothing in the loop writes b either
+};
+
+// Whether a call has no side effects. Adds the variables the callee, or anything it calls, reads
+// without declaring them to `outer_reads`.
+typedef std::function<bool(const std::string&, std::unordered_set<std::string>& outer_reads)> PureCallPredicate;
+
+bool plan_parallel_loop(const ForStatement* loop, const PureCallPredicate& is_pure_call,
+                        ParallelLoopPlan& plan, std::string& reason);
+
+extern "C" void compfoundation_parallel_for(void (*chunk)(int64_t, int64_t, double*, double*),
+                                            double start, double bound, double step, int32_t inclusive,
+                                            double* env, double* result,
+                                            int32_t reduction_count, const char* reduction_ops);
+
+// Called from JIT-compiled code on an out-of-range array index. The exception unwinds through
+// the generated frames, which have no cleanups to run.
+extern "C" [[noreturn]] void compfoundation_index_error() {
+    throw std::runtime_error("Array index out of bounds");
+}
+
+// Body invariants LICM hoisted out of a loop can raise errors (an out-of-bounds index), so, as in the
+// interpreter, they only run once the loop's first condition check passes. `enters` is that check,
+// generated before the loop; the loop itself still tests its condition as usual.
+static void codegen_hoisted_body(JITEngine& jit, JITSymbolTable& symbols, llvm::Value* enters,
+                                 const std::vector<std::unique_ptr<VariableDeclaration>>& hoisted_body) {
+    llvm::Function* function = jit.builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock* hoistBB = llvm::BasicBlock::Create(jit.context, "hoist.body", function);
+    llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(jit.context, "hoist.end", function);
+    jit.builder->CreateCondBr(enters, hoistBB, loopBB);
+    jit.builder->SetInsertPoint(hoistBB);
+    for (const auto& decl : hoisted_body) decl->codegen(jit, symbols);
+    jit.builder->CreateBr(loopBB);
+    jit.builder->SetInsertPoint(loopBB);
+}
+
+// --- JIT codegen for ForStatement ---
+class ForStatement : public Statement {
 public:
-    std::string name;
-    std::vector<std::string> parameters;
-    std::unique_ptr<BlockStatement> body;
-    FunctionDeclaration(const std::string& n) : name(n) {}
-    void addParameter(const std::string& param) {
-        parameters.push_back(param);
-    }
+    std::unique_ptr<Statement> init;
+    std::unique_ptr<Expression> condition;
+    std::unique_ptr<Statement> update;
+    std::unique_ptr<Statement> body;
+    bool is_parallel;
+    // Loop-invariant lets hoisted out of the condition (run after init) and out of the body
+    // (run before the first iteration); see LoopInvariantHoister
+    std::vector<std::unique_ptr<VariableDeclaration>> hoisted_condition;
+    std::vector<std::unique_ptr<VariableDeclaration>> hoisted_body;
+    CountedLoop counted;
+    ForStatement(std::unique_ptr<Statement> i, std::unique_ptr<Expression> c,
+                 std::unique_ptr<Statement> u, std::unique_ptr<Statement> b, bool parallel = false)
+        : init(std::move(i)), condition(std::move(c)), update(std::move(u)), body(std::move(b)),
+          is_parallel(parallel) {}
     void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "FunctionDeclaration: " << name << std::endl;
-        std::cout << std::string(indent + 2, ' ') << "Parameters: ";
-        for (size_t i = 0; i < parameters.size(); i++) {
-            std::cout << parameters[i];
-            if (i < parameters.size() - 1) std::cout << ", ";
+        std::cout << std::string(indent, ' ') << (is_parallel ? "ParallelForStatement:" : "ForStatement:") << std::endl;
+        if (init) init->print(indent + 2);
+        for (const auto& decl : hoisted_condition) decl->print(indent + 2);
+        for (const auto& decl : hoisted_body) decl->print(indent + 2);
+        if (condition) condition->print(indent + 2);
+        if (update) update->print(indent + 2);
+        body->print(indent + 2);
+    }
+    llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
+        if (is_parallel) {
+            return codegen_parallel(jit, symbols);
         }
-        std::cout << std::endl;
-        std::cout << std::string(indent + 2, ' ') << "Body:" << std::endl;
-        body->print(indent + 4);
+        if (init) init->codegen(jit, symbols);
+        for (const auto& decl : hoisted_condition) decl->codegen(jit, symbols);
+        if (!hoisted_body.empty()) {
+            llvm::Value* enters = jit.builder->getTrue();
+            if (condition) {
+                enters = condition->codegen(jit, symbols);
+                if (!enters) throw std::runtime_error("Cannot compile for loop condition");
+                enters = jit.builder->CreateFCmpUNE(enters, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)), "forenters");
+            }
+            codegen_hoisted_body(jit, symbols, enters, hoisted_body);
+        }
+        if (counted.step != 0 && counted.invariant_bound && jit.version_counted_loops) {
+            codegen_counted(jit, symbols);
+        } else {
+            codegen_loop(jit, symbols);
+        }
+        return nullptr;
     }
-    llvm::Function* codegen(JITEngine& jit) const {
-        std::vector<llvm::Type*> doubles(parameters.size(), llvm::Type::getDoubleTy(jit.context));
-        llvm::FunctionType* funcType = llvm::FunctionType::get(llvm::Type::getDoubleTy(jit.context), doubles, false);
-        llvm::Function* function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, jit.module.get());
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(jit.context, "entry", function);
-        jit.builder->SetInsertPoint(entry);
-        JITSymbolTable symbols;
-        unsigned idx = 0;
-        for (auto& arg : function->args()) {
-            arg.setName(parameters[idx]);
-            llvm::AllocaInst* alloca = jit.builder->CreateAlloca(llvm::Type::getDoubleTy(jit.context), nullptr, parameters[idx]);
-            jit.builder->CreateStore(&arg, alloca);
-            symbols[parameters[idx]] = alloca;
-            idx++;
+
+private:
+    // The condition, body and update, once init and the hoisted lets ran. Leaves the builder after the loop.
+    void codegen_loop(JITEngine& jit, JITSymbolTable& symbols) const {
+        llvm::Function* function = jit.builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock* condBB = llvm::BasicBlock::Create(jit.context, "for.cond", function);
+        llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(jit.context, "for.body", function);
+        llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(jit.context, "for.end", function);
+        jit.builder->CreateBr(condBB);
+        jit.builder->SetInsertPoint(condBB);
+        if (condition) {
+            llvm::Value* cond = condition->codegen(jit, symbols);
+            if (!cond) throw std::runtime_error("Cannot compile for loop condition");
+            cond = jit.builder->CreateFCmpUNE(cond, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)), "forcond");
+            jit.builder->CreateCondBr(cond, bodyBB, afterBB);
+        } else {
+            jit.builder->CreateBr(bodyBB);
         }
-        llvm::Value* retVal = body->codegen(jit, symbols);
-        if (!retVal) jit.builder->CreateRet(llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)));
-        return function;
+        jit.builder->SetInsertPoint(bodyBB);
+        body->codegen(jit, symbols);
+        if (!jit.builder->GetInsertBlock()->getTerminator()) {
+            if (update) update->codegen(jit, symbols);
+            jit.builder->CreateBr(condBB);
+        }
+        jit.builder->SetInsertPoint(afterBB);
     }
-};
 
-class Program : public ASTNode {
-public:
-    std::vector<std::unique_ptr<Statement>> statements;
-    
-    void addStatement(std::unique_ptr<Statement> stmt) {
-        statements.push_back(std::move(stmt));
+    // Loop range analysis for counted loops: counting up from a non-negative start while i < len(a),
+    // directly or through the hoisted let LICM made of it, keeps i within a's bounds in the body
+    std::set<std::string> arrays_in_bounds(const JITSymbolTable& symbols) const {
+        auto cond = static_cast<const BinaryOperation*>(condition.get());
+        if (counted.step <= 0 || counted.start < 0 || cond->op != BinaryOp::LT) return {};
+        const Expression* bound = cond->right.get();
+        if (auto id = dynamic_cast<const Identifier*>(bound)) {
+            bound = nullptr;
+            for (const auto& decl : hoisted_condition) {
+                if (decl->name == id->name) bound = decl->initializer.get();
+            }
+        }
+        auto call = dynamic_cast<const FunctionCall*>(bound);
+        auto array = call && call->function_name == "len" && call->arguments.size() == 1
+                         ? dynamic_cast<const Identifier*>(call->arguments[0].get()) : nullptr;
+        if (!array || !symbols.count(array->name + ".len")) return {};
+        return {array->name};
     }
-    
-    void print(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Program:" << std::endl;
-        for (const auto& stmt : statements) {
-            stmt->print(indent + 2);
+
+    // Versions a counted loop: when the bound keeps the counter within exact_integer_limit, the
+    // counter runs as an i64 induction variable compared against the bound rounded to an integer,
+    // and the double loop variable is only written for the body to read. Other bounds (huge,
+    // infinite, NaN) run the plain double loop, generated without versioning its nested loops.
+    void codegen_counted(JITEngine& jit, JITSymbolTable& symbols) const {
+        auto cond = static_cast<const BinaryOperation*>(condition.get());
+        const std::string& name = static_cast<const VariableDeclaration*>(init.get())->name;
+        llvm::IRBuilder<>& builder = *jit.builder;
+        llvm::Type* i64Ty = llvm::Type::getInt64Ty(jit.context);
+        llvm::Function* function = builder.GetInsertBlock()->getParent();
+        llvm::Value* bound = cond->right->codegen(jit, symbols);
+        if (!bound) throw std::runtime_error("Cannot compile for loop bound");
+        double limit = exact_integer_limit - std::fabs(static_cast<double>(counted.step));
+        std::set<std::string> in_bounds = arrays_in_bounds(symbols);
+        // Array lengths stay far below the limit, so a loop bounded by one always takes the integer version
+        llvm::Value* exact = builder.getTrue();
+        if (in_bounds.empty()) {
+            llvm::Value* magnitude = builder.CreateUnaryIntrinsic(llvm::Intrinsic::fabs, bound);
+            exact = builder.CreateFCmpOLE(magnitude, llvm::ConstantFP::get(jit.context, llvm::APFloat(limit)), "counter.exact");
+        }
+        llvm::BasicBlock* intBB = llvm::BasicBlock::Create(jit.context, "for.int", function);
+        llvm::BasicBlock* doubleBB = llvm::BasicBlock::Create(jit.context, "for.double", function);
+        llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(jit.context, "for.end", function);
+        builder.CreateCondBr(exact, intBB, doubleBB);
+
+        // For an integer i: i < b iff i < ceil(b), i >= b iff i >= ceil(b), and likewise with floor for <= and >
+        builder.SetInsertPoint(intBB);
+        bool round_up = cond->op == BinaryOp::LT || cond->op == BinaryOp::GE;
+        llvm::Value* rounded = builder.CreateUnaryIntrinsic(round_up ? llvm::Intrinsic::ceil : llvm::Intrinsic::floor, bound);
+        llvm::Value* last = builder.CreateFPToSI(rounded, i64Ty, "counter.bound");
+        llvm::AllocaInst* counter = jit.createEntryBlockAlloca(function, name + ".int", i64Ty);
+        builder.CreateStore(llvm::ConstantInt::get(i64Ty, counted.start, true), counter);
+        llvm::BasicBlock* condBB = llvm::BasicBlock::Create(jit.context, "for.int.cond", function);
+        llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(jit.context, "for.int.body", function);
+        builder.CreateBr(condBB);
+        builder.SetInsertPoint(condBB);
+        llvm::Value* current = builder.CreateLoad(i64Ty, counter, name + ".int");
+        llvm::Value* more;
+        switch (cond->op) {
+            case BinaryOp::LT: more = builder.CreateICmpSLT(current, last, "forcond"); break;
+            case BinaryOp::LE: more = builder.CreateICmpSLE(current, last, "forcond"); break;
+            case BinaryOp::GT: more = builder.CreateICmpSGT(current, last, "forcond"); break;
+            default: more = builder.CreateICmpSGE(current, last, "forcond"); break;
+        }
+        builder.CreateCondBr(more, bodyBB, afterBB);
+        builder.SetInsertPoint(bodyBB);
+        jit.integer_counters[name] = {counter, in_bounds};
+        body->codegen(jit, symbols);
+        jit.integer_counters.erase(name);
+        if (!builder.GetInsertBlock()->getTerminator()) {
+            llvm::Value* next = builder.CreateNSWAdd(builder.CreateLoad(i64Ty, counter),
+                                                     llvm::ConstantInt::get(i64Ty, counted.step, true), "counter.next");
+            builder.CreateStore(next, counter);
+            builder.CreateStore(builder.CreateSIToFP(next, llvm::Type::getDoubleTy(jit.context)), symbols[name]);
+            builder.CreateBr(condBB);
+        }
+        JITSymbolTable integer_symbols = symbols;
+
+        builder.SetInsertPoint(doubleBB);
+        bool versioning = jit.version_counted_loops;
+        jit.version_counted_loops = false;
+        codegen_loop(jit, symbols);
+        jit.version_counted_loops = versioning;
+        builder.CreateBr(afterBB);
+        builder.SetInsertPoint(afterBB);
+
+        // Lets in the body outlive the loop in the symbol table; give both versions the same slots
+        for (const auto& entry : integer_symbols) {
+            auto other = symbols.find(entry.first);
+            auto slot = llvm::dyn_cast<llvm::AllocaInst>(entry.second);
+            if (slot && other != symbols.end() && other->second != slot) {
+                slot->replaceAllUsesWith(other->second);
+                slot->eraseFromParent();
+            }
         }
     }
-};
 
-// Enhanced Lexer
-class Lexer {
-private:
-    std::string source;
-    size_t position;
-    int line;
-    int column;
+    // Outlines the loop into a chunk function `void(i64 begin, i64 end, double* env, double* partials)`
+    // and hands it to the work-stealing pool. env holds start, step and the captured variables;
+    // each chunk accumulates its own reduction partials which the runtime combines in chunk order.
+    llvm::Value* codegen_parallel(JITEngine& jit, JITSymbolTable& symbols) const {
+        ParallelLoopPlan plan;
+        std::string reason;
+        // JIT-compiled functions only touch their own stack slots, so every call is pure and reads nothing outside
+        if (!plan_parallel_loop(this, [](const std::string&, std::unordered_set<std::string>&) { return true; },
+                                plan, reason)) {
+            throw std::runtime_error("Cannot parallelize for loop: " + reason);
+        }
+        llvm::Type* doubleTy = llvm::Type::getDoubleTy(jit.context);
+        llvm::Type* i64Ty = llvm::Type::getInt64Ty(jit.context);
+        llvm::Type* i32Ty = llvm::Type::getInt32Ty(jit.context);
+        llvm::Type* doublePtrTy = llvm::PointerType::getUnqual(doubleTy);
+        llvm::Function* parent = jit.builder->GetInsertBlock()->getParent();
+        const size_t reductionCount = plan.reductions.size();
+        const size_t envSize = 2 + plan.captures.size();
+        for (const auto& decl : hoisted_condition) decl->codegen(jit, symbols);
+
+        llvm::Value* start = plan.start->codegen(jit, symbols);
+        llvm::Value* bound = plan.bound->codegen(jit, symbols);
+        if (!start || !bound) return nullptr;
+        if (!hoisted_body.empty()) {
+            llvm::Value* enters = plan.inclusive ? jit.builder->CreateFCmpOLE(start, bound, "parenters")
+                                                 : jit.builder->CreateFCmpOLT(start, bound, "parenters");
+            codegen_hoisted_body(jit, symbols, enters, hoisted_body);
+        }
+        llvm::Value* env = jit.createEntryBlockAlloca(parent, "par.env", doubleTy, envSize);
+        llvm::Value* result = jit.createEntryBlockAlloca(parent, "par.result", doubleTy, reductionCount + 1);
+        jit.builder->CreateStore(start, jit.builder->CreateConstGEP1_64(doubleTy, env, 0));
+        jit.builder->CreateStore(llvm::ConstantFP::get(jit.context, llvm::APFloat(plan.step)),
+                                 jit.builder->CreateConstGEP1_64(doubleTy, env, 1));
+        for (size_t c = 0; c < plan.captures.size(); c++) {
+            llvm::Value* slot = symbols[plan.captures[c]];
+            if (!slot) throw std::runtime_error("Undefined variable: " + plan.captures[c]);
+            llvm::Value* captured = jit.builder->CreateLoad(doubleTy, slot, plan.captures[c] + "_capture");
+            jit.builder->CreateStore(captured, jit.builder->CreateConstGEP1_64(doubleTy, env, 2 + c));
+        }
+        llvm::BasicBlock* resumeBB = jit.builder->GetInsertBlock();
+
+        // Chunk function
+        llvm::FunctionType* chunkTy = llvm::FunctionType::get(llvm::Type::getVoidTy(jit.context),
+            {i64Ty, i64Ty, doublePtrTy, doublePtrTy}, false);
+        llvm::Function* chunk = llvm::Function::Create(chunkTy, llvm::Function::InternalLinkage,
+            parent->getName() + ".parallel_for", jit.module.get());
+        auto argIt = chunk->arg_begin();
+        llvm::Value* begin = &*argIt++;
+        llvm::Value* end = &*argIt++;
+        llvm::Value* chunkEnv = &*argIt++;
+        llvm::Value* partials = &*argIt;
+        llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(jit.context, "entry", chunk);
+        llvm::BasicBlock* condBB = llvm::BasicBlock::Create(jit.context, "par.cond", chunk);
+        llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(jit.context, "par.body", chunk);
+        llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(jit.context, "par.exit", chunk);
+        jit.builder->SetInsertPoint(entryBB);
+        JITSymbolTable chunkSymbols;
+        for (size_t c = 0; c < plan.captures.size(); c++) {
+            llvm::AllocaInst* slot = jit.createEntryBlockAlloca(chunk, plan.captures[c]);
+            jit.builder->CreateStore(jit.builder->CreateLoad(doubleTy, jit.builder->CreateConstGEP1_64(doubleTy, chunkEnv, 2 + c)), slot);
+            chunkSymbols[plan.captures[c]] = slot;
+        }
+        for (const auto& reduction : plan.reductions) {
+            llvm::AllocaInst* slot = jit.createEntryBlockAlloca(chunk, reduction.first);
+            jit.builder->CreateStore(llvm::ConstantFP::get(jit.context, llvm::APFloat(reduction.second == '*' ? 1.0 : 0.0)), slot);
+            chunkSymbols[reduction.first] = slot;
+        }
+        llvm::Value* chunkStart = jit.builder->CreateLoad(doubleTy, jit.builder->CreateConstGEP1_64(doubleTy, chunkEnv, 0), "start");
+        llvm::Value* chunkStep = jit.builder->CreateLoad(doubleTy, jit.builder->CreateConstGEP1_64(doubleTy, chunkEnv, 1), "step");
+        llvm::AllocaInst* inductionSlot = jit.createEntryBlockAlloca(chunk, plan.induction_variable);
+        chunkSymbols[plan.induction_variable] = inductionSlot;
+        llvm::AllocaInst* counter = jit.createEntryBlockAlloca(chunk, "k", i64Ty);
+        jit.builder->CreateStore(begin, counter);
+        jit.builder->CreateBr(condBB);
+
+        jit.builder->SetInsertPoint(condBB);
+        llvm::Value* k = jit.builder->CreateLoad(i64Ty, counter, "k");
+        jit.builder->CreateCondBr(jit.builder->CreateICmpSLT(k, end), bodyBB, exitBB);
+
+        jit.builder->SetInsertPoint(bodyBB);
+        llvm::Value* iv = jit.builder->CreateFAdd(chunkStart,
+            jit.builder->CreateFMul(jit.builder->CreateSIToFP(k, doubleTy), chunkStep), plan.induction_variable);
+        jit.builder->CreateStore(iv, inductionSlot);
+        body->codegen(jit, chunkSymbols);
+        jit.builder->CreateStore(jit.builder->CreateAdd(k, llvm::ConstantInt::get(i64Ty, 1)), counter);
+        jit.builder->CreateBr(condBB);
+
+        jit.builder->SetInsertPoint(exitBB);
+        for (size_t r = 0; r < reductionCount; r++) {
+            llvm::Value* partial = jit.builder->CreateLoad(doubleTy, chunkSymbols[plan.reductions[r].first]);
+            jit.builder->CreateStore(partial, jit.builder->CreateConstGEP1_64(doubleTy, partials, r));
+        }
+        jit.builder->CreateRetVoid();
+
+        // Back in the parent: run the chunks, then fold the combined partials into the originals
+        jit.builder->SetInsertPoint(resumeBB);
+        std::string ops;
+        for (const auto& reduction : plan.reductions) ops += reduction.second;
+        llvm::FunctionCallee runtime = jit.module->getOrInsertFunction("compfoundation_parallel_for",
+            llvm::FunctionType::get(llvm::Type::getVoidTy(jit.context),
+                {chunk->getType(), doubleTy, doubleTy, doubleTy, i32Ty, doublePtrTy, doublePtrTy, i32Ty,
+                 llvm::Type::getInt8PtrTy(jit.context)}, false));
+        jit.builder->CreateCall(runtime, {chunk, start, bound, llvm::ConstantFP::get(jit.context, llvm::APFloat(plan.step)),
+            llvm::ConstantInt::get(i32Ty, plan.inclusive ? 1 : 0), env, result,
+            llvm::ConstantInt::get(i32Ty, reductionCount), jit.builder->CreateGlobalStringPtr(ops, "par.ops")});
+        for (size_t r = 0; r < reductionCount; r++) {
+            llvm::Value* slot = symbols[plan.reductions[r].first];
+            if (!slot) throw std::runtime_error("Undefined variable: " + plan.reductions[r].first);
+            llvm::Value* original = jit.builder->CreateLoad(doubleTy, slot);
+            llvm::Value* combined = jit.builder->CreateLoad(doubleTy, jit.builder->CreateConstGEP1_64(doubleTy, result, r));
+            jit.builder->CreateStore(plan.reductions[r].second == '*'
+                ? jit.builder->CreateFMul(original, combined)
+                : jit.builder->CreateFAdd(original, combined), slot);
+        }
+        return nullptr;
+    }
+};
+
+// --- JIT codegen for IfStatement ---
+class IfStatement : public Statement {
+public:
+    std::unique_ptr<Expression> condition;
+    std::unique_ptr<Statement> then_branch;
+    std::unique_ptr<Statement> else_branch;
+    IfStatement(std::unique_ptr<Expression> c, std::unique_ptr<Statement> t, std::unique_ptr<Statement> e)
+        : condition(std::move(c)), then_branch(std::move(t)), else_branch(std::move(e)) {}
+    void print(int indent = 0) const override {
+        std::cout << std::string(indent, ' ') << "IfStatement:" << std::endl;
+        condition->print(indent + 2);
+        then_branch->print(indent + 2);
+        if (else_branch) else_branch->print(indent + 2);
+    }
+    llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
+        llvm::Value* cond = condition->codegen(jit, symbols);
+        if (!cond) return nullptr;
+        cond = jit.builder->CreateFCmpUNE(cond, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)), "ifcond");
+        llvm::Function* function = jit.builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(jit.context, "if.then", function);
+        llvm::BasicBlock* elseBB = else_branch ? llvm::BasicBlock::Create(jit.context, "if.else", function) : nullptr;
+        llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(jit.context, "if.end", function);
+        jit.builder->CreateCondBr(cond, thenBB, elseBB ? elseBB : mergeBB);
+        jit.builder->SetInsertPoint(thenBB);
+        then_branch->codegen(jit, symbols);
+        if (!jit.builder->GetInsertBlock()->getTerminator()) jit.builder->CreateBr(mergeBB);
+        if (elseBB) {
+            jit.builder->SetInsertPoint(elseBB);
+            else_branch->codegen(jit, symbols);
+            if (!jit.builder->GetInsertBlock()->getTerminator()) jit.builder->CreateBr(mergeBB);
+        }
+        // Both branches may return; the merge block then has no predecessors but stays well-formed
+        jit.builder->SetInsertPoint(mergeBB);
+        return nullptr;
+    }
+};
+
+// --- JIT codegen for WhileStatement ---
+class WhileStatement : public Statement {
+public:
+    std::unique_ptr<Expression> condition;
+    std::unique_ptr<Statement> body;
+    // Loop-invariant lets hoisted out of the condition and body; see LoopInvariantHoister
+    std::vector<std::unique_ptr<VariableDeclaration>> hoisted_condition;
+    std::vector<std::unique_ptr<VariableDeclaration>> hoisted_body;
+    WhileStatement(std::unique_ptr<Expression> c, std::unique_ptr<Statement> b)
+        : condition(std::move(c)), body(std::move(b)) {}
+    void print(int indent = 0) const override {
+        std::cout << std::string(indent, ' ') << "WhileStatement:" << std::endl;
+        for (const auto& decl : hoisted_condition) decl->print(indent + 2);
+        for (const auto& decl : hoisted_body) decl->print(indent + 2);
+        condition->print(indent + 2);
+        body->print(indent + 2);
+    }
+    llvm::Value* codegen(JITEngine& jit, JITSymbolTable& symbols) const {
+        llvm::Function* function = jit.builder->GetInsertBlock()->getParent();
+        for (const auto& decl : hoisted_condition) decl->codegen(jit, symbols);
+        if (!hoisted_body.empty()) {
+            llvm::Value* enters = condition->codegen(jit, symbols);
+            if (!enters) return nullptr;
+            enters = jit.builder->CreateFCmpUNE(enters, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)), "whileenters");
+            codegen_hoisted_body(jit, symbols, enters, hoisted_body);
+        }
+        llvm::BasicBlock* condBB = llvm::BasicBlock::Create(jit.context, "while.cond", function);
+        llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(jit.context, "while.body", function);
+        llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(jit.context, "while.end", function);
+        jit.builder->CreateBr(condBB);
+        jit.builder->SetInsertPoint(condBB);
+        llvm::Value* cond = condition->codegen(jit, symbols);
+        if (!cond) return nullptr;
+        cond = jit.builder->CreateFCmpUNE(cond, llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)), "whilecond");
+        jit.builder->CreateCondBr(cond, bodyBB, afterBB);
+        jit.builder->SetInsertPoint(bodyBB);
+        body->codegen(jit, symbols);
+        if (!jit.builder->GetInsertBlock()->getTerminator()) {
+            jit.builder->CreateBr(condBB);
+        }
+        jit.builder->SetInsertPoint(afterBB);
+        return nullptr;
+    }
+};
+
+// Which parameters of a JIT-compiled function are packed arrays; defined with JITCompatibility.
+// `callee_takes_array(name, i)` tells whether a compiled callee takes argument i as an array.
+typedef std::function<bool(const std::string&, size_t)> ArrayArgumentPredicate;
+std::vector<bool> jit_array_parameters(const FunctionDeclaration* func, const ArrayArgumentPredicate& callee_takes_array);
+
+// --- JIT codegen for FunctionDeclaration ---
+class FunctionDeclaration : public Statement {
+public:
+    std::string name;
+    std::vector<std::string> parameters;
+    std::unique_ptr<BlockStatement> body;
+    StaticType return_type = StaticType::UNKNOWN;  // Filled in by TypeInference
+    // Locals of enclosing functions the body uses, and whether it assigns each; see ClosureResolver
+    std::vector<std::string> captures;
+    std::vector<bool> assigns_capture;
+    FunctionDeclaration(const std::string& n) : name(n) {}
+    void addParameter(const std::string& param) {
+        parameters.push_back(param);
+    }
+    void print(int indent = 0) const override {
+        std::cout << std::string(indent, ' ') << "FunctionDeclaration: " << name << std::endl;
+        std::cout << std::string(indent + 2, ' ') << "Parameters: ";
+        for (size_t i = 0; i < parameters.size(); i++) {
+            std::cout << parameters[i];
+            if (i < parameters.size() - 1) std::cout << ", ";
+        }
+        std::cout << std::endl;
+        if (!captures.empty()) {
+            std::cout << std::string(indent + 2, ' ') << "Captures: ";
+            for (size_t i = 0; i < captures.size(); i++) {
+                std::cout << captures[i] << (i + 1 < captures.size() ? ", " : "");
+            }
+            std::cout << std::endl;
+        }
+        std::cout << std::string(indent + 2, ' ') << "Body:" << std::endl;
+        body->print(indent + 4);
+    }
+    // Captured variables become trailing parameters of the compiled function. An array parameter
+    // becomes two, `const double* data, int64_t length`; see jit_array_parameters.
+    llvm::Function* codegen(JITEngine& jit) const {
+        COMPFOUNDATION_COMPILE_TIMER(name);
+        llvm::Type* doubleTy = llvm::Type::getDoubleTy(jit.context);
+        std::vector<bool> arrays = jit_array_parameters(this, [&jit](const std::string& callee, size_t i) {
+            llvm::Function* f = jit.module->getFunction(callee);
+            if (!f) return false;
+            size_t param = 0;
+            for (size_t a = 0; a < i && param < f->arg_size(); a++) {
+                param += f->getFunctionType()->getParamType(param)->isPointerTy() ? 2 : 1;
+            }
+            return param < f->arg_size() && f->getFunctionType()->getParamType(param)->isPointerTy();
+        });
+        std::vector<std::string> arguments;
+        std::vector<llvm::Type*> types;
+        for (size_t i = 0; i < parameters.size(); i++) {
+            arguments.push_back(parameters[i]);
+            types.push_back(arrays[i] ? llvm::PointerType::getUnqual(doubleTy) : doubleTy);
+            if (!arrays[i]) continue;
+            arguments.push_back(parameters[i] + ".len");
+            types.push_back(llvm::Type::getInt64Ty(jit.context));
+        }
+        for (const std::string& capture : captures) {
+            arguments.push_back(capture);
+            types.push_back(doubleTy);
+        }
+        llvm::FunctionType* funcType = llvm::FunctionType::get(doubleTy, types, false);
+        llvm::Function* function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, jit.module.get());
+        llvm::BasicBlock* entry = llvm::BasicBlock::Create(jit.context, "entry", function);
+        jit.builder->SetInsertPoint(entry);
+        JITSymbolTable symbols;
+        unsigned idx = 0;
+        for (auto& arg : function->args()) {
+            arg.setName(arguments[idx]);
+            // Arrays can't be assigned, so their pointer and length are used directly
+            if (arg.getType() != doubleTy) {
+                symbols[arguments[idx]] = &arg;
+                idx++;
+                continue;
+            }
+            llvm::AllocaInst* alloca = jit.builder->CreateAlloca(doubleTy, nullptr, arguments[idx]);
+            jit.builder->CreateStore(&arg, alloca);
+            symbols[arguments[idx]] = alloca;
+            idx++;
+        }
+        body->codegen(jit, symbols);
+        if (!jit.builder->GetInsertBlock()->getTerminator()) {
+            jit.builder->CreateRet(llvm::ConstantFP::get(jit.context, llvm::APFloat(0.0)));
+        }
+        return function;
+    }
+};
+
+class Program : public ASTNode {
+public:
+    std::vector<std::unique_ptr<Statement>> statements;
     
-    std::unordered_map<std::string, TokenType> keywords = {
-        {"let", TokenType::LET},
-        {"print", TokenType::PRINT},
-        {"if", TokenType::IF},
-        {"else", TokenType::ELSE},
-        {"while", TokenType::WHILE},
-        {"for", TokenType::FOR},
-        {"function", TokenType::FUNCTION},
-        {"return", TokenType::RETURN}
-    };
+    void addStatement(std::unique_ptr<Statement> stmt) {
+        statements.push_back(std::move(stmt));
+    }
+    
+    void print(int indent = 0) const override {
+        std::cout << std::string(indent, ' ') << "Program:" << std::endl;
+        for (const auto& stmt : statements) {
+            stmt->print(indent + 2);
+        }
+    }
+};
+
+// Enhanced Lexer
+class Lexer {
+private:
+    std::string source;
+    size_t position;
+    int line;
+    int column;
+    
+    // Keywords by length first, so most identifiers are rejected without a string compare
+    static TokenType keyword_or_identifier(const std::string& id) {
+        switch (id.size()) {
+            case 2: if (id == "if") return TokenType::IF; break;
+            case 3:
+                if (id == "let") return TokenType::LET;
+                if (id == "for") return TokenType::FOR;
+                break;
+            case 4: if (id == "else") return TokenType::ELSE; break;
+            case 5:
+                if (id == "print") return TokenType::PRINT;
+                if (id == "while") return TokenType::WHILE;
+                break;
+            case 6: if (id == "return") return TokenType::RETURN; break;
+            case 8:
+                if (id == "function") return TokenType::FUNCTION;
+                if (id == "parallel") return TokenType::PARALLEL;
+                break;
+        }
+        return TokenType::IDENTIFIER;
+    }
     
     char current_char() const {
         if (position >= source.length()) return '\0';
@@ -494,36 +1775,50 @@ private:
     }
     
     void skip_whitespace() {
-        while (std::isspace(current_char())) {
-            advance();
+        while (position < source.length()) {
+            char ch = source[position];
+            if (ch == '\n') {
+                line++;
+                column = 1;
+            } else if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f') {
+                column++;
+            } else {
+                break;
+            }
+            position++;
         }
     }
     
-    void skip_comment() {
-        // Skip single-line comment
-        if (current_char() == '/' && peek_char() == '/') {
+    // Whitespace and any number of single-line comments
+    void skip_trivia() {
+        skip_whitespace();
+        while (current_char() == '/' && peek_char() == '/') {
             while (current_char() != '\n' && current_char() != '\0') {
                 advance();
             }
+            skip_whitespace();
         }
     }
     
+    // Numbers and identifiers never span lines, so these scan ahead and copy the run once
     std::string read_number() {
-        std::string result;
-        while (std::isdigit(current_char()) || current_char() == '.') {
-            result += current_char();
-            advance();
+        size_t start = position;
+        while (position < source.length() && (std::isdigit(static_cast<unsigned char>(source[position])) ||
+                                              source[position] == '.')) {
+            position++;
         }
-        return result;
+        column += static_cast<int>(position - start);
+        return source.substr(start, position - start);
     }
     
     std::string read_identifier() {
-        std::string result;
-        while (std::isalnum(current_char()) || current_char() == '_') {
-            result += current_char();
-            advance();
+        size_t start = position;
+        while (position < source.length() && (std::isalnum(static_cast<unsigned char>(source[position])) ||
+                                              source[position] == '_')) {
+            position++;
         }
-        return result;
+        column += static_cast<int>(position - start);
+        return source.substr(start, position - start);
     }
     
     std::string read_string() {
@@ -550,14 +1845,7 @@ private:
         return result;
     }
     
-public:
-    Lexer(const std::string& src) : source(src), position(0), line(1), column(1) {}
-    
-    Token next_token() {
-        skip_whitespace();
-        skip_comment();
-        skip_whitespace();
-        
+    Token scan_token() {
         if (position >= source.length()) {
             return Token(TokenType::EOF_TOKEN, "", line, column);
         }
@@ -577,8 +1865,8 @@ public:
         // Identifiers and keywords
         if (std::isalpha(ch) || ch == '_') {
             std::string id = read_identifier();
-            TokenType type = keywords.count(id) ? keywords[id] : TokenType::IDENTIFIER;
-            return Token(type, id, line, column);
+            TokenType type = keyword_or_identifier(id);
+            return Token(type, std::move(id), line, column);
         }
         
         // Two-character operators
@@ -627,15 +1915,96 @@ public:
                 return Token(TokenType::INVALID, std::string(1, ch), line, column - 1);
         }
     }
+    
+public:
+    Lexer(const std::string& src) : source(src), position(0), line(1), column(1) {}
+    
+    // Every token is positioned at its first character
+    Token next_token() {
+        skip_trivia();
+        int start_line = line;
+        int start_column = column;
+        size_t start = position;
+        Token token = scan_token();
+        token.line = start_line;
+        token.column = start_column;
+        token.length = static_cast<int>(position - start);
+        return token;
+    }
+};
+
+// --- Diagnostics ---
+// A problem found in a script, positioned at the offending token
+struct Diagnostic {
+    int line;
+    int column;
+    int length;
+    std::string message;
+};
+
+// "line:column: message", then the source line with the span underlined when the source is known
+inline void write_diagnostic(std::ostream& out, const std::string& path, const std::string& source,
+                             const Diagnostic& diagnostic) {
+    if (!path.empty()) out << path << ":";
+    out << diagnostic.line << ":" << diagnostic.column << ": error: " << diagnostic.message << "\n";
+    if (source.empty() || diagnostic.line <= 0) return;
+    size_t begin = 0;
+    for (int l = 1; l < diagnostic.line && begin != std::string::npos; l++) {
+        begin = source.find('\n', begin);
+        if (begin != std::string::npos) begin++;
+    }
+    if (begin == std::string::npos) return;
+    size_t end = source.find('\n', begin);
+    std::string text = source.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    out << "  " << text << "\n  ";
+    for (int c = 1; c < diagnostic.column; c++) out << (c - 1 < static_cast<int>(text.size()) && text[c - 1] == '\t' ? '\t' : ' ');
+    out << "^" << std::string(std::max(diagnostic.length, 1) - 1, '~') << "\n";
+}
+
+// Binding strength of each binary operator token; 0 for tokens that don't continue an expression
+struct BinaryOperator {
+    int precedence;
+    BinaryOp op;
 };
 
+static const std::array<BinaryOperator, static_cast<size_t>(TokenType::INVALID) + 1> binary_operators = [] {
+    std::array<BinaryOperator, static_cast<size_t>(TokenType::INVALID) + 1> table{};
+    auto set = [&](TokenType type, int precedence, BinaryOp op) {
+        table[static_cast<size_t>(type)] = {precedence, op};
+    };
+    set(TokenType::EQUAL, 1, BinaryOp::EQ);
+    set(TokenType::NOT_EQUAL, 1, BinaryOp::NE);
+    set(TokenType::LESS_THAN, 1, BinaryOp::LT);
+    set(TokenType::GREATER_THAN, 1, BinaryOp::GT);
+    set(TokenType::LESS_EQUAL, 1, BinaryOp::LE);
+    set(TokenType::GREATER_EQUAL, 1, BinaryOp::GE);
+    set(TokenType::PLUS, 2, BinaryOp::ADD);
+    set(TokenType::MINUS, 2, BinaryOp::SUB);
+    set(TokenType::MULTIPLY, 3, BinaryOp::MUL);
+    set(TokenType::DIVIDE, 3, BinaryOp::DIV);
+    set(TokenType::POWER, 4, BinaryOp::POW);
+    return table;
+}();
+
 // Enhanced Parser
+// Errors don't throw while parsing: the first one in a statement is recorded and the rest of the
+// statement is parsed in panic mode, with placeholders for anything missing and further errors
+// suppressed, then the parser skips ahead to the next statement boundary (after a ';', before a
+// '}' or a statement keyword) and carries on. parse() throws once at the end if anything failed.
 class Parser {
 private:
     Lexer& lexer;
     Token current_token;
+    TokenType previous_type = TokenType::INVALID;
+    std::vector<Diagnostic> errors;
+    bool panicking = false;
+    int brace_depth = 0;  // '{' consumed and not yet closed, blocks and map literals alike
+    int block_depth = 0;  // Of those, the ones parse_block opened
     
     void advance() {
+        if (current_token.type == TokenType::LBRACE) brace_depth++;
+        if (current_token.type == TokenType::RBRACE) brace_depth--;
+        previous_type = current_token.type;
         current_token = lexer.next_token();
     }
     
@@ -647,28 +2016,91 @@ private:
         return false;
     }
     
-    void expect(TokenType type) {
-        if (current_token.type != type) {
-            throw std::runtime_error("Expected token type, got: " + current_token.value);
+    static std::string describe(TokenType type) {
+        switch (type) {
+            case TokenType::NUMBER: return "number";
+            case TokenType::STRING_LITERAL: return "string";
+            case TokenType::IDENTIFIER: return "identifier";
+            case TokenType::SEMICOLON: return "';'";
+            case TokenType::LPAREN: return "'('";
+            case TokenType::RPAREN: return "')'";
+            case TokenType::LBRACE: return "'{'";
+            case TokenType::RBRACE: return "'}'";
+            case TokenType::LBRACKET: return "'['";
+            case TokenType::RBRACKET: return "']'";
+            case TokenType::COMMA: return "','";
+            case TokenType::COLON: return "':'";
+            case TokenType::ASSIGN: return "'='";
+            case TokenType::EOF_TOKEN: return "end of input";
+            default: return "token";
         }
-        advance();
+    }
+    
+    static std::string describe(const Token& token) {
+        if (token.type == TokenType::EOF_TOKEN) return "end of input";
+        if (token.type == TokenType::STRING_LITERAL) return "string \"" + token.value + "\"";
+        return "'" + token.value + "'";
+    }
+    
+    void error(const Token& at, const std::string& message) {
+        if (panicking) return;
+        panicking = true;
+        errors.push_back({at.line, at.column, at.length, message});
+    }
+    
+    bool expect(TokenType type) {
+        if (current_token.type == type) {
+            advance();
+            return true;
+        }
+        error(current_token, "expected " + describe(type) + ", got " + describe(current_token));
+        return false;
+    }
+    
+    static bool starts_statement(TokenType type) {
+        return type == TokenType::LET || type == TokenType::PRINT || type == TokenType::IF ||
+               type == TokenType::WHILE || type == TokenType::FOR || type == TokenType::PARALLEL ||
+               type == TokenType::FUNCTION || type == TokenType::RETURN;
+    }
+    
+    // Leaves panic mode at the next statement boundary. A '}' only counts if it closes a block;
+    // the brace of a half-parsed map literal is skipped.
+    void synchronize() {
+        if (previous_type != TokenType::SEMICOLON && previous_type != TokenType::RBRACE) {
+            while (current_token.type != TokenType::EOF_TOKEN && !starts_statement(current_token.type)) {
+                if (current_token.type == TokenType::RBRACE && brace_depth <= block_depth) break;
+                bool boundary = current_token.type == TokenType::SEMICOLON;
+                advance();
+                if (boundary) break;
+            }
+        }
+        panicking = false;
     }
     
     std::unique_ptr<Expression> parse_primary() {
+        int line = current_token.line;
+        int column = current_token.column;
+        auto expr = parse_primary_unlocated();
+        expr->line = line;
+        expr->column = column;
+        return expr;
+    }
+    
+    std::unique_ptr<Expression> parse_primary_unlocated() {
         if (current_token.type == TokenType::NUMBER) {
-            double value = std::stod(current_token.value);
+            double value = std::strtod(current_token.value.c_str(), nullptr);
             advance();
             return std::make_unique<NumberLiteral>(value);
         }
         
         if (current_token.type == TokenType::STRING_LITERAL) {
-            std::string value = current_token.value;
+            std::string value = std::move(current_token.value);
             advance();
             return std::make_unique<StringLiteral>(value);
         }
         
         if (current_token.type == TokenType::IDENTIFIER) {
-            std::string name = current_token.value;
+            std::string name = std::move(current_token.value);
             advance();
             
             // Function call
@@ -693,7 +2125,7 @@ private:
                 
                 // Check if it's a string key (map access)
                 if (current_token.type == TokenType::STRING_LITERAL) {
-                    std::string key = current_token.value;
+                    std::string key = std::move(current_token.value);
                     advance();
                     expect(TokenType::RBRACKET);
                     return std::make_unique<MapAccess>(std::move(identifier), key);
@@ -728,7 +2160,8 @@ private:
                 // Parse key-value pairs
                 do {
                     if (current_token.type != TokenType::STRING_LITERAL) {
-                        throw std::runtime_error("Expected string key in map literal");
+                        error(current_token, "expected string key in map literal, got " + describe(current_token));
+                        break;
                     }
                     std::string key = current_token.value;
                     advance();
@@ -747,75 +2180,43 @@ private:
             return expr;
         }
         
-        throw std::runtime_error("Unexpected token: " + current_token.value);
+        error(current_token, "expected an expression, got " + describe(current_token));
+        return std::make_unique<NumberLiteral>(0);
     }
     
-    std::unique_ptr<Expression> parse_power() {
+    // Precedence climbing over the operator table: binds every operator tighter than
+    // min_precedence, then returns at the first token that isn't one. All levels are left-associative.
+    std::unique_ptr<Expression> parse_expression(int min_precedence = 1) {
         auto left = parse_primary();
-        
-        while (current_token.type == TokenType::POWER) {
-            std::string op = current_token.value;
-            advance();
-            auto right = parse_primary();
-            left = std::make_unique<BinaryOperation>(std::move(left), op, std::move(right));
-        }
-        
-        return left;
-    }
-    
-    std::unique_ptr<Expression> parse_term() {
-        auto left = parse_power();
-        
-        while (current_token.type == TokenType::MULTIPLY || 
-               current_token.type == TokenType::DIVIDE) {
-            std::string op = current_token.value;
+        for (;;) {
+            const BinaryOperator& info = binary_operators[static_cast<size_t>(current_token.type)];
+            if (info.precedence < min_precedence) return left;
+            int line = current_token.line;
+            int column = current_token.column;
             advance();
-            auto right = parse_power();
-            left = std::make_unique<BinaryOperation>(std::move(left), op, std::move(right));
+            auto right = parse_expression(info.precedence + 1);
+            left = std::make_unique<BinaryOperation>(std::move(left), info.op, std::move(right));
+            left->line = line;
+            left->column = column;
         }
-        
-        return left;
-    }
-    
-    std::unique_ptr<Expression> parse_arithmetic() {
-        auto left = parse_term();
-        
-        while (current_token.type == TokenType::PLUS || 
-               current_token.type == TokenType::MINUS) {
-            std::string op = current_token.value;
-            advance();
-            auto right = parse_term();
-            left = std::make_unique<BinaryOperation>(std::move(left), op, std::move(right));
-        }
-        
-        return left;
-    }
-    
-    std::unique_ptr<Expression> parse_expression() {
-        auto left = parse_arithmetic();
-        
-        while (current_token.type == TokenType::EQUAL || 
-               current_token.type == TokenType::NOT_EQUAL ||
-               current_token.type == TokenType::LESS_THAN ||
-               current_token.type == TokenType::GREATER_THAN ||
-               current_token.type == TokenType::LESS_EQUAL ||
-               current_token.type == TokenType::GREATER_EQUAL) {
-            std::string op = current_token.value;
-            advance();
-            auto right = parse_arithmetic();
-            left = std::make_unique<BinaryOperation>(std::move(left), op, std::move(right));
-        }
-        
-        return left;
     }
     
     std::unique_ptr<Statement> parse_block() {
         auto block = std::make_unique<BlockStatement>();
-        expect(TokenType::LBRACE);
+        if (!expect(TokenType::LBRACE)) {
+            // Most likely a braceless body: take one statement rather than the rest of the file
+            block->addStatement(parse_statement());
+            return std::move(block);
+        }
         
+        // The braces delimit the body, so an error in the header doesn't mute errors inside it
+        panicking = false;
+        block_depth++;
         while (current_token.type != TokenType::RBRACE && current_token.type != TokenType::EOF_TOKEN) {
             block->addStatement(parse_statement());
+            if (panicking) synchronize();
         }
+        block_depth--;
         
         expect(TokenType::RBRACE);
         return std::move(block);
@@ -841,10 +2242,51 @@ private:
         return nullptr;
     }
     
+    // Parses the remainder of a for loop after the 'for' keyword
+    std::unique_ptr<Statement> parse_for(bool parallel) {
+        expect(TokenType::LPAREN);
+        
+        auto init = parse_for_init();
+        expect(TokenType::SEMICOLON);
+        
+        std::unique_ptr<Expression> condition = nullptr;
+        if (current_token.type != TokenType::SEMICOLON) {
+            condition = parse_expression();
+        }
+        expect(TokenType::SEMICOLON);
+        
+        std::unique_ptr<Statement> update = nullptr;
+        if (current_token.type != TokenType::RPAREN) {
+            if (current_token.type == TokenType::IDENTIFIER) {
+                std::string name = current_token.value;
+                advance();
+                expect(TokenType::ASSIGN);
+                auto value = parse_expression();
+                update = std::make_unique<AssignmentStatement>(name, std::move(value));
+            }
+        }
+        expect(TokenType::RPAREN);
+        
+        auto body = parse_block();
+        
+        return std::make_unique<ForStatement>(std::move(init), std::move(condition), 
+                                          std::move(update), std::move(body), parallel);
+    }
+    
     std::unique_ptr<Statement> parse_statement() {
+        int line = current_token.line;
+        int column = current_token.column;
+        auto stmt = parse_statement_unlocated();
+        stmt->line = line;
+        stmt->column = column;
+        return stmt;
+    }
+    
+    std::unique_ptr<Statement> parse_statement_unlocated() {
         if (match(TokenType::LET)) {
             if (current_token.type != TokenType::IDENTIFIER) {
-                throw std::runtime_error("Expected identifier after 'let'");
+                error(current_token, "expected a variable name after 'let', got " + describe(current_token));
+                return std::make_unique<BlockStatement>();
             }
             std::string name = current_token.value;
             advance();
@@ -891,33 +2333,15 @@ private:
         }
         
         if (match(TokenType::FOR)) {
-            expect(TokenType::LPAREN);
-            
-            auto init = parse_for_init();
-            expect(TokenType::SEMICOLON);
-            
-            std::unique_ptr<Expression> condition = nullptr;
-            if (current_token.type != TokenType::SEMICOLON) {
-                condition = parse_expression();
-            }
-            expect(TokenType::SEMICOLON);
-            
-            std::unique_ptr<Statement> update = nullptr;
-            if (current_token.type != TokenType::RPAREN) {
-                if (current_token.type == TokenType::IDENTIFIER) {
-                    std::string name = current_token.value;
-                    advance();
-                    expect(TokenType::ASSIGN);
-                    auto value = parse_expression();
-                    update = std::make_unique<AssignmentStatement>(name, std::move(value));
-                }
+            return parse_for(false);
+        }
+        
+        if (match(TokenType::PARALLEL)) {
+            if (!match(TokenType::FOR)) {
+                error(current_token, "expected 'for' after 'parallel', got " + describe(current_token));
+                return std::make_unique<BlockStatement>();
             }
-            expect(TokenType::RPAREN);
-            
-            auto body = parse_block();
-            
-            return std::make_unique<ForStatement>(std::move(init), std::move(condition), 
-                                                  std::move(update), std::move(body));
+            return parse_for(true);
         }
         
         if (match(TokenType::FUNCTION)) {
@@ -964,7 +2388,12 @@ private:
             return std::make_unique<AssignmentStatement>(name, std::move(value));
         }
         
-        throw std::runtime_error("Unexpected statement: " + current_token.value);
+        // Consume the token so recovery always makes progress
+        error(current_token, current_token.type == TokenType::INVALID
+                                 ? "unexpected character " + describe(current_token)
+                                 : "expected a statement, got " + describe(current_token));
+        if (current_token.type != TokenType::EOF_TOKEN) advance();
+        return std::make_unique<BlockStatement>();
     }
     
 public:
@@ -972,479 +2401,6505 @@ public:
         advance();
     }
     
-    std::unique_ptr<Program> parse() {
+    // Parses everything, recovering from errors; the program is only meaningful if diagnostics()
+    // is empty afterwards
+    std::unique_ptr<Program> parse_recovering() {
         auto program = std::make_unique<Program>();
         
         while (current_token.type != TokenType::EOF_TOKEN) {
             program->addStatement(parse_statement());
+            if (panicking) synchronize();
         }
         
         return program;
     }
-};
-
-// Return value for functions
-struct ReturnValue {
-    Value value;
-    bool has_value;
     
-    ReturnValue() : has_value(false) {}
-    ReturnValue(const Value& v) : value(v), has_value(true) {}
+    const std::vector<Diagnostic>& diagnostics() const { return errors; }
+    
+    // Throws one error listing every diagnostic if the source has problems
+    std::unique_ptr<Program> parse() {
+        auto program = parse_recovering();
+        if (!errors.empty()) {
+            std::ostringstream message;
+            for (size_t i = 0; i < errors.size(); i++) {
+                message << (i ? "\n" : "") << "line " << errors[i].line << ", column " << errors[i].column
+                        << ": " << errors[i].message;
+            }
+            throw std::runtime_error(message.str());
+        }
+        return program;
+    }
 };
 
-class Interpreter {
-private:
-    std::unordered_map<std::string, Value> global_variables;
-    std::vector<std::unordered_map<std::string, Value>> local_scopes;
-    bool in_function = false;
-    ReturnValue return_value;
+// --- Loop dependence analysis ---
+// Summary of what a statement or expression tree declares, reads, writes and calls
+struct EffectSummary {
+    std::unordered_set<std::string> declared;
+    std::unordered_set<std::string> assigned;
+    std::unordered_map<std::string, int> reads;
+    std::vector<std::string> read_order;  // Distinct reads in order of first appearance
+    std::unordered_set<std::string> calls;
+    std::vector<const AssignmentStatement*> assignments;
+    bool prints = false;
+    bool returns = false;
+    bool declares_functions = false;
+    bool unknown = false;  // Hit a node the walker does not understand
     
-    Value& get_variable(const std::string& name) {
-        // Check local scopes from innermost to outermost
-        for (auto it = local_scopes.rbegin(); it != local_scopes.rend(); ++it) {
-            if (it->find(name) != it->end()) {
-                return (*it)[name];
-            }
+    void add_expression(const Expression* expr) {
+        if (!expr) return;
+        if (dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr)) {
+            return;
         }
-        // Check global scope
-        if (global_variables.find(name) != global_variables.end()) {
-            return global_variables[name];
+        if (auto id = dynamic_cast<const Identifier*>(expr)) {
+            if (reads[id->name]++ == 0) read_order.push_back(id->name);
+        } else if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            add_expression(binop->left.get());
+            add_expression(binop->right.get());
+        } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            calls.insert(call->function_name);
+            for (const auto& arg : call->arguments) add_expression(arg.get());
+        } else if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+            for (const auto& elem : arr->elements) add_expression(elem.get());
+        } else if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+            for (const auto& pair : map->pairs) add_expression(pair.second.get());
+        } else if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            add_expression(access->array.get());
+            add_expression(access->index.get());
+        } else if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+            add_expression(access->map.get());
+        } else {
+            unknown = true;
         }
-        throw std::runtime_error("Undefined variable: " + name);
     }
     
-    void set_variable(const std::string& name, const Value& value) {
-        // If in local scope, set in the innermost scope
-        if (!local_scopes.empty()) {
-            local_scopes.back()[name] = value;
+    void add_statement(const Statement* stmt) {
+        if (!stmt) return;
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            declared.insert(vardecl->name);
+            add_expression(vardecl->initializer.get());
+        } else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            assigned.insert(assignment->variable_name);
+            assignments.push_back(assignment);
+            add_expression(assignment->value.get());
+        } else if (auto print = dynamic_cast<const PrintStatement*>(stmt)) {
+            prints = true;
+            add_expression(print->expression.get());
+        } else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) add_statement(s.get());
+        } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            add_expression(if_stmt->condition.get());
+            add_statement(if_stmt->then_branch.get());
+            add_statement(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            for (const auto& decl : while_stmt->hoisted_condition) add_statement(decl.get());
+            for (const auto& decl : while_stmt->hoisted_body) add_statement(decl.get());
+            add_expression(while_stmt->condition.get());
+            add_statement(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            add_statement(for_stmt->init.get());
+            for (const auto& decl : for_stmt->hoisted_condition) add_statement(decl.get());
+            for (const auto& decl : for_stmt->hoisted_body) add_statement(decl.get());
+            add_expression(for_stmt->condition.get());
+            add_statement(for_stmt->update.get());
+            add_statement(for_stmt->body.get());
+        } else if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
+            returns = true;
+            add_expression(ret_stmt->value.get());
+        } else if (dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            declares_functions = true;
         } else {
-            global_variables[name] = value;
+            unknown = true;
         }
     }
-    
-    Value call_builtin_function(const std::string& name, const std::vector<Value>& args) {
-        // Math functions
-        if (name == "sqrt" && args.size() == 1 && args[0].type == Value::NUMBER) {
-            return Value(std::sqrt(args[0].number_value));
+};
+
+// Decides whether the iterations of a for loop can run in any order. The loop must have the
+// canonical shape `for (let i = a; i < b; i = i + c)` with a positive integer step, and the body
+// may only write variables it declares itself plus reduction variables updated as `x = x + e`,
+// `x = x - e` or `x = x * e` that are read nowhere else in the loop, not even by its callees.
+bool plan_parallel_loop(const ForStatement* loop, const PureCallPredicate& is_pure_call,
+                        ParallelLoopPlan& plan, std::string& reason) {
+    auto init = dynamic_cast<const VariableDeclaration*>(loop->init.get());
+    if (!init) {
+        reason = "loop variable must be declared with let";
+        return false;
+    }
+    plan.induction_variable = init->name;
+    plan.start = init->initializer.get();
+    
+    auto cond = dynamic_cast<const BinaryOperation*>(loop->condition.get());
+    auto cond_var = cond ? dynamic_cast<const Identifier*>(cond->left.get()) : nullptr;
+    if (!cond_var || cond_var->name != plan.induction_variable ||
+        (cond->op != BinaryOp::LT && cond->op != BinaryOp::LE)) {
+        reason = "condition must be " + plan.induction_variable + " < bound or " + plan.induction_variable + " <= bound";
+        return false;
+    }
+    plan.bound = cond->right.get();
+    plan.inclusive = cond->op == BinaryOp::LE;
+    
+    auto update = dynamic_cast<const AssignmentStatement*>(loop->update.get());
+    auto step = update ? dynamic_cast<const BinaryOperation*>(update->value.get()) : nullptr;
+    auto step_var = step ? dynamic_cast<const Identifier*>(step->left.get()) : nullptr;
+    auto step_size = step ? dynamic_cast<const NumberLiteral*>(step->right.get()) : nullptr;
+    if (!update || update->variable_name != plan.induction_variable || !step || step->op != BinaryOp::ADD ||
+        !step_var || step_var->name != plan.induction_variable || !step_size || step_size->value <= 0 ||
+        std::trunc(step_size->value) != step_size->value) {
+        reason = "update must be " + plan.induction_variable + " = " + plan.induction_variable + " + <positive integer>";
+        return false;
+    }
+    plan.step = step_size->value;
+    
+    EffectSummary body;
+    body.add_statement(loop->body.get());
+    if (body.unknown) {
+        reason = "unsupported statement in loop body";
+        return false;
+    }
+    if (body.prints) {
+        reason = "print has ordered side effects";
+        return false;
+    }
+    if (body.returns || body.declares_functions) {
+        reason = "loop body may not return or declare functions";
+        return false;
+    }
+    if (body.declared.count(plan.induction_variable) || body.assigned.count(plan.induction_variable)) {
+        reason = "loop body modifies " + plan.induction_variable;
+        return false;
+    }
+    std::unordered_set<std::string> callee_reads;
+    for (const auto& name : body.calls) {
+        if (!is_pure_call(name, callee_reads)) {
+            reason = "call to " + name + " may have side effects";
+            return false;
         }
-        if (name == "pow" && args.size() == 2 && args[0].type == Value::NUMBER && args[1].type == Value::NUMBER) {
-            return Value(std::pow(args[0].number_value, args[1].number_value));
+    }
+    
+    // Every write to an outer variable has to be a reduction
+    std::unordered_map<std::string, int> self_reads;
+    for (const AssignmentStatement* assignment : body.assignments) {
+        const std::string& target = assignment->variable_name;
+        if (body.declared.count(target)) continue;
+        auto binop = dynamic_cast<const BinaryOperation*>(assignment->value.get());
+        auto lhs = binop ? dynamic_cast<const Identifier*>(binop->left.get()) : nullptr;
+        if (!lhs || lhs->name != target ||
+            (binop->op != BinaryOp::ADD && binop->op != BinaryOp::SUB && binop->op != BinaryOp::MUL)) {
+            reason = "loop body assigns shared variable " + target;
+            return false;
         }
-        if (name == "log" && args.size() == 1 && args[0].type == Value::NUMBER) {
-            return Value(std::log(args[0].number_value));
+        char op = binop->op == BinaryOp::MUL ? '*' : '+';
+        auto existing = std::find_if(plan.reductions.begin(), plan.reductions.end(),
+                                     [&](const std::pair<std::string, char>& r) { return r.first == target; });
+        if (existing == plan.reductions.end()) {
+            plan.reductions.push_back({target, op});
+        } else if (existing->second != op) {
+            reason = "mixed reduction operators on " + target;
+            return false;
         }
-        if (name == "exp" && args.size() == 1 && args[0].type == Value::NUMBER) {
-            return Value(std::exp(args[0].number_value));
+        self_reads[target]++;
+    }
+    for (const auto& reduction : plan.reductions) {
+        if (body.reads[reduction.first] != self_reads[reduction.first] || callee_reads.count(reduction.first)) {
+            reason = "reduction variable " + reduction.first + " is read inside the loop";
+            return false;
         }
-        if (name == "abs" && args.size() == 1 && args[0].type == Value::NUMBER) {
-            return Value(std::abs(args[0].number_value));
+    }
+    
+    // Start and bound are evaluated once, outside the chunks
+    EffectSummary range;
+    range.add_expression(plan.start);
+    range.add_expression(plan.bound);
+    std::unordered_set<std::string> range_reads;  // Evaluated before any reduction is written
+    for (const auto& name : range.calls) {
+        if (!is_pure_call(name, range_reads)) {
+            reason = "call to " + name + " may have side effects";
+            return false;
         }
-        
-        // String functions
-        if (name == "len" && args.size() == 1) {
-            if (args[0].type == Value::STRING) {
-                return Value(static_cast<double>(args[0].string_value.length()));
-            }
-            if (args[0].type == Value::ARRAY) {
-                return Value(static_cast<double>(args[0].array_value.size()));
-            }
-            if (args[0].type == Value::MAP) {
-                return Value(static_cast<double>(args[0].map_value.size()));
-            }
+    }
+    for (const auto& reduction : plan.reductions) {
+        if (range.reads.count(reduction.first)) {
+            reason = "loop bound depends on reduction variable " + reduction.first;
+            return false;
         }
-        
-        // Array statistical functions
-        if (name == "mean" && args.size() == 1 && args[0].type == Value::ARRAY) {
-            const auto& arr = args[0].array_value;
-            if (arr.empty()) return Value(0.0);
-            double sum = 0;
-            for (const auto& val : arr) {
-                if (val.type != Value::NUMBER) throw std::runtime_error("mean() requires numeric array");
-                sum += val.number_value;
-            }
-            return Value(sum / arr.size());
+    }
+    if (range.reads.count(plan.induction_variable)) {
+        reason = "loop bound depends on " + plan.induction_variable;
+        return false;
+    }
+    
+    for (const auto& name : body.read_order) {
+        if (name == plan.induction_variable || body.declared.count(name) || self_reads.count(name)) continue;
+        plan.captures.push_back(name);
+    }
+    return true;
+}
+
+// Number of iterations of `for (i = start; i < bound (or <=); i = i + step)`
+// How many of start, start + step, ... lie below bound (or up to it when inclusive), or -1 when that
+// count is infinite or does not fit in an int64
+inline int64_t trip_count(double start, double bound, double step, bool inclusive) {
+    if (!(step > 0) || !(bound >= start)) return 0;
+    double span = (bound - start) / step;
+    if (!(span < 0x1p62)) return -1;
+    return inclusive ? static_cast<int64_t>(std::floor(span)) + 1 : static_cast<int64_t>(std::ceil(span));
+}
+
+// Iterations of a parallel loop, whose workers compute i as start + k * step. That only matches the
+// sequential i = i + step when every i is an exact integer, so, as for CountedLoops, start and step
+// must be integers and the range must stay within exact_integer_limit; otherwise -1.
+inline int64_t parallel_trip_count(double start, double bound, double step, bool inclusive) {
+    int64_t count = trip_count(start, bound, step, inclusive);
+    if (count == 0) return 0;
+    if (count < 0 || std::trunc(start) != start || std::trunc(step) != step ||
+        !(std::fabs(start) <= exact_integer_limit) || !(bound <= exact_integer_limit)) {
+        return -1;
+    }
+    return count;
+}
+
+// Names the interpreter implements itself; none of them has side effects
+inline bool is_builtin_function(const std::string& name) {
+    static const std::unordered_set<std::string> builtins = {
+        "sqrt", "pow", "log", "exp", "abs", "len", "mean", "std", "max", "min", "sum", "str", "num", "range",
+        "substr", "find", "split", "join", "trim", "starts_with"
+    };
+    return builtins.count(name) > 0;
+}
+
+// --- Counted loops ---
+// Finds the for loops whose counter can run as an int64; see CountedLoop. A closure can write the
+// locals it captures whenever it is called, so loops whose counter a closure of the enclosing
+// function captures, or whose body declares a function, stay generic. Runs after ClosureResolver.
+class CountedLoops {
+private:
+    std::vector<std::unordered_set<std::string>> captured;  // Per enclosing function, what its closures capture
+    
+    // The captures of the functions declared directly in a body, which include those of theirs
+    static void collect_captures(const Statement* stmt, std::unordered_set<std::string>& out) {
+        if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) collect_captures(s.get(), out);
+        } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            collect_captures(if_stmt->then_branch.get(), out);
+            if (if_stmt->else_branch) collect_captures(if_stmt->else_branch.get(), out);
+        } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            collect_captures(while_stmt->body.get(), out);
+        } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            collect_captures(for_stmt->body.get(), out);
+        } else if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            out.insert(func->captures.begin(), func->captures.end());
         }
-        
-        if (name == "std" && args.size() == 1 && args[0].type == Value::ARRAY) {
-            const auto& arr = args[0].array_value;
-            if (arr.size() <= 1) return Value(0.0);
-            
-            double mean = 0;
-            for (const auto& val : arr) {
-                if (val.type != Value::NUMBER) throw std::runtime_error("std() requires numeric array");
-                mean += val.number_value;
-            }
-            mean /= arr.size();
-            
-            double variance = 0;
-            for (const auto& val : arr) {
-                variance += (val.number_value - mean) * (val.number_value - mean);
-            }
-            variance /= (arr.size() - 1);
-            
-            return Value(std::sqrt(variance));
+    }
+    
+    static bool integer_constant(const Expression* expr, int64_t& out) {
+        auto num = dynamic_cast<const NumberLiteral*>(expr);
+        if (!num || !(std::fabs(num->value) <= exact_integer_limit) || std::trunc(num->value) != num->value) return false;
+        out = static_cast<int64_t>(num->value);
+        return true;
+    }
+    
+    void plan(ForStatement* loop) const {
+        auto init = dynamic_cast<const VariableDeclaration*>(loop->init.get());
+        auto cond = dynamic_cast<const BinaryOperation*>(loop->condition.get());
+        auto update = dynamic_cast<const AssignmentStatement*>(loop->update.get());
+        if (loop->is_parallel || !init || !cond || !update) return;
+        const std::string& name = init->name;
+        auto counter = dynamic_cast<const Identifier*>(cond->left.get());
+        auto next = dynamic_cast<const BinaryOperation*>(update->value.get());
+        auto previous = next ? dynamic_cast<const Identifier*>(next->left.get()) : nullptr;
+        if (!counter || counter->name != name || update->variable_name != name || !previous || previous->name != name) return;
+        int64_t start, step;
+        if (!integer_constant(init->initializer.get(), start) || !integer_constant(next->right.get(), step) ||
+            step == 0 || std::llabs(step) > (int64_t(1) << 32)) {
+            return;
         }
-        
-        if (name == "max" && args.size() == 1 && args[0].type == Value::ARRAY) {
-            const auto& arr = args[0].array_value;
-            if (arr.empty()) return Value(0.0);
-            double max_val = arr[0].number_value;
-            for (const auto& val : arr) {
-                if (val.type != Value::NUMBER) throw std::runtime_error("max() requires numeric array");
-                if (val.number_value > max_val) max_val = val.number_value;
-            }
-            return Value(max_val);
+        if (next->op == BinaryOp::SUB) step = -step;
+        else if (next->op != BinaryOp::ADD) return;
+        bool upward = cond->op == BinaryOp::LT || cond->op == BinaryOp::LE;
+        bool downward = cond->op == BinaryOp::GT || cond->op == BinaryOp::GE;
+        if (!(step > 0 ? upward : downward)) return;
+        auto bound = dynamic_cast<const Identifier*>(cond->right.get());
+        if (!bound && !dynamic_cast<const NumberLiteral*>(cond->right.get())) return;
+        if (bound && bound->name == name) return;
+        EffectSummary body;
+        body.add_statement(loop->body.get());
+        if (body.unknown || body.declares_functions || body.assigned.count(name) || body.declared.count(name)) return;
+        static const std::unordered_set<std::string> none;
+        const std::unordered_set<std::string>& closures = captured.empty() ? none : captured.back();
+        if (closures.count(name)) return;
+        loop->counted.start = start;
+        loop->counted.step = step;
+        loop->counted.invariant_bound = !bound || (!body.assigned.count(bound->name) &&
+                                                   !body.declared.count(bound->name) && !closures.count(bound->name));
+    }
+    
+    void visit(Statement* stmt) {
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) visit(s.get());
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            plan(for_stmt);
+            visit(for_stmt->body.get());
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            captured.emplace_back();
+            collect_captures(func->body.get(), captured.back());
+            visit(func->body.get());
+            captured.pop_back();
         }
-        
-        if (name == "min" && args.size() == 1 && args[0].type == Value::ARRAY) {
-            const auto& arr = args[0].array_value;
-            if (arr.empty()) return Value(0.0);
-            double min_val = arr[0].number_value;
-            for (const auto& val : arr) {
-                if (val.type != Value::NUMBER) throw std::runtime_error("min() requires numeric array");
-                if (val.number_value < min_val) min_val = val.number_value;
-            }
-            return Value(min_val);
+    }
+    
+public:
+    void run(Program& program) {
+        for (auto& stmt : program.statements) visit(stmt.get());
+    }
+};
+
+// --- Closure conversion ---
+// Works out, for every function nested inside another function, which locals of the enclosing
+// functions its body uses (reads, assigns or calls). Those become the function's captures: when the
+// declaration runs, the interpreter moves each of them into a shared heap cell (declaring it first if
+// the enclosing function has not reached its let yet), and calls bind those cells in the callee's own
+// frame, so every closure over a local and the enclosing frame see the same variable. Lookups inside
+// the callee never walk the caller's scopes.
+// A function that captures a name from further out makes every function in between capture it too.
+// Names no enclosing function declares are globals or builtins. Block scopes are flattened.
+class ClosureResolver {
+private:
+    std::vector<std::unordered_set<std::string>> enclosing;  // Locals of each enclosing function
+    
+    // Declarations directly in a body: lets and nested function names, not their contents
+    static void collect(Statement* stmt, std::unordered_set<std::string>& locals,
+                        std::vector<FunctionDeclaration*>& nested) {
+        if (!stmt) return;
+        if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            locals.insert(vardecl->name);
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            locals.insert(func->name);
+            nested.push_back(func);
+        } else if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) collect(s.get(), locals, nested);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            collect(if_stmt->then_branch.get(), locals, nested);
+            collect(if_stmt->else_branch.get(), locals, nested);
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            for (auto& decl : while_stmt->hoisted_condition) locals.insert(decl->name);
+            for (auto& decl : while_stmt->hoisted_body) locals.insert(decl->name);
+            collect(while_stmt->body.get(), locals, nested);
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            collect(for_stmt->init.get(), locals, nested);
+            for (auto& decl : for_stmt->hoisted_condition) locals.insert(decl->name);
+            for (auto& decl : for_stmt->hoisted_body) locals.insert(decl->name);
+            collect(for_stmt->body.get(), locals, nested);
+        }
+    }
+    
+    bool declared_outside(const std::string& name) const {
+        for (const auto& locals : enclosing) {
+            if (locals.count(name)) return true;
         }
+        return false;
+    }
+    
+    void resolve(FunctionDeclaration* func) {
+        std::unordered_set<std::string> locals(func->parameters.begin(), func->parameters.end());
+        std::vector<FunctionDeclaration*> nested;
+        collect(func->body.get(), locals, nested);
         
-        if (name == "sum" && args.size() == 1 && args[0].type == Value::ARRAY) {
-            const auto& arr = args[0].array_value;
-            double total = 0;
-            for (const auto& val : arr) {
-                if (val.type != Value::NUMBER) throw std::runtime_error("sum() requires numeric array");
-                total += val.number_value;
-            }
-            return Value(total);
+        // Inner functions first: what they capture from further out, this function must capture too
+        EffectSummary effects;
+        effects.add_statement(func->body.get());
+        std::set<std::string> used(effects.assigned.begin(), effects.assigned.end());
+        for (const auto& read : effects.reads) used.insert(read.first);
+        used.insert(effects.calls.begin(), effects.calls.end());
+        enclosing.push_back(locals);
+        for (FunctionDeclaration* inner : nested) {
+            resolve(inner);
+            used.insert(inner->captures.begin(), inner->captures.end());
         }
+        enclosing.pop_back();
         
-        // Type conversion functions
-        if (name == "str" && args.size() == 1) {
-            return Value(args[0].to_string());
+        func->captures.clear();
+        func->assigns_capture.clear();
+        for (const auto& name : used) {
+            if (locals.count(name) || !declared_outside(name)) continue;
+            func->captures.push_back(name);
+            func->assigns_capture.push_back(effects.assigned.count(name) > 0);
+        }
+    }
+    
+    // Top-level code is not a function: functions declared there, even inside blocks, see only globals
+    void visit_top_level(Statement* stmt) {
+        std::unordered_set<std::string> ignored;
+        std::vector<FunctionDeclaration*> functions;
+        collect(stmt, ignored, functions);
+        for (FunctionDeclaration* func : functions) resolve(func);
+    }
+    
+public:
+    void run(Program& program) {
+        for (auto& stmt : program.statements) visit_top_level(stmt.get());
+    }
+};
+
+// What a function name refers to wherever it's called: top-level functions declared exactly once,
+// versus names that some let, assignment, parameter or nested function declaration rebinds
+struct ProgramBindings {
+    std::unordered_map<std::string, const FunctionDeclaration*> functions;
+    std::unordered_set<std::string> rebound;
+    
+    explicit ProgramBindings(const Program& program) {
+        for (const auto& stmt : program.statements) collect(stmt.get(), true);
+    }
+    
+    // A call that reaches the interpreter's builtin (or map/filter/reduce) under `name`
+    bool is_builtin_call(const std::string& name) const {
+        return !functions.count(name) && !rebound.count(name);
+    }
+    
+private:
+    void collect(const Statement* stmt, bool top_level) {
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            rebound.insert(vardecl->name);
+        } else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            rebound.insert(assignment->variable_name);
+        } else if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            if (!top_level || !functions.emplace(func->name, func).second) rebound.insert(func->name);
+            rebound.insert(func->parameters.begin(), func->parameters.end());
+            collect(func->body.get(), false);
+        } else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) collect(s.get(), false);
+        } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            collect(if_stmt->then_branch.get(), false);
+            if (if_stmt->else_branch) collect(if_stmt->else_branch.get(), false);
+        } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            collect(while_stmt->body.get(), false);
+        } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            if (for_stmt->init) collect(for_stmt->init.get(), false);
+            if (for_stmt->update) collect(for_stmt->update.get(), false);
+            collect(for_stmt->body.get(), false);
+        }
+    }
+};
+
+// --- Call effects ---
+// What a call by name can do, judged from ProgramBindings and the callee's body: whether it writes
+// only its own parameters and locals and never prints, and whether it reads variables it doesn't own.
+// Names some let, assignment or parameter rebinds are assumed to do anything.
+class CallEffects {
+public:
+    struct Info {
+        bool pure = true;          // Writes only its parameters and locals, never prints
+        bool reads_outer = false;  // Reads a variable that isn't its own
+    };
+    
+    explicit CallEffects(const ProgramBindings& b) : bindings(b) {}
+    
+    Info analyze(const std::string& name) {
+        std::unordered_set<std::string> visiting;
+        return analyze(name, visiting);
+    }
+    
+    // Every call in `effects` is pure
+    bool all_pure(const EffectSummary& effects) {
+        for (const auto& callee : effects.calls) {
+            if (!analyze(callee).pure) return false;
+        }
+        return true;
+    }
+    
+private:
+    const ProgramBindings& bindings;
+    std::unordered_map<std::string, Info> cache;
+    
+    Info analyze(const std::string& name, std::unordered_set<std::string>& visiting) {
+        Info info;
+        if (bindings.rebound.count(name)) {
+            info.pure = false;
+            return info;
         }
+        auto func = bindings.functions.find(name);
+        if (func == bindings.functions.end()) {
+            info.pure = is_builtin_function(name);
+            return info;
+        }
+        auto cached = cache.find(name);
+        if (cached != cache.end()) return cached->second;
+        if (!visiting.insert(name).second) return info;  // Recursive call, already being checked
         
-        if (name == "num" && args.size() == 1 && args[0].type == Value::STRING) {
-            try {
-                return Value(std::stod(args[0].string_value));
-            } catch (...) {
-                throw std::runtime_error("Cannot convert string to number: " + args[0].string_value);
+        const std::vector<std::string>& params = func->second->parameters;
+        EffectSummary effects;
+        effects.add_statement(func->second->body.get());
+        auto is_own = [&](const std::string& var) {
+            return effects.declared.count(var) || std::find(params.begin(), params.end(), var) != params.end();
+        };
+        info.pure = !effects.unknown && !effects.prints && !effects.declares_functions;
+        for (const auto& target : effects.assigned) {
+            if (!is_own(target)) info.pure = false;
+        }
+        for (const auto& var : effects.read_order) {
+            if (!is_own(var)) info.reads_outer = true;
+        }
+        for (const auto& callee : effects.calls) {
+            Info callee_info = analyze(callee, visiting);
+            info.pure = info.pure && callee_info.pure;
+            info.reads_outer = info.reads_outer || callee_info.reads_outer;
+        }
+        visiting.erase(name);
+        // Results computed inside a cycle assume the rest of the cycle is clean; only cache the root
+        if (visiting.empty()) cache[name] = info;
+        return info;
+    }
+};
+
+// --- Loop-invariant code motion ---
+// Moves subexpressions whose value cannot change inside a for or while loop, such as `len(arr)` in
+// `i < len(arr)`, into hidden lets (`$licm0`, `$licm1`, ...) computed once when the loop is entered.
+// Values are copied on assignment, so no two names alias: an expression is invariant when no
+// variable it reads is declared or assigned anywhere in the loop and each call in it goes to a
+// builtin or to a top-level function that neither writes nor reads state outside itself. Loops
+// making any call that might write outer state are left alone. Only expressions evaluated on
+// every iteration are moved: the condition, and the body statements up to the first one that can
+// return.
+class LoopInvariantHoister {
+private:
+    CallEffects calls;
+    std::unordered_set<std::string> variant;  // Names written by the loop being hoisted
+    size_t next_id = 0;
+    
+    bool is_invariant(const Expression* expr) {
+        if (dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr)) return true;
+        if (auto id = dynamic_cast<const Identifier*>(expr)) return !variant.count(id->name);
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            return is_invariant(binop->left.get()) && is_invariant(binop->right.get());
+        }
+        if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            CallEffects::Info info = calls.analyze(call->function_name);
+            if (!info.pure || info.reads_outer) return false;
+            for (const auto& arg : call->arguments) {
+                if (!is_invariant(arg.get())) return false;
             }
+            return true;
         }
-        
-        throw std::runtime_error("Unknown function: " + name);
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            return is_invariant(access->array.get()) && is_invariant(access->index.get());
+        }
+        if (auto access = dynamic_cast<const MapAccess*>(expr)) return is_invariant(access->map.get());
+        return false;
     }
     
-    Value call_user_function(FunctionDeclaration* func, const std::vector<Value>& args) {
-        if (args.size() != func->parameters.size()) {
-            throw std::runtime_error("Function " + func->name + " expects " + 
-                                   std::to_string(func->parameters.size()) + " arguments, got " + 
-                                   std::to_string(args.size()));
+    // Replaces the largest invariant subexpressions of `slot` with hidden variables. Literals and
+    // plain identifiers are already as cheap as a variable read and stay in place.
+    void hoist_expression(std::unique_ptr<Expression>& slot, std::vector<std::unique_ptr<VariableDeclaration>>& hoisted) {
+        Expression* expr = slot.get();
+        if (!expr || dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr) ||
+            dynamic_cast<const Identifier*>(expr)) {
+            return;
         }
-        
-        // Create new scope for function
-        local_scopes.push_back({});
-        
-        // Bind arguments to parameters
-        for (size_t i = 0; i < args.size(); i++) {
-            local_scopes.back()[func->parameters[i]] = args[i];
+        bool composite = dynamic_cast<const BinaryOperation*>(expr) || dynamic_cast<const FunctionCall*>(expr) ||
+                         dynamic_cast<const ArrayAccess*>(expr) || dynamic_cast<const MapAccess*>(expr);
+        if (composite && is_invariant(expr)) {
+            std::string name = "$licm" + std::to_string(next_id++);
+            auto decl = std::make_unique<VariableDeclaration>(name, std::move(slot));
+            auto use = std::make_unique<Identifier>(name);
+            decl->line = use->line = expr->line;
+            decl->column = use->column = expr->column;
+            hoisted.push_back(std::move(decl));
+            slot = std::move(use);
+            return;
         }
-        
-        // Save current function state
-        bool prev_in_function = in_function;
-        ReturnValue prev_return = return_value;
-        
-        in_function = true;
-        return_value = ReturnValue();
-        
-        // Execute function body
-        try {
-            execute_statement(func->body.get());
-        } catch (...) {
-            // Clean up and rethrow
-            local_scopes.pop_back();
-            in_function = prev_in_function;
-            return_value = prev_return;
-            throw;
+        if (auto binop = dynamic_cast<BinaryOperation*>(expr)) {
+            hoist_expression(binop->left, hoisted);
+            hoist_expression(binop->right, hoisted);
+        } else if (auto call = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : call->arguments) hoist_expression(arg, hoisted);
+        } else if (auto access = dynamic_cast<ArrayAccess*>(expr)) {
+            hoist_expression(access->array, hoisted);
+            hoist_expression(access->index, hoisted);
+        } else if (auto access = dynamic_cast<MapAccess*>(expr)) {
+            hoist_expression(access->map, hoisted);
+        } else if (auto arr = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& elem : arr->elements) hoist_expression(elem, hoisted);
+        } else if (auto map = dynamic_cast<MapLiteral*>(expr)) {
+            for (auto& pair : map->pairs) hoist_expression(pair.second, hoisted);
         }
+    }
+    
+    void hoist_loop(const Statement* loop, std::unique_ptr<Expression>* condition, Statement* body,
+                    std::vector<std::unique_ptr<VariableDeclaration>>& hoisted_condition,
+                    std::vector<std::unique_ptr<VariableDeclaration>>& hoisted_body) {
+        EffectSummary effects;
+        effects.add_statement(loop);
+        if (effects.unknown || effects.declares_functions || !calls.all_pure(effects)) return;
+        variant = effects.declared;
+        variant.insert(effects.assigned.begin(), effects.assigned.end());
         
-        // Get return value
-        Value result = return_value.has_value ? return_value.value : Value(0.0);
-        
-        // Restore previous function state
-        in_function = prev_in_function;
-        return_value = prev_return;
-        
-        // Remove function scope
-        local_scopes.pop_back();
+        hoist_expression(*condition, hoisted_condition);
         
-        return result;
+        std::vector<Statement*> prefix;
+        if (auto block = dynamic_cast<BlockStatement*>(body)) {
+            for (auto& s : block->statements) prefix.push_back(s.get());
+        } else {
+            prefix.push_back(body);
+        }
+        for (Statement* stmt : prefix) {
+            if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+                hoist_expression(vardecl->initializer, hoisted_body);
+            } else if (auto assignment = dynamic_cast<AssignmentStatement*>(stmt)) {
+                hoist_expression(assignment->value, hoisted_body);
+            } else if (auto print = dynamic_cast<PrintStatement*>(stmt)) {
+                hoist_expression(print->expression, hoisted_body);
+            } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+                hoist_expression(if_stmt->condition, hoisted_body);
+            } else if (auto ret_stmt = dynamic_cast<ReturnStatement*>(stmt)) {
+                hoist_expression(ret_stmt->value, hoisted_body);
+            }
+            EffectSummary stmt_effects;
+            stmt_effects.add_statement(stmt);
+            if (stmt_effects.returns) break;
+        }
+    }
+    
+    // Inner loops go first, so an outer loop sees their hidden lets as variables it declares
+    void visit(Statement* stmt) {
+        if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            visit(func->body.get());
+        } else if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) visit(s.get());
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            visit(while_stmt->body.get());
+            hoist_loop(while_stmt, &while_stmt->condition, while_stmt->body.get(),
+                       while_stmt->hoisted_condition, while_stmt->hoisted_body);
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->body.get());
+            hoist_loop(for_stmt, &for_stmt->condition, for_stmt->body.get(),
+                       for_stmt->hoisted_condition, for_stmt->hoisted_body);
+        }
     }
     
 public:
-    Value evaluate_expression(const Expression* expr) {
-        if (auto num = dynamic_cast<const NumberLiteral*>(expr)) {
-            return Value(num->value);
+    explicit LoopInvariantHoister(const ProgramBindings& b) : calls(b) {}
+    
+    void run(Program& program) {
+        for (auto& stmt : program.statements) visit(stmt.get());
+    }
+};
+
+// --- AST optimizer ---
+// Inlining, common subexpression elimination and dead code removal on the AST, before LICM and
+// type inference, so the interpreter and the JIT both run the result. Hidden names start with '$'
+// and can't clash with script names.
+
+// Identifiers to replace while copying an expression tree
+typedef std::unordered_map<std::string, const Expression*> Substitutions;
+
+std::unique_ptr<Expression> clone_expression(const Expression* expr, const Substitutions& substitutions) {
+    if (!expr) return nullptr;
+    std::unique_ptr<Expression> copy;
+    if (auto num = dynamic_cast<const NumberLiteral*>(expr)) {
+        copy = std::make_unique<NumberLiteral>(num->value);
+    } else if (auto str = dynamic_cast<const StringLiteral*>(expr)) {
+        copy = std::make_unique<StringLiteral>(str->value);
+    } else if (auto id = dynamic_cast<const Identifier*>(expr)) {
+        auto found = substitutions.find(id->name);
+        if (found != substitutions.end()) return clone_expression(found->second, {});
+        copy = std::make_unique<Identifier>(id->name);
+    } else if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+        copy = std::make_unique<BinaryOperation>(clone_expression(binop->left.get(), substitutions), binop->op,
+                                                 clone_expression(binop->right.get(), substitutions));
+    } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+        auto copied = std::make_unique<FunctionCall>(call->function_name);
+        for (const auto& arg : call->arguments) copied->addArgument(clone_expression(arg.get(), substitutions));
+        copy = std::move(copied);
+    } else if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+        auto copied = std::make_unique<ArrayLiteral>();
+        for (const auto& elem : arr->elements) copied->addElement(clone_expression(elem.get(), substitutions));
+        copy = std::move(copied);
+    } else if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+        auto copied = std::make_unique<MapLiteral>();
+        for (const auto& pair : map->pairs) copied->addPair(pair.first, clone_expression(pair.second.get(), substitutions));
+        copy = std::move(copied);
+    } else if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+        copy = std::make_unique<ArrayAccess>(clone_expression(access->array.get(), substitutions),
+                                             clone_expression(access->index.get(), substitutions));
+    } else if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+        copy = std::make_unique<MapAccess>(clone_expression(access->map.get(), substitutions), access->key);
+    } else {
+        throw std::runtime_error("Cannot copy expression");
+    }
+    copy->line = expr->line;
+    copy->column = expr->column;
+    return copy;
+}
+
+// Calls `fn` on each operand slot of `expr`
+template <typename Fn>
+void for_each_operand(Expression* expr, Fn fn) {
+    if (auto binop = dynamic_cast<BinaryOperation*>(expr)) {
+        fn(binop->left);
+        fn(binop->right);
+    } else if (auto call = dynamic_cast<FunctionCall*>(expr)) {
+        for (auto& arg : call->arguments) fn(arg);
+    } else if (auto arr = dynamic_cast<ArrayLiteral*>(expr)) {
+        for (auto& elem : arr->elements) fn(elem);
+    } else if (auto map = dynamic_cast<MapLiteral*>(expr)) {
+        for (auto& pair : map->pairs) fn(pair.second);
+    } else if (auto access = dynamic_cast<ArrayAccess*>(expr)) {
+        fn(access->array);
+        fn(access->index);
+    } else if (auto access = dynamic_cast<MapAccess*>(expr)) {
+        fn(access->map);
+    }
+}
+
+// Structural key of an expression tree: two trees with the same key compute the same thing
+void append_expression_key(const Expression* expr, std::string& key) {
+    auto append_name = [&key](const std::string& name) {
+        key += std::to_string(name.size());
+        key += ':';
+        key += name;
+    };
+    if (auto num = dynamic_cast<const NumberLiteral*>(expr)) {
+        uint64_t bits;
+        std::memcpy(&bits, &num->value, sizeof bits);
+        key += 'n' + std::to_string(bits) + ';';
+    } else if (auto str = dynamic_cast<const StringLiteral*>(expr)) {
+        key += 's';
+        append_name(str->value);
+    } else if (auto id = dynamic_cast<const Identifier*>(expr)) {
+        key += 'i';
+        append_name(id->name);
+    } else if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+        key += 'b' + std::to_string(static_cast<int>(binop->op)) + '(';
+        append_expression_key(binop->left.get(), key);
+        append_expression_key(binop->right.get(), key);
+        key += ')';
+    } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+        key += 'c';
+        append_name(call->function_name);
+        key += '(';
+        for (const auto& arg : call->arguments) append_expression_key(arg.get(), key);
+        key += ')';
+    } else if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+        key += '[';
+        for (const auto& elem : arr->elements) append_expression_key(elem.get(), key);
+        key += ']';
+    } else if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+        key += '{';
+        for (const auto& pair : map->pairs) {
+            append_name(pair.first);
+            append_expression_key(pair.second.get(), key);
         }
-        
-        if (auto str = dynamic_cast<const StringLiteral*>(expr)) {
-            return Value(str->value);
+        key += '}';
+    } else if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+        key += "a(";
+        append_expression_key(access->array.get(), key);
+        append_expression_key(access->index.get(), key);
+        key += ')';
+    } else if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+        key += 'm';
+        append_name(access->key);
+        key += '(';
+        append_expression_key(access->map.get(), key);
+        key += ')';
+    } else {
+        key += '?';
+    }
+}
+
+std::string expression_key(const Expression* expr) {
+    std::string key;
+    append_expression_key(expr, key);
+    return key;
+}
+
+// The expression a let, assignment, print or return evaluates, or an if's condition: the part of
+// the statement that always runs first. Null for other statements.
+std::unique_ptr<Expression>* evaluated_expression(Statement* stmt) {
+    if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) return &vardecl->initializer;
+    if (auto assignment = dynamic_cast<AssignmentStatement*>(stmt)) return &assignment->value;
+    if (auto print = dynamic_cast<PrintStatement*>(stmt)) return &print->expression;
+    if (auto ret_stmt = dynamic_cast<ReturnStatement*>(stmt)) return ret_stmt->value ? &ret_stmt->value : nullptr;
+    if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) return &if_stmt->condition;
+    return nullptr;
+}
+
+// Names a body declares in its own frame: lets, loop variables and nested function names, but not
+// what nested functions declare
+void collect_locals(const Statement* stmt, std::unordered_set<std::string>& locals) {
+    if (!stmt) return;
+    if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+        locals.insert(vardecl->name);
+    } else if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+        locals.insert(func->name);
+    } else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+        for (const auto& s : block->statements) collect_locals(s.get(), locals);
+    } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+        collect_locals(if_stmt->then_branch.get(), locals);
+        collect_locals(if_stmt->else_branch.get(), locals);
+    } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+        collect_locals(while_stmt->body.get(), locals);
+    } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+        collect_locals(for_stmt->init.get(), locals);
+        collect_locals(for_stmt->body.get(), locals);
+    }
+}
+
+// --- Function inlining ---
+// Replaces calls to small top-level functions with their bodies, saving the scope, argument vector
+// and return bookkeeping of a call. A callee qualifies when it is declared once and never rebound,
+// captures nothing, is pure (see CallEffects), can't reach itself through calls, and its body is a
+// few lets followed by `return e;`. Its parameters and lets become hidden `$inl<N>_<name>`
+// variables; literal arguments, and variable arguments the body reads, are substituted instead. When that leaves no lets,
+// the call is replaced by `e` wherever it is. Otherwise the lets go just before the calling
+// statement, which needs the call to be in the expression the statement always evaluates (see
+// evaluated_expression) and every call in that expression to be pure, so moving work ahead of
+// it changes nothing observable. A body sees only its own variables and the globals, so callees
+// reading a global that the caller shadows with a local stay calls, and top-level code only
+// inlines functions declared above it.
+class FunctionInliner {
+private:
+    static const int max_nodes = 40;  // Expression nodes in an inlinable body
+    static const int max_depth = 4;   // Calls inlined into bodies that were themselves inlined
+    
+    struct Callee {
+        const FunctionDeclaration* func;
+        std::vector<const VariableDeclaration*> lets;
+        const Expression* result;
+        std::unordered_set<std::string> free_names;  // Globals and functions the body refers to
+        std::unordered_set<std::string> own_reads;   // Parameters and lets the body reads
+    };
+    
+    const ProgramBindings& bindings;
+    CallEffects calls;
+    std::unordered_map<std::string, std::unique_ptr<Callee>> callees;  // Null when not inlinable
+    std::unordered_set<std::string> locals;  // Declared in the frame being rewritten
+    bool top_level = true;
+    std::unordered_set<std::string> declared_above;  // Top-level functions declared so far
+    size_t next_id = 0;
+    
+    static int count_nodes(const Expression* expr) {
+        int nodes = 1;
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            nodes += count_nodes(binop->left.get()) + count_nodes(binop->right.get());
+        } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            for (const auto& arg : call->arguments) nodes += count_nodes(arg.get());
+        } else if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+            for (const auto& elem : arr->elements) nodes += count_nodes(elem.get());
+        } else if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+            for (const auto& pair : map->pairs) nodes += count_nodes(pair.second.get());
+        } else if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            nodes += count_nodes(access->array.get()) + count_nodes(access->index.get());
+        } else if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+            nodes += count_nodes(access->map.get());
         }
-        
-        if (auto id = dynamic_cast<const Identifier*>(expr)) {
-            return get_variable(id->name);
+        return nodes;
+    }
+    
+    // Whether argument i can replace its parameter outright. A variable only can when the body reads
+    // the parameter: otherwise nothing would evaluate it any more, and an undefined one must still fail.
+    static bool is_simple(const Callee* callee, size_t i, const Expression* arg) {
+        if (dynamic_cast<const NumberLiteral*>(arg) || dynamic_cast<const StringLiteral*>(arg)) return true;
+        return dynamic_cast<const Identifier*>(arg) && callee->own_reads.count(callee->func->parameters[i]);
+    }
+    
+    // Whether `from` calls `target`, directly or through other top-level functions
+    bool reaches(const std::string& from, const std::string& target, std::unordered_set<std::string>& visited) const {
+        if (!visited.insert(from).second) return false;
+        auto func = bindings.functions.find(from);
+        if (func == bindings.functions.end()) return false;
+        EffectSummary effects;
+        effects.add_statement(func->second->body.get());
+        for (const auto& callee : effects.calls) {
+            if (callee == target || reaches(callee, target, visited)) return true;
         }
+        return false;
+    }
+    
+    std::unique_ptr<Callee> analyze(const std::string& name) {
+        auto func = bindings.functions.find(name);
+        if (func == bindings.functions.end() || bindings.rebound.count(name)) return nullptr;
+        const FunctionDeclaration* decl = func->second;
+        const auto& statements = decl->body->statements;
+        if (!decl->captures.empty() || statements.empty() || !calls.analyze(name).pure) return nullptr;
+        std::unordered_set<std::string> visited;
+        if (reaches(name, name, visited)) return nullptr;
         
-        if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
-            std::vector<Value> values;
-            for (const auto& elem : arr->elements) {
-                values.push_back(evaluate_expression(elem.get()));
-            }
-            return Value(values);
+        auto callee = std::make_unique<Callee>();
+        callee->func = decl;
+        std::unordered_set<std::string> own(decl->parameters.begin(), decl->parameters.end());
+        int nodes = 0;
+        for (size_t i = 0; i + 1 < statements.size(); i++) {
+            auto vardecl = dynamic_cast<const VariableDeclaration*>(statements[i].get());
+            // A let may not redeclare a parameter or an earlier let, nor be read before it runs
+            if (!vardecl || own.count(vardecl->name)) return nullptr;
+            callee->lets.push_back(vardecl);
+            own.insert(vardecl->name);
+            nodes += count_nodes(vardecl->initializer.get());
         }
+        auto ret_stmt = dynamic_cast<const ReturnStatement*>(statements.back().get());
+        if (!ret_stmt || !ret_stmt->value) return nullptr;
+        callee->result = ret_stmt->value.get();
+        nodes += count_nodes(callee->result);
+        if (nodes > max_nodes) return nullptr;
         
-        if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
-            std::unordered_map<std::string, Value> map_val;
-            for (const auto& pair : map->pairs) {
-                map_val[pair.first] = evaluate_expression(pair.second.get());
+        std::unordered_set<std::string> declared_so_far(decl->parameters.begin(), decl->parameters.end());
+        EffectSummary effects;
+        for (const VariableDeclaration* let : callee->lets) {
+            EffectSummary init;
+            init.add_expression(let->initializer.get());
+            for (const auto& read : init.read_order) {
+                if (own.count(read) && !declared_so_far.count(read)) return nullptr;
             }
-            return Value(map_val);
+            declared_so_far.insert(let->name);
+            effects.add_statement(let);
         }
-        
-        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
-            Value array_val = evaluate_expression(access->array.get());
-            Value index_val = evaluate_expression(access->index.get());
-            
-            if (array_val.type != Value::ARRAY || index_val.type != Value::NUMBER) {
-                throw std::runtime_error("Invalid array access");
+        effects.add_expression(callee->result);
+        if (effects.unknown) return nullptr;
+        for (const auto& read : effects.read_order) {
+            (own.count(read) ? callee->own_reads : callee->free_names).insert(read);
+        }
+        callee->free_names.insert(effects.calls.begin(), effects.calls.end());
+        return callee;
+    }
+    
+    const Callee* inlinable(const FunctionCall* call) {
+        auto cached = callees.find(call->function_name);
+        if (cached == callees.end()) {
+            cached = callees.emplace(call->function_name, analyze(call->function_name)).first;
+        }
+        const Callee* callee = cached->second.get();
+        if (!callee || callee->func->parameters.size() != call->arguments.size()) return nullptr;
+        if (top_level && !declared_above.count(call->function_name)) return nullptr;
+        for (const auto& name : callee->free_names) {
+            if (locals.count(name)) return nullptr;
+        }
+        return callee;
+    }
+    
+    // Inlines the calls in `slot`, innermost first. With a prelude, lets the inlined code needs are
+    // appended to it; without one, only calls that need no lets are inlined.
+    void rewrite(std::unique_ptr<Expression>& slot, std::vector<std::unique_ptr<Statement>>* prelude, int depth) {
+        Expression* expr = slot.get();
+        if (!expr) return;
+        for_each_operand(expr, [&](std::unique_ptr<Expression>& operand) { rewrite(operand, prelude, depth); });
+        if (auto call = dynamic_cast<FunctionCall*>(expr)) {
+            const Callee* callee = depth < max_depth ? inlinable(call) : nullptr;
+            if (!callee) return;
+            bool needs_lets = !callee->lets.empty();
+            for (size_t i = 0; i < call->arguments.size(); i++) {
+                if (!is_simple(callee, i, call->arguments[i].get())) needs_lets = true;
             }
+            if (needs_lets && !prelude) return;
             
-            int index = static_cast<int>(index_val.number_value);
-            if (index < 0 || index >= static_cast<int>(array_val.array_value.size())) {
-                throw std::runtime_error("Array index out of bounds");
+            std::string prefix = "$inl" + std::to_string(next_id++) + "_";
+            std::vector<std::unique_ptr<Expression>> renamed;
+            Substitutions substitutions;
+            auto bind = [&](const std::string& name, std::unique_ptr<Expression> value) {
+                auto let = std::make_unique<VariableDeclaration>(prefix + name, std::move(value));
+                let->line = call->line;
+                let->column = call->column;
+                renamed.push_back(std::make_unique<Identifier>(prefix + name));
+                substitutions[name] = renamed.back().get();
+                prelude->push_back(std::move(let));
+            };
+            const std::vector<std::string>& params = callee->func->parameters;
+            for (size_t i = 0; i < params.size(); i++) {
+                if (is_simple(callee, i, call->arguments[i].get())) {
+                    substitutions[params[i]] = call->arguments[i].get();
+                } else {
+                    bind(params[i], std::move(call->arguments[i]));
+                }
             }
-            
-            return array_val.array_value[index];
+            for (const VariableDeclaration* let : callee->lets) {
+                std::unique_ptr<Expression> value = clone_expression(let->initializer.get(), substitutions);
+                rewrite(value, prelude, depth + 1);
+                bind(let->name, std::move(value));
+            }
+            std::unique_ptr<Expression> body = clone_expression(callee->result, substitutions);
+            rewrite(body, prelude, depth + 1);
+            slot = std::move(body);
+        }
+    }
+    
+    void visit_list(std::vector<std::unique_ptr<Statement>>& statements) {
+        std::vector<std::unique_ptr<Statement>> rewritten;
+        for (auto& stmt : statements) {
+            std::vector<std::unique_ptr<Statement>> prelude;
+            visit(stmt.get(), &prelude);
+            for (auto& let : prelude) rewritten.push_back(std::move(let));
+            rewritten.push_back(std::move(stmt));
+        }
+        statements = std::move(rewritten);
+    }
+    
+    // `prelude` is where lets may go ahead of `stmt`, or null outside a statement list
+    void visit(Statement* stmt, std::vector<std::unique_ptr<Statement>>* prelude) {
+        if (!stmt) return;
+        if (std::unique_ptr<Expression>* evaluated = evaluated_expression(stmt)) {
+            EffectSummary effects;
+            effects.add_expression(evaluated->get());
+            bool movable = prelude && !effects.unknown && calls.all_pure(effects);
+            rewrite(*evaluated, movable ? prelude : nullptr, 0);
+        }
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            visit_list(block->statements);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get(), nullptr);
+            visit(if_stmt->else_branch.get(), nullptr);
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            rewrite(while_stmt->condition, nullptr, 0);
+            visit(while_stmt->body.get(), nullptr);
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->init.get(), nullptr);
+            rewrite(for_stmt->condition, nullptr, 0);
+            visit(for_stmt->update.get(), nullptr);
+            visit(for_stmt->body.get(), nullptr);
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            std::unordered_set<std::string> outer_locals = std::move(locals);
+            bool outer_top_level = top_level;
+            locals = std::unordered_set<std::string>(func->parameters.begin(), func->parameters.end());
+            locals.insert(func->captures.begin(), func->captures.end());
+            collect_locals(func->body.get(), locals);
+            top_level = false;
+            visit_list(func->body->statements);
+            locals = std::move(outer_locals);
+            top_level = outer_top_level;
+            callees.erase(func->name);  // Its analysis pointed into the body just rewritten
+        }
+    }
+    
+public:
+    explicit FunctionInliner(const ProgramBindings& b) : bindings(b), calls(b) {}
+    
+    void run(Program& program) {
+        // Lets directly in the program are globals; those in its blocks and loops are locals
+        std::vector<std::unique_ptr<Statement>> rewritten;
+        for (auto& stmt : program.statements) {
+            locals.clear();
+            if (!dynamic_cast<const VariableDeclaration*>(stmt.get()) &&
+                !dynamic_cast<const FunctionDeclaration*>(stmt.get())) {
+                collect_locals(stmt.get(), locals);
+            }
+            std::vector<std::unique_ptr<Statement>> prelude;
+            visit(stmt.get(), &prelude);
+            for (auto& let : prelude) rewritten.push_back(std::move(let));
+            if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt.get())) declared_above.insert(func->name);
+            rewritten.push_back(std::move(stmt));
+        }
+        program.statements = std::move(rewritten);
+    }
+};
+
+// --- Common subexpression elimination ---
+// Computes an expression that a statement list evaluates more than once, like `data["scores"]`
+// used twice, into a hidden `$cse<N>` let ahead of its first use. That use must be in the
+// expression a statement always evaluates (see evaluated_expression); later uses are shared from
+// there on until a statement writes a variable the expression reads, declares a function or makes
+// an impure call. A statement that writes one still shares it in its evaluated expression, which
+// runs before the write. Only expressions that index an array or map or call a pure function
+// reading nothing but its arguments are worth a variable.
+class CommonSubexpressions {
+private:
+    CallEffects calls;
+    size_t next_id = 0;
+    
+    static bool is_leaf(const Expression* expr) {
+        return dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr) ||
+               dynamic_cast<const Identifier*>(expr);
+    }
+    
+    // Same value every time while its variables don't change; `costly` is set if it indexes or calls
+    bool is_shareable(const Expression* expr, bool& costly) {
+        if (is_leaf(expr)) return true;
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            return is_shareable(binop->left.get(), costly) && is_shareable(binop->right.get(), costly);
+        }
+        if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            CallEffects::Info info = calls.analyze(call->function_name);
+            if (!info.pure || info.reads_outer) return false;
+            costly = true;
+            for (const auto& arg : call->arguments) {
+                if (!is_shareable(arg.get(), costly)) return false;
+            }
+            return true;
+        }
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            costly = true;
+            return is_shareable(access->array.get(), costly) && is_shareable(access->index.get(), costly);
+        }
+        if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+            costly = true;
+            return is_shareable(access->map.get(), costly);
+        }
+        return false;
+    }
+    
+    // Slots worth sharing, outermost first
+    void candidates(std::unique_ptr<Expression>& slot, std::vector<std::unique_ptr<Expression>*>& out) {
+        Expression* expr = slot.get();
+        if (!expr || is_leaf(expr)) return;
+        bool costly = false;
+        if (is_shareable(expr, costly) && costly) out.push_back(&slot);
+        for_each_operand(expr, [&](std::unique_ptr<Expression>& operand) { candidates(operand, out); });
+    }
+    
+    // Slots holding a tree with `key`; a match isn't searched any further
+    void find(std::unique_ptr<Expression>& slot, const std::string& key, std::vector<std::unique_ptr<Expression>*>& out) {
+        if (!slot) return;
+        if (expression_key(slot.get()) == key) {
+            out.push_back(&slot);
+            return;
+        }
+        for_each_operand(slot.get(), [&](std::unique_ptr<Expression>& operand) { find(operand, key, out); });
+    }
+    
+    void find(Statement* stmt, const std::string& key, std::vector<std::unique_ptr<Expression>*>& out) {
+        if (!stmt) return;
+        if (std::unique_ptr<Expression>* evaluated = evaluated_expression(stmt)) find(*evaluated, key, out);
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) find(s.get(), key, out);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            find(if_stmt->then_branch.get(), key, out);
+            find(if_stmt->else_branch.get(), key, out);
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            find(while_stmt->condition, key, out);
+            find(while_stmt->body.get(), key, out);
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            find(for_stmt->init.get(), key, out);
+            find(for_stmt->condition, key, out);
+            find(for_stmt->update.get(), key, out);
+            find(for_stmt->body.get(), key, out);
+        }
+    }
+    
+    // Shares one repeated expression of statement i through a let inserted at i
+    bool share(std::vector<std::unique_ptr<Statement>>& statements, size_t i) {
+        std::unique_ptr<Expression>* root = evaluated_expression(statements[i].get());
+        if (!root) return false;
+        std::vector<std::unique_ptr<Expression>*> slots;
+        candidates(*root, slots);
+        for (std::unique_ptr<Expression>* slot : slots) {
+            std::string key = expression_key(slot->get());
+            EffectSummary reads;
+            reads.add_expression(slot->get());
+            std::vector<std::unique_ptr<Expression>*> uses;
+            for (size_t j = i; j < statements.size(); j++) {
+                Statement* stmt = statements[j].get();
+                EffectSummary effects;
+                effects.add_statement(stmt);
+                if (effects.unknown || effects.declares_functions || !calls.all_pure(effects)) break;
+                bool writes = std::any_of(reads.read_order.begin(), reads.read_order.end(), [&](const std::string& name) {
+                    return effects.declared.count(name) || effects.assigned.count(name);
+                });
+                if (!writes) {
+                    find(stmt, key, uses);
+                    continue;
+                }
+                if (std::unique_ptr<Expression>* evaluated = evaluated_expression(stmt)) find(*evaluated, key, uses);
+                break;
+            }
+            if (uses.size() < 2) continue;
+            
+            std::string name = "$cse" + std::to_string(next_id++);
+            auto let = std::make_unique<VariableDeclaration>(name, std::move(*uses[0]));
+            let->line = statements[i]->line;
+            let->column = statements[i]->column;
+            for (std::unique_ptr<Expression>* use : uses) {
+                const Expression* original = *use ? use->get() : let->initializer.get();
+                auto id = std::make_unique<Identifier>(name);
+                id->line = original->line;
+                id->column = original->column;
+                *use = std::move(id);
+            }
+            statements.insert(statements.begin() + i, std::move(let));
+            return true;
+        }
+        return false;
+    }
+    
+    void visit_list(std::vector<std::unique_ptr<Statement>>& statements) {
+        for (size_t i = 0; i < statements.size(); i++) {
+            // The new let lands at i and is tried next, so repeats inside what it computes are shared too
+            while (share(statements, i)) {}
+            visit(statements[i].get());
+        }
+    }
+    
+    void visit(Statement* stmt) {
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            visit_list(block->statements);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->body.get());
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            visit_list(func->body->statements);
+        }
+    }
+    
+public:
+    explicit CommonSubexpressions(const ProgramBindings& b) : calls(b) {}
+    
+    void run(Program& program) {
+        visit_list(program.statements);
+    }
+};
+
+// --- Scalar replacement ---
+// Splits a local `let p = {...}` or `let p = [...]` into one hidden `$sr<N>_<k>` local per element
+// when nothing lets the literal escape: every later use of `p` in its scope must be `p["key"]`
+// with a key the literal has, or `p[k]` with a constant in-range index, and `p` is never
+// assigned, redeclared or captured. The uses become reads of those locals, so the array or map
+// is never allocated. Element lets keep the literal's evaluation order. Top-level lets are
+// globals that any function may read, so only function bodies and nested blocks are split.
+// Runs after inlining, which turns `let p = make_point(x, y);` into a literal.
+class ScalarReplacement {
+private:
+    int next_id = 0;
+    
+    struct Candidate {
+        std::string name;
+        ArrayLiteral* array = nullptr;
+        MapLiteral* map = nullptr;
+        std::vector<std::string> locals;  // One per element or pair
+        
+        // Element an access reads, or -1 if it can't be resolved statically
+        int field(const Expression* access) const {
+            if (auto map_access = dynamic_cast<const MapAccess*>(access)) {
+                if (!map) return -1;
+                for (size_t k = map->pairs.size(); k-- > 0;) {
+                    if (map->pairs[k].first == map_access->key) return static_cast<int>(k);  // Last one wins
+                }
+            } else if (auto array_access = dynamic_cast<const ArrayAccess*>(access)) {
+                auto num = dynamic_cast<const NumberLiteral*>(array_access->index.get());
+                if (!array || !num) return -1;
+                double index = std::trunc(num->value);
+                if (index >= 0 && index < static_cast<double>(array->elements.size())) return static_cast<int>(index);
+            }
+            return -1;
+        }
+    };
+    
+    // Checks, or with `rewrite` replaces, the uses of the candidate in an expression; false if one
+    // needs the whole value
+    static bool scan(std::unique_ptr<Expression>& slot, const Candidate& c, bool rewrite) {
+        Expression* expr = slot.get();
+        if (!expr) return true;
+        if (auto id = dynamic_cast<const Identifier*>(expr)) return id->name != c.name;
+        if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            if (call->function_name == c.name) return false;
+        }
+        const Expression* base = nullptr;
+        if (auto access = dynamic_cast<const MapAccess*>(expr)) base = access->map.get();
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) base = access->array.get();
+        auto base_id = dynamic_cast<const Identifier*>(base);
+        if (base_id && base_id->name == c.name) {
+            int k = c.field(expr);
+            if (k < 0) return false;
+            if (rewrite) {
+                auto local = std::make_unique<Identifier>(c.locals[k]);
+                local->line = expr->line;
+                local->column = expr->column;
+                slot = std::move(local);
+            }
+            return true;
+        }
+        bool ok = true;
+        for_each_operand(expr, [&](std::unique_ptr<Expression>& operand) {
+            ok = ok && scan(operand, c, rewrite);
+        });
+        return ok;
+    }
+    
+    static bool scan(Statement* stmt, const Candidate& c, bool rewrite) {
+        if (!stmt) return true;
+        if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            return vardecl->name != c.name && scan(vardecl->initializer, c, rewrite);
+        }
+        if (auto assignment = dynamic_cast<AssignmentStatement*>(stmt)) {
+            return assignment->variable_name != c.name && scan(assignment->value, c, rewrite);
+        }
+        if (auto print = dynamic_cast<PrintStatement*>(stmt)) return scan(print->expression, c, rewrite);
+        if (auto ret_stmt = dynamic_cast<ReturnStatement*>(stmt)) return scan(ret_stmt->value, c, rewrite);
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) {
+                if (!scan(s.get(), c, rewrite)) return false;
+            }
+            return true;
+        }
+        if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            return scan(if_stmt->condition, c, rewrite) && scan(if_stmt->then_branch.get(), c, rewrite) &&
+                   scan(if_stmt->else_branch.get(), c, rewrite);
+        }
+        if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            return scan(while_stmt->condition, c, rewrite) && scan(while_stmt->body.get(), c, rewrite);
+        }
+        if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            return scan(for_stmt->init.get(), c, rewrite) && scan(for_stmt->condition, c, rewrite) &&
+                   scan(for_stmt->update.get(), c, rewrite) && scan(for_stmt->body.get(), c, rewrite);
+        }
+        if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            // Its body is a separate frame that can only see the candidate by capturing it
+            return func->name != c.name &&
+                   std::find(func->captures.begin(), func->captures.end(), c.name) == func->captures.end();
+        }
+        return false;
+    }
+    
+    // Splits the let at `i` if it qualifies, leaving its element lets in its place
+    bool replace(std::vector<std::unique_ptr<Statement>>& statements, size_t i) {
+        if (i >= statements.size()) return false;
+        auto vardecl = dynamic_cast<VariableDeclaration*>(statements[i].get());
+        if (!vardecl) return false;
+        Candidate c;
+        c.name = vardecl->name;
+        c.array = dynamic_cast<ArrayLiteral*>(vardecl->initializer.get());
+        c.map = dynamic_cast<MapLiteral*>(vardecl->initializer.get());
+        if (!c.array && !c.map) return false;
+        size_t count = c.array ? c.array->elements.size() : c.map->pairs.size();
+        int id = next_id++;
+        for (size_t k = 0; k < count; k++) {
+            c.locals.push_back("$sr" + std::to_string(id) + "_" + std::to_string(k));
+        }
+        for (size_t j = i + 1; j < statements.size(); j++) {
+            if (!scan(statements[j].get(), c, false)) return false;
+        }
+        for (size_t j = i + 1; j < statements.size(); j++) scan(statements[j].get(), c, true);
+        
+        std::vector<std::unique_ptr<Statement>> lets;
+        for (size_t k = 0; k < count; k++) {
+            auto init = c.array ? std::move(c.array->elements[k]) : std::move(c.map->pairs[k].second);
+            auto let = std::make_unique<VariableDeclaration>(c.locals[k], std::move(init));
+            let->line = vardecl->line;
+            let->column = vardecl->column;
+            lets.push_back(std::move(let));
+        }
+        statements.erase(statements.begin() + i);
+        statements.insert(statements.begin() + i, std::make_move_iterator(lets.begin()),
+                          std::make_move_iterator(lets.end()));
+        return true;
+    }
+    
+    void visit_list(std::vector<std::unique_ptr<Statement>>& statements, bool locals) {
+        for (size_t i = 0; i < statements.size(); i++) {
+            // An element may itself be a literal that can be split in turn
+            while (locals && replace(statements, i)) {}
+            if (i < statements.size()) visit(statements[i].get());
+        }
+    }
+    
+    void visit(Statement* stmt) {
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            visit_list(block->statements, true);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->body.get());
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            visit_list(func->body->statements, true);
+        }
+    }
+
+public:
+    void run(Program& program) {
+        visit_list(program.statements, false);
+    }
+};
+
+// --- Dead code elimination ---
+// Drops statements that can't run or whose result nobody reads: whatever follows a statement that
+// always returns, except function declarations; ifs and whiles whose condition is a number literal;
+// lets of function locals that are never read or assigned, and assignments to parameters that are
+// never read. Functions declaring nested functions keep their stores, since closures capture
+// locals. A store is only dropped when its value can't raise an error either: a literal, or
+// arithmetic and comparisons on values TypeInference typed NUMBER, so this pass runs after it.
+class DeadCodeEliminator {
+private:
+    std::unordered_set<std::string> dead;  // Unread variables of the function being cleaned
+    
+    static bool always_returns(const Statement* stmt) {
+        if (dynamic_cast<const ReturnStatement*>(stmt)) return true;
+        if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) {
+                if (always_returns(s.get())) return true;
+            }
+            return false;
+        }
+        if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            return if_stmt->else_branch && always_returns(if_stmt->then_branch.get()) &&
+                   always_returns(if_stmt->else_branch.get());
+        }
+        return false;
+    }
+    
+    // What a statement with a constant condition reduces to; null when nothing runs
+    static std::unique_ptr<Statement> fold(std::unique_ptr<Statement> stmt) {
+        if (auto if_stmt = dynamic_cast<IfStatement*>(stmt.get())) {
+            if (auto num = dynamic_cast<const NumberLiteral*>(if_stmt->condition.get())) {
+                return std::move(num->value != 0 ? if_stmt->then_branch : if_stmt->else_branch);
+            }
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt.get())) {
+            auto num = dynamic_cast<const NumberLiteral*>(while_stmt->condition.get());
+            if (num && num->value == 0) return nullptr;
+        }
+        return stmt;
+    }
+    
+    bool is_dead_store(const Statement* stmt) {
+        const Expression* value = nullptr;
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            if (dead.count(vardecl->name)) value = vardecl->initializer.get();
+        } else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            if (dead.count(assignment->variable_name)) value = assignment->value.get();
+        }
+        return value && cannot_fail(value);
+    }
+    
+    static bool cannot_fail(const Expression* expr) {
+        if (dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr)) return true;
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            return binop->left->static_type == StaticType::NUMBER && binop->right->static_type == StaticType::NUMBER &&
+                   cannot_fail(binop->left.get()) && cannot_fail(binop->right.get());
+        }
+        return dynamic_cast<const Identifier*>(expr) && expr->static_type == StaticType::NUMBER;
+    }
+    
+    // Function declarations after a return stay: the Script API and --aot still find top-level
+    // ones by name through CompiledProgram::functions()
+    void visit_list(std::vector<std::unique_ptr<Statement>>& statements) {
+        std::vector<std::unique_ptr<Statement>> kept;
+        bool returned = false;
+        for (auto& stmt : statements) {
+            if (returned && !dynamic_cast<const FunctionDeclaration*>(stmt.get())) continue;
+            std::unique_ptr<Statement> folded = fold(std::move(stmt));
+            if (!folded || is_dead_store(folded.get())) continue;
+            visit(folded.get());
+            returned = returned || always_returns(folded.get());
+            kept.push_back(std::move(folded));
+        }
+        statements = std::move(kept);
+    }
+    
+    void visit(Statement* stmt) {
+        if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            visit_list(block->statements);
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->body.get());
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            std::unordered_set<std::string> outer = std::move(dead);
+            dead.clear();
+            EffectSummary effects;
+            effects.add_statement(func->body.get());
+            if (!effects.unknown && !effects.declares_functions) {
+                for (const auto& name : effects.declared) {
+                    if (!effects.reads.count(name) && !effects.calls.count(name) && !effects.assigned.count(name)) {
+                        dead.insert(name);
+                    }
+                }
+                for (const auto& param : func->parameters) {
+                    if (!effects.reads.count(param) && !effects.calls.count(param)) dead.insert(param);
+                }
+            }
+            visit_list(func->body->statements);
+            dead = std::move(outer);
+        }
+    }
+    
+public:
+    void run(Program& program) {
+        visit_list(program.statements);
+    }
+};
+
+// --- Static type inference ---
+// Flow-sensitive pass that annotates each expression with the one type it always evaluates to
+// (when it evaluates without error), and each function with its return type. Scopes mirror the
+// interpreter's, branches join to UNKNOWN where they disagree, and loops and mutually recursive
+// functions are iterated to a fixed point. Parameters stay UNKNOWN, and so does any name a
+// function body assigns without declaring it: a nested function may be writing a local it
+// captures, which changes the variable in the enclosing frame too.
+class TypeInference {
+private:
+    typedef std::vector<std::unordered_map<std::string, StaticType>> Scopes;
+    
+    const ProgramBindings& bindings;
+    std::unordered_set<std::string> clobbered;
+    std::vector<FunctionDeclaration*> function_list;  // Every function, nested ones included
+    std::unordered_map<const FunctionDeclaration*, StaticType> return_types;
+    Scopes scopes;
+    StaticType* function_returns = nullptr;  // Joined return type of the body being analyzed
+    
+    // NEVER is the "no value seen yet" bottom of the lattice
+    static StaticType join(StaticType a, StaticType b) {
+        if (a == StaticType::NEVER) return b;
+        if (b == StaticType::NEVER) return a;
+        return a == b ? a : StaticType::UNKNOWN;
+    }
+    
+    static Scopes join(const Scopes& a, const Scopes& b) {
+        Scopes joined = a;
+        for (size_t level = 0; level < joined.size() && level < b.size(); level++) {
+            for (auto& entry : joined[level]) {
+                auto other = b[level].find(entry.first);
+                entry.second = other == b[level].end() ? StaticType::UNKNOWN : join(entry.second, other->second);
+            }
+            for (const auto& entry : b[level]) {
+                if (!joined[level].count(entry.first)) joined[level][entry.first] = StaticType::UNKNOWN;
+            }
+        }
+        return joined;
+    }
+    
+    StaticType lookup(const std::string& name) const {
+        if (clobbered.count(name)) return StaticType::UNKNOWN;
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            auto found = it->find(name);
+            if (found != it->end()) return found->second;
+        }
+        return StaticType::UNKNOWN;
+    }
+    
+    void assign(const std::string& name, StaticType type) {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            auto found = it->find(name);
+            if (found != it->end()) {
+                found->second = type;
+                return;
+            }
+        }
+    }
+    
+    void collect_functions(Statement* stmt) {
+        if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            function_list.push_back(func);
+            EffectSummary effects;
+            effects.add_statement(func->body.get());
+            for (const auto& name : effects.assigned) {
+                if (!effects.declared.count(name) &&
+                    std::find(func->parameters.begin(), func->parameters.end(), name) == func->parameters.end()) {
+                    clobbered.insert(name);
+                }
+            }
+            collect_functions(func->body.get());
+        } else if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) collect_functions(s.get());
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            collect_functions(if_stmt->then_branch.get());
+            if (if_stmt->else_branch) collect_functions(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            collect_functions(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            collect_functions(for_stmt->body.get());
+        }
+    }
+    
+    StaticType builtin_result(const std::string& name) const {
+        static const std::unordered_set<std::string> numeric = {
+            "sqrt", "pow", "log", "exp", "abs", "len", "mean", "std", "max", "min", "sum", "num", "find", "starts_with",
+            "save"
+        };
+        if (numeric.count(name)) return StaticType::NUMBER;
+        if (name == "str" || name == "stats" || name == "substr" || name == "trim" || name == "join") {
+            return StaticType::STRING;
+        }
+        if (name == "range" || name == "map" || name == "filter" || name == "split" || name == "load_f64") {
+            return StaticType::ARRAY;
+        }
+        if (name == "load_csv") return StaticType::MAP;
+        return StaticType::UNKNOWN;
+    }
+    
+    StaticType infer(Expression* expr) {
+        if (!expr) return StaticType::UNKNOWN;
+        StaticType type = StaticType::UNKNOWN;
+        bool never = false;  // Some operand never produces a value yet
+        auto operand = [&](Expression* e) {
+            StaticType t = infer(e);
+            if (t == StaticType::NEVER) never = true;
+            return t;
+        };
+        if (dynamic_cast<NumberLiteral*>(expr)) {
+            type = StaticType::NUMBER;
+        } else if (dynamic_cast<StringLiteral*>(expr)) {
+            type = StaticType::STRING;
+        } else if (auto id = dynamic_cast<Identifier*>(expr)) {
+            type = lookup(id->name);
+        } else if (auto binop = dynamic_cast<BinaryOperation*>(expr)) {
+            StaticType left = operand(binop->left.get());
+            StaticType right = operand(binop->right.get());
+            if (binop->op == BinaryOp::ADD && (left == StaticType::STRING || right == StaticType::STRING)) {
+                type = StaticType::STRING;
+            } else if (left == StaticType::ARRAY || right == StaticType::ARRAY) {
+                // Element-wise, or throws
+                type = StaticType::ARRAY;
+            } else if (left == StaticType::UNKNOWN || right == StaticType::UNKNOWN) {
+                // Either side may turn out to be an array
+            } else if (binop->op == BinaryOp::ADD) {
+                if (left == StaticType::NUMBER && right == StaticType::NUMBER) type = StaticType::NUMBER;
+            } else {
+                // Every other operator on non-arrays either yields a number or throws
+                type = StaticType::NUMBER;
+            }
+        } else if (auto call = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : call->arguments) operand(arg.get());
+            auto func = bindings.functions.find(call->function_name);
+            if (func != bindings.functions.end() && !bindings.rebound.count(call->function_name)) {
+                auto known = return_types.find(func->second);
+                type = known == return_types.end() ? StaticType::NEVER : known->second;
+            } else if (bindings.is_builtin_call(call->function_name)) {
+                type = builtin_result(call->function_name);
+            }
+        } else if (auto arr = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& elem : arr->elements) operand(elem.get());
+            type = StaticType::ARRAY;
+        } else if (auto map = dynamic_cast<MapLiteral*>(expr)) {
+            for (auto& pair : map->pairs) operand(pair.second.get());
+            type = StaticType::MAP;
+        } else if (auto access = dynamic_cast<ArrayAccess*>(expr)) {
+            operand(access->array.get());
+            operand(access->index.get());
+        } else if (auto access = dynamic_cast<MapAccess*>(expr)) {
+            operand(access->map.get());
+        }
+        if (never) type = StaticType::NEVER;
+        // Annotations only ever claim what holds at run time
+        expr->static_type = type == StaticType::NEVER ? StaticType::UNKNOWN : type;
+        return type;
+    }
+    
+    void analyze_hoisted(const std::vector<std::unique_ptr<VariableDeclaration>>& decls) {
+        for (const auto& decl : decls) analyze(decl.get());
+    }
+    
+    // Runs `iteration` (condition, body, update) until the types at the loop head stop changing
+    void analyze_loop(const std::function<void()>& iteration) {
+        while (true) {
+            Scopes head = scopes;
+            iteration();
+            scopes = join(head, scopes);
+            if (scopes == head) break;
+        }
+    }
+    
+    void analyze(Statement* stmt) {
+        if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            scopes.back()[vardecl->name] = infer(vardecl->initializer.get());
+        } else if (auto assignment = dynamic_cast<AssignmentStatement*>(stmt)) {
+            assign(assignment->variable_name, infer(assignment->value.get()));
+        } else if (auto print = dynamic_cast<PrintStatement*>(stmt)) {
+            infer(print->expression.get());
+        } else if (auto ret_stmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            StaticType type = ret_stmt->value ? infer(ret_stmt->value.get()) : StaticType::NUMBER;
+            if (function_returns) *function_returns = join(*function_returns, type);
+        } else if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            scopes.push_back({});
+            for (auto& s : block->statements) analyze(s.get());
+            scopes.pop_back();
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            infer(if_stmt->condition.get());
+            Scopes before = scopes;
+            analyze(if_stmt->then_branch.get());
+            Scopes after_then = scopes;
+            scopes = before;
+            if (if_stmt->else_branch) analyze(if_stmt->else_branch.get());
+            scopes = join(after_then, scopes);
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            scopes.push_back({});
+            analyze_hoisted(while_stmt->hoisted_condition);
+            analyze_loop([&] {
+                infer(while_stmt->condition.get());
+                analyze_hoisted(while_stmt->hoisted_body);
+                analyze(while_stmt->body.get());
+            });
+            scopes.pop_back();
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            scopes.push_back({});
+            if (for_stmt->init) analyze(for_stmt->init.get());
+            analyze_hoisted(for_stmt->hoisted_condition);
+            analyze_loop([&] {
+                infer(for_stmt->condition.get());
+                analyze_hoisted(for_stmt->hoisted_body);
+                analyze(for_stmt->body.get());
+                if (for_stmt->update) analyze(for_stmt->update.get());
+            });
+            scopes.pop_back();
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            scopes.back()[func->name] = StaticType::FUNCTION;
+        }
+    }
+    
+    // Returns whether the function's return type changed
+    bool analyze_function(FunctionDeclaration* func) {
+        Scopes saved = std::move(scopes);
+        scopes.assign(1, {});
+        for (const auto& param : func->parameters) scopes.back()[param] = StaticType::UNKNOWN;
+        StaticType returns = StaticType::NEVER;
+        function_returns = &returns;
+        analyze(func->body.get());
+        function_returns = nullptr;
+        scopes = std::move(saved);
+        // Falling off the end returns 0
+        const auto& body = func->body->statements;
+        if (body.empty() || !dynamic_cast<const ReturnStatement*>(body.back().get())) {
+            returns = join(returns, StaticType::NUMBER);
+        }
+        auto known = return_types.find(func);
+        if (known != return_types.end() && known->second == returns) return false;
+        return_types[func] = returns;
+        return true;
+    }
+    
+public:
+    explicit TypeInference(const ProgramBindings& b) : bindings(b) {}
+    
+    void run(Program& program) {
+        for (auto& stmt : program.statements) collect_functions(stmt.get());
+        // Return types only move up the lattice, so this terminates
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (FunctionDeclaration* func : function_list) {
+                changed = analyze_function(func) || changed;
+            }
+        }
+        // One more pass so every annotation reflects the final return types
+        for (FunctionDeclaration* func : function_list) analyze_function(func);
+        scopes.assign(1, {});
+        for (auto& stmt : program.statements) analyze(stmt.get());
+        for (FunctionDeclaration* func : function_list) {
+            StaticType returns = return_types[func];
+            func->return_type = returns == StaticType::NEVER ? StaticType::UNKNOWN : returns;
+        }
+    }
+};
+
+// --- Quickening slots ---
+// Numbers the nodes the interpreter can rewrite into a specialized form on first execution:
+// arithmetic and comparisons over locals, constants, arr[i] and other such arithmetic (i < n,
+// x + 1, total + arr[i], x * 2 - 1),
+// assignments of such expressions, array reads indexed by a local, and `return local`. The AST
+// only carries the slot; what a node was quickened to lives in the interpreter running it.
+class QuickeningSlots {
+private:
+    int count = 0;
+    
+    static bool is_indexable(const Expression* expr) {
+        auto access = dynamic_cast<const ArrayAccess*>(expr);
+        return access && dynamic_cast<const Identifier*>(access->array.get()) &&
+               (dynamic_cast<const Identifier*>(access->index.get()) ||
+                dynamic_cast<const NumberLiteral*>(access->index.get()));
+    }
+    
+    // Nested arithmetic such as x * 2 - 1 counts too, so each level guards its own operand types
+    static bool is_simple_operand(const Expression* expr) {
+        return dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const Identifier*>(expr) ||
+               is_indexable(expr) || is_numeric_binary(expr);
+    }
+    
+    static bool is_numeric_binary(const Expression* expr) {
+        auto binop = dynamic_cast<const BinaryOperation*>(expr);
+        return binop && is_simple_operand(binop->left.get()) && is_simple_operand(binop->right.get());
+    }
+    
+    void visit(Expression* expr) {
+        if (!expr) return;
+        if (is_numeric_binary(expr) || is_indexable(expr)) expr->quick_slot = count++;
+        if (auto binop = dynamic_cast<BinaryOperation*>(expr)) {
+            visit(binop->left.get());
+            visit(binop->right.get());
+        } else if (auto call = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : call->arguments) visit(arg.get());
+        } else if (auto arr = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& elem : arr->elements) visit(elem.get());
+        } else if (auto map = dynamic_cast<MapLiteral*>(expr)) {
+            for (auto& pair : map->pairs) visit(pair.second.get());
+        } else if (auto access = dynamic_cast<ArrayAccess*>(expr)) {
+            visit(access->array.get());
+            visit(access->index.get());
+        } else if (auto access = dynamic_cast<MapAccess*>(expr)) {
+            visit(access->map.get());
+        }
+    }
+    
+    void visit(Statement* stmt) {
+        if (!stmt) return;
+        if (auto vardecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            visit(vardecl->initializer.get());
+        } else if (auto assignment = dynamic_cast<AssignmentStatement*>(stmt)) {
+            if (is_numeric_binary(assignment->value.get())) assignment->quick_slot = count++;
+            visit(assignment->value.get());
+        } else if (auto print = dynamic_cast<PrintStatement*>(stmt)) {
+            visit(print->expression.get());
+        } else if (auto ret_stmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            if (dynamic_cast<const Identifier*>(ret_stmt->value.get())) ret_stmt->quick_slot = count++;
+            visit(ret_stmt->value.get());
+        } else if (auto block = dynamic_cast<BlockStatement*>(stmt)) {
+            for (auto& s : block->statements) visit(s.get());
+        } else if (auto if_stmt = dynamic_cast<IfStatement*>(stmt)) {
+            visit(if_stmt->condition.get());
+            visit(if_stmt->then_branch.get());
+            visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<WhileStatement*>(stmt)) {
+            for (auto& decl : while_stmt->hoisted_condition) visit(decl.get());
+            for (auto& decl : while_stmt->hoisted_body) visit(decl.get());
+            visit(while_stmt->condition.get());
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<ForStatement*>(stmt)) {
+            visit(for_stmt->init.get());
+            for (auto& decl : for_stmt->hoisted_condition) visit(decl.get());
+            for (auto& decl : for_stmt->hoisted_body) visit(decl.get());
+            visit(for_stmt->condition.get());
+            visit(for_stmt->body.get());
+            visit(for_stmt->update.get());
+        } else if (auto func = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            visit(func->body.get());
+        }
+    }
+    
+public:
+    // Returns the number of slots handed out
+    int run(Program& program) {
+        for (auto& stmt : program.statements) visit(stmt.get());
+        return count;
+    }
+};
+
+// What one interpreter rewrote a quickening slot to. Nodes start UNSEEN, pick a specialized kind
+// from their shape on first execution, and drop to GENERIC for good once a type guard fails.
+struct QuickForm {
+    enum Kind : uint8_t { UNSEEN, GENERIC, NUMBER_BINARY, ARRAY_INDEX, ASSIGN_NUMBER, RETURN_LOCAL };
+    enum Operand : uint8_t { CONSTANT, LOCAL, INDEX, BINARY };
+    
+    Kind kind = UNSEEN;
+    Operand left = CONSTANT;
+    Operand right = CONSTANT;  // Also the index operand of ARRAY_INDEX
+};
+
+// --- Shareable compiled program ---
+// The parsed AST, after closure conversion, inlining, scalar replacement of non-escaping literals,
+// common subexpression and dead code elimination, loop-invariant hoisting, type inference and
+// quickening slot numbering, plus a function table resolved once up front.
+// It is never mutated after construction, so one instance can be shared by any number of
+// concurrent executions.
+class CompiledProgram {
+private:
+    std::unique_ptr<const Program> ast;
+    std::unordered_map<std::string, const FunctionDeclaration*> function_table;
+    std::vector<const FunctionDeclaration*> function_list;
+    int quick_slots = 0;
+    
+    void index_functions() {
+        for (const auto& stmt : ast->statements) {
+            if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt.get())) {
+                function_table[func->name] = func;
+                function_list.push_back(func);
+            }
+        }
+    }
+    
+public:
+    explicit CompiledProgram(std::unique_ptr<Program> program) {
+        ClosureResolver().run(*program);
+        ProgramBindings bindings(*program);
+        FunctionInliner(bindings).run(*program);
+        ScalarReplacement().run(*program);
+        CommonSubexpressions(bindings).run(*program);
+        LoopInvariantHoister(bindings).run(*program);
+        TypeInference(bindings).run(*program);
+        DeadCodeEliminator().run(*program);
+        CountedLoops().run(*program);
+        quick_slots = QuickeningSlots().run(*program);
+        ast = std::move(program);
+        index_functions();
+    }
+    
+    // A program whose passes already ran, as read back from a snapshot. Counted loops aren't
+    // stored; finding them again is one cheap walk.
+    CompiledProgram(std::unique_ptr<Program> analysed, int quick_slot_count)
+        : quick_slots(quick_slot_count) {
+        CountedLoops().run(*analysed);
+        ast = std::move(analysed);
+        index_functions();
+    }
+    
+    static std::shared_ptr<const CompiledProgram> compile(const std::string& source) {
+        Lexer lexer(source);
+        Parser parser(lexer);
+        return std::make_shared<const CompiledProgram>(parser.parse());
+    }
+    
+    const Program& program() const { return *ast; }
+    int quick_slot_count() const { return quick_slots; }
+    
+    // Top-level function by name, or nullptr
+    const FunctionDeclaration* find_function(const std::string& name) const {
+        auto it = function_table.find(name);
+        return it == function_table.end() ? nullptr : it->second;
+    }
+    
+    // Top-level functions in declaration order
+    const std::vector<const FunctionDeclaration*>& functions() const { return function_list; }
+    
+    // Binary snapshots of the analysed program, for starting without lexing, parsing or the passes
+    void save_snapshot(const std::string& path) const;
+    static std::shared_ptr<const CompiledProgram> load_snapshot(const std::string& path);
+};
+
+// --- Program snapshots ---
+// Read-only view of a whole file through mmap; the mapping lives as long as the object.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            bytes = static_cast<const char*>(mapped);
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Layout: the magic "CFSNAP", a format version and the program's quickening slot count, then a
+// symbol table (names and string constants), a pool of number constants and the
+// statements in preorder. Integers are LEB128 varints; strings and numbers are referenced by
+// pool index; numbers are stored as native doubles, so snapshots don't move between
+// architectures with different byte orders. Every node stores its tag, source position and
+// quickening slot, expressions their static type, so loading rebuilds the analysed AST exactly.
+enum class SnapshotTag : uint8_t {
+    NONE, NUMBER, STRING, IDENTIFIER, BINARY, CALL, ARRAY, MAP, ARRAY_ACCESS, MAP_ACCESS,
+    LET, ASSIGN, PRINT, RETURN, BLOCK, IF, WHILE, FOR, FUNCTION
+};
+
+static const char snapshot_magic[6] = {'C', 'F', 'S', 'N', 'A', 'P'};
+static const uint64_t snapshot_version = 2;
+
+class SnapshotWriter {
+private:
+    std::string nodes;
+    std::vector<const std::string*> symbols;
+    std::unordered_map<std::string, uint64_t> symbol_ids;
+    std::vector<double> numbers;
+    std::unordered_map<uint64_t, uint64_t> number_ids;  // Keyed by bit pattern, so -0 and NaN survive
+    
+    static void varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+    
+    void symbol(const std::string& name) {
+        auto inserted = symbol_ids.emplace(name, symbols.size());
+        if (inserted.second) symbols.push_back(&inserted.first->first);
+        varint(nodes, inserted.first->second);
+    }
+    
+    void number(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        auto inserted = number_ids.emplace(bits, numbers.size());
+        if (inserted.second) numbers.push_back(value);
+        varint(nodes, inserted.first->second);
+    }
+    
+    void header(SnapshotTag tag, const ASTNode* node) {
+        nodes.push_back(static_cast<char>(tag));
+        varint(nodes, node->line);
+        varint(nodes, node->column);
+        varint(nodes, node->quick_slot + 1);
+    }
+    
+    void expression(const Expression* expr) {
+        if (!expr) {
+            nodes.push_back(static_cast<char>(SnapshotTag::NONE));
+            return;
+        }
+        if (auto num = dynamic_cast<const NumberLiteral*>(expr)) {
+            header(SnapshotTag::NUMBER, expr);
+            number(num->value);
+        } else if (auto str = dynamic_cast<const StringLiteral*>(expr)) {
+            header(SnapshotTag::STRING, expr);
+            symbol(str->value);
+        } else if (auto id = dynamic_cast<const Identifier*>(expr)) {
+            header(SnapshotTag::IDENTIFIER, expr);
+            symbol(id->name);
+        } else if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            header(SnapshotTag::BINARY, expr);
+            nodes.push_back(static_cast<char>(binop->op));
+            expression(binop->left.get());
+            expression(binop->right.get());
+        } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            header(SnapshotTag::CALL, expr);
+            symbol(call->function_name);
+            varint(nodes, call->arguments.size());
+            for (const auto& arg : call->arguments) expression(arg.get());
+        } else if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+            header(SnapshotTag::ARRAY, expr);
+            varint(nodes, arr->elements.size());
+            for (const auto& elem : arr->elements) expression(elem.get());
+        } else if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+            header(SnapshotTag::MAP, expr);
+            varint(nodes, map->pairs.size());
+            for (const auto& pair : map->pairs) {
+                symbol(pair.first);
+                expression(pair.second.get());
+            }
+        } else if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            header(SnapshotTag::ARRAY_ACCESS, expr);
+            expression(access->array.get());
+            expression(access->index.get());
+        } else if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+            header(SnapshotTag::MAP_ACCESS, expr);
+            symbol(access->key);
+            expression(access->map.get());
+        } else {
+            throw std::runtime_error("Cannot snapshot expression");
+        }
+        nodes.push_back(static_cast<char>(expr->static_type));
+    }
+    
+    void hoisted(const std::vector<std::unique_ptr<VariableDeclaration>>& decls) {
+        varint(nodes, decls.size());
+        for (const auto& decl : decls) statement(decl.get());
+    }
+    
+    void statement(const Statement* stmt) {
+        if (!stmt) {
+            nodes.push_back(static_cast<char>(SnapshotTag::NONE));
+        } else if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            header(SnapshotTag::LET, stmt);
+            symbol(vardecl->name);
+            expression(vardecl->initializer.get());
+        } else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            header(SnapshotTag::ASSIGN, stmt);
+            symbol(assignment->variable_name);
+            expression(assignment->value.get());
+        } else if (auto print = dynamic_cast<const PrintStatement*>(stmt)) {
+            header(SnapshotTag::PRINT, stmt);
+            expression(print->expression.get());
+        } else if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
+            header(SnapshotTag::RETURN, stmt);
+            expression(ret_stmt->value.get());
+        } else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            header(SnapshotTag::BLOCK, stmt);
+            varint(nodes, block->statements.size());
+            for (const auto& s : block->statements) statement(s.get());
+        } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            header(SnapshotTag::IF, stmt);
+            expression(if_stmt->condition.get());
+            statement(if_stmt->then_branch.get());
+            statement(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            header(SnapshotTag::WHILE, stmt);
+            expression(while_stmt->condition.get());
+            statement(while_stmt->body.get());
+            hoisted(while_stmt->hoisted_condition);
+            hoisted(while_stmt->hoisted_body);
+        } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            header(SnapshotTag::FOR, stmt);
+            nodes.push_back(for_stmt->is_parallel ? 1 : 0);
+            statement(for_stmt->init.get());
+            expression(for_stmt->condition.get());
+            statement(for_stmt->update.get());
+            statement(for_stmt->body.get());
+            hoisted(for_stmt->hoisted_condition);
+            hoisted(for_stmt->hoisted_body);
+        } else if (auto func = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            header(SnapshotTag::FUNCTION, stmt);
+            symbol(func->name);
+            varint(nodes, func->parameters.size());
+            for (const auto& param : func->parameters) symbol(param);
+            varint(nodes, func->captures.size());
+            for (size_t i = 0; i < func->captures.size(); i++) {
+                symbol(func->captures[i]);
+                nodes.push_back(func->assigns_capture[i] ? 1 : 0);
+            }
+            nodes.push_back(static_cast<char>(func->return_type));
+            statement(func->body.get());
+        } else {
+            throw std::runtime_error("Cannot snapshot statement");
+        }
+    }
+    
+public:
+    void write(const CompiledProgram& compiled, std::ostream& out) {
+        const Program& program = compiled.program();
+        varint(nodes, program.statements.size());
+        for (const auto& stmt : program.statements) statement(stmt.get());
+        
+        std::string head(snapshot_magic, sizeof(snapshot_magic));
+        varint(head, snapshot_version);
+        varint(head, compiled.quick_slot_count());
+        varint(head, symbols.size());
+        for (const std::string* name : symbols) {
+            varint(head, name->size());
+            head += *name;
+        }
+        varint(head, numbers.size());
+        head.append(reinterpret_cast<const char*>(numbers.data()), numbers.size() * sizeof(double));
+        out.write(head.data(), head.size());
+        out.write(nodes.data(), nodes.size());
+    }
+};
+
+// Decodes a snapshot held in memory, normally a MappedFile. Throws on anything malformed.
+class SnapshotReader {
+private:
+    const uint8_t* cursor;
+    const uint8_t* end;
+    std::vector<std::string> symbols;
+    std::vector<double> numbers;
+    // Nodes are read recursively; real programs nest far less deeply, and the cap keeps a crafted
+    // file from overflowing the stack
+    static const int max_depth = 10000;
+    int depth = 0;
+    
+    [[noreturn]] static void corrupt(const std::string& what) {
+        throw std::runtime_error("Corrupt snapshot: " + what);
+    }
+    
+    struct DepthScope {
+        int& depth;
+        explicit DepthScope(int& d) : depth(d) {
+            if (depth == max_depth) corrupt("nesting too deep");
+            depth++;
+        }
+        ~DepthScope() { depth--; }
+    };
+    
+    uint8_t byte() {
+        if (cursor == end) corrupt("unexpected end of data");
+        return *cursor++;
+    }
+    
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return value;
+        }
+        corrupt("varint too long");
+    }
+    
+    // Element counts are bounded by the bytes left, so a bad count can't trigger a huge allocation
+    size_t count() {
+        uint64_t n = varint();
+        if (n > static_cast<uint64_t>(end - cursor)) corrupt("count out of range");
+        return static_cast<size_t>(n);
+    }
+    
+    const std::string& symbol() {
+        uint64_t id = varint();
+        if (id >= symbols.size()) corrupt("symbol out of range");
+        return symbols[id];
+    }
+    
+    template <typename Node>
+    std::unique_ptr<Node> located(std::unique_ptr<Node> node, int line, int column, int quick_slot) {
+        node->line = line;
+        node->column = column;
+        node->quick_slot = quick_slot;
+        return node;
+    }
+    
+    std::unique_ptr<Expression> expression() {
+        DepthScope scope(depth);
+        auto tag = static_cast<SnapshotTag>(byte());
+        if (tag == SnapshotTag::NONE) return nullptr;
+        int line = static_cast<int>(varint());
+        int column = static_cast<int>(varint());
+        int quick_slot = static_cast<int>(varint()) - 1;
+        std::unique_ptr<Expression> expr;
+        switch (tag) {
+            case SnapshotTag::NUMBER: {
+                uint64_t id = varint();
+                if (id >= numbers.size()) corrupt("number out of range");
+                expr = std::make_unique<NumberLiteral>(numbers[id]);
+                break;
+            }
+            case SnapshotTag::STRING:
+                expr = std::make_unique<StringLiteral>(symbol());
+                break;
+            case SnapshotTag::IDENTIFIER:
+                expr = std::make_unique<Identifier>(symbol());
+                break;
+            case SnapshotTag::BINARY: {
+                uint8_t op = byte();
+                if (op > static_cast<uint8_t>(BinaryOp::GE)) corrupt("bad operator");
+                auto left = required_expression();
+                expr = std::make_unique<BinaryOperation>(std::move(left), static_cast<BinaryOp>(op), required_expression());
+                break;
+            }
+            case SnapshotTag::CALL: {
+                auto call = std::make_unique<FunctionCall>(symbol());
+                for (size_t n = count(); n > 0; n--) call->addArgument(required_expression());
+                expr = std::move(call);
+                break;
+            }
+            case SnapshotTag::ARRAY: {
+                auto arr = std::make_unique<ArrayLiteral>();
+                for (size_t n = count(); n > 0; n--) arr->addElement(required_expression());
+                expr = std::move(arr);
+                break;
+            }
+            case SnapshotTag::MAP: {
+                auto map = std::make_unique<MapLiteral>();
+                for (size_t n = count(); n > 0; n--) {
+                    const std::string& key = symbol();
+                    map->addPair(key, required_expression());
+                }
+                expr = std::move(map);
+                break;
+            }
+            case SnapshotTag::ARRAY_ACCESS: {
+                auto arr = required_expression();
+                expr = std::make_unique<ArrayAccess>(std::move(arr), required_expression());
+                break;
+            }
+            case SnapshotTag::MAP_ACCESS: {
+                const std::string& key = symbol();
+                expr = std::make_unique<MapAccess>(required_expression(), key);
+                break;
+            }
+            default:
+                corrupt("expected an expression");
+        }
+        uint8_t type = byte();
+        if (type > static_cast<uint8_t>(StaticType::NEVER)) corrupt("bad static type");
+        expr->static_type = static_cast<StaticType>(type);
+        return located(std::move(expr), line, column, quick_slot);
+    }
+    
+    std::unique_ptr<Expression> required_expression() {
+        auto expr = expression();
+        if (!expr) corrupt("missing expression");
+        return expr;
+    }
+    
+    std::unique_ptr<VariableDeclaration> let_statement() {
+        std::unique_ptr<Statement> stmt = statement();
+        if (!dynamic_cast<VariableDeclaration*>(stmt.get())) corrupt("expected a let");
+        return std::unique_ptr<VariableDeclaration>(static_cast<VariableDeclaration*>(stmt.release()));
+    }
+    
+    void hoisted(std::vector<std::unique_ptr<VariableDeclaration>>& decls) {
+        for (size_t n = count(); n > 0; n--) decls.push_back(let_statement());
+    }
+    
+    std::unique_ptr<Statement> required_statement() {
+        auto stmt = statement();
+        if (!stmt) corrupt("missing statement");
+        return stmt;
+    }
+    
+    std::unique_ptr<BlockStatement> block_statement() {
+        std::unique_ptr<Statement> stmt = required_statement();
+        if (!dynamic_cast<BlockStatement*>(stmt.get())) corrupt("expected a block");
+        return std::unique_ptr<BlockStatement>(static_cast<BlockStatement*>(stmt.release()));
+    }
+    
+    std::unique_ptr<Statement> statement() {
+        DepthScope scope(depth);
+        auto tag = static_cast<SnapshotTag>(byte());
+        if (tag == SnapshotTag::NONE) return nullptr;
+        int line = static_cast<int>(varint());
+        int column = static_cast<int>(varint());
+        int quick_slot = static_cast<int>(varint()) - 1;
+        std::unique_ptr<Statement> stmt;
+        switch (tag) {
+            case SnapshotTag::LET: {
+                const std::string& name = symbol();
+                stmt = std::make_unique<VariableDeclaration>(name, required_expression());
+                break;
+            }
+            case SnapshotTag::ASSIGN: {
+                const std::string& name = symbol();
+                stmt = std::make_unique<AssignmentStatement>(name, required_expression());
+                break;
+            }
+            case SnapshotTag::PRINT:
+                stmt = std::make_unique<PrintStatement>(required_expression());
+                break;
+            case SnapshotTag::RETURN:
+                stmt = std::make_unique<ReturnStatement>(expression());
+                break;
+            case SnapshotTag::BLOCK: {
+                auto block = std::make_unique<BlockStatement>();
+                for (size_t n = count(); n > 0; n--) block->addStatement(required_statement());
+                stmt = std::move(block);
+                break;
+            }
+            case SnapshotTag::IF: {
+                auto condition = required_expression();
+                auto then_branch = required_statement();
+                stmt = std::make_unique<IfStatement>(std::move(condition), std::move(then_branch), statement());
+                break;
+            }
+            case SnapshotTag::WHILE: {
+                auto condition = required_expression();
+                auto loop = std::make_unique<WhileStatement>(std::move(condition), required_statement());
+                hoisted(loop->hoisted_condition);
+                hoisted(loop->hoisted_body);
+                stmt = std::move(loop);
+                break;
+            }
+            case SnapshotTag::FOR: {
+                bool parallel = byte() != 0;
+                auto init = statement();
+                auto condition = expression();
+                auto update = statement();
+                auto loop = std::make_unique<ForStatement>(std::move(init), std::move(condition), std::move(update),
+                                                           required_statement(), parallel);
+                hoisted(loop->hoisted_condition);
+                hoisted(loop->hoisted_body);
+                stmt = std::move(loop);
+                break;
+            }
+            case SnapshotTag::FUNCTION: {
+                auto func = std::make_unique<FunctionDeclaration>(symbol());
+                for (size_t n = count(); n > 0; n--) func->addParameter(symbol());
+                for (size_t n = count(); n > 0; n--) {
+                    func->captures.push_back(symbol());
+                    func->assigns_capture.push_back(byte() != 0);
+                }
+                uint8_t type = byte();
+                if (type > static_cast<uint8_t>(StaticType::NEVER)) corrupt("bad static type");
+                func->return_type = static_cast<StaticType>(type);
+                func->body = block_statement();
+                stmt = std::move(func);
+                break;
+            }
+            default:
+                corrupt("expected a statement");
+        }
+        return located(std::move(stmt), line, column, quick_slot);
+    }
+    
+public:
+    SnapshotReader(const char* data, size_t size)
+        : cursor(reinterpret_cast<const uint8_t*>(data)), end(reinterpret_cast<const uint8_t*>(data) + size) {}
+    
+    std::shared_ptr<const CompiledProgram> read() {
+        if (static_cast<size_t>(end - cursor) < sizeof(snapshot_magic) ||
+            std::memcmp(cursor, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+            throw std::runtime_error("Not a program snapshot");
+        }
+        cursor += sizeof(snapshot_magic);
+        if (varint() != snapshot_version) throw std::runtime_error("Unsupported snapshot version");
+        int quick_slots = static_cast<int>(count());  // At most one per node
+        symbols.resize(count());
+        for (auto& name : symbols) {
+            size_t length = count();
+            name.assign(reinterpret_cast<const char*>(cursor), length);
+            cursor += length;
+        }
+        size_t number_count = count();
+        if (number_count * sizeof(double) > static_cast<size_t>(end - cursor)) corrupt("number pool out of range");
+        numbers.resize(number_count);
+        std::memcpy(numbers.data(), cursor, number_count * sizeof(double));
+        cursor += number_count * sizeof(double);
+        
+        auto program = std::make_unique<Program>();
+        for (size_t n = count(); n > 0; n--) program->addStatement(required_statement());
+        if (cursor != end) corrupt("trailing data");
+        return std::make_shared<const CompiledProgram>(std::move(program), quick_slots);
+    }
+};
+
+void CompiledProgram::save_snapshot(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot write " + path);
+    SnapshotWriter().write(*this, out);
+    if (!out) throw std::runtime_error("Cannot write " + path);
+}
+
+std::shared_ptr<const CompiledProgram> CompiledProgram::load_snapshot(const std::string& path) {
+    MappedFile file(path);
+    return SnapshotReader(file.data(), file.size()).read();
+}
+
+// --- Work-stealing thread pool for parallel loops ---
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    
+    // Completion state shared by the chunks of one parallel_for call
+    struct Batch {
+        std::atomic<size_t> remaining{0};
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+    
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> pending{0};
+    bool stopping = false;
+    
+    static bool& on_pool_thread() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+    
+    // Pops from the back of our own queue, otherwise steals from the front of another
+    bool try_pop(size_t self, std::function<void()>& task) {
+        for (size_t n = 0; n < queues.size(); n++) {
+            WorkerQueue& queue = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (n == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            pending--;
+            return true;
+        }
+        return false;
+    }
+    
+    void worker_loop(size_t index) {
+        on_pool_thread() = true;
+        std::function<void()> task;
+        while (true) {
+            if (try_pop(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping) return;
+        }
+    }
+    
+    static int64_t chunk_begin(int64_t count, size_t chunks, size_t chunk) {
+        return static_cast<int64_t>(static_cast<double>(count) * chunk / chunks);
+    }
+    
+public:
+    explicit WorkStealingPool(size_t thread_count) {
+        for (size_t i = 0; i < thread_count; i++) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    
+    static WorkStealingPool& instance() {
+        static WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+    
+    size_t size() const { return threads.size(); }
+    
+    // Chunk count that leaves enough slack for stealing to even out uneven iterations
+    size_t chunks_for(int64_t count) const {
+        return static_cast<size_t>(std::max<int64_t>(1, std::min<int64_t>(count, size() * 4)));
+    }
+    
+    // Splits [0, count) into contiguous chunks and runs fn(chunk, begin, end) for each, blocking
+    // until all are done. The calling thread helps drain the queues; calls made from a pool thread
+    // run inline so nested parallel loops cannot deadlock. The first exception is rethrown here.
+    void parallel_for(int64_t count, size_t chunks, const std::function<void(size_t, int64_t, int64_t)>& fn) {
+        if (count <= 0) return;
+        chunks = std::max<size_t>(1, std::min<size_t>(chunks, static_cast<size_t>(count)));
+        if (chunks == 1 || on_pool_thread()) {
+            for (size_t c = 0; c < chunks; c++) {
+                fn(c, chunk_begin(count, chunks, c), chunk_begin(count, chunks, c + 1));
+            }
+            return;
+        }
+        
+        auto batch = std::make_shared<Batch>();
+        batch->remaining = chunks;
+        for (size_t c = 0; c < chunks; c++) {
+            int64_t begin = chunk_begin(count, chunks, c);
+            int64_t end = chunk_begin(count, chunks, c + 1);
+            WorkerQueue& queue = *queues[c % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back([batch, &fn, c, begin, end] {
+                try {
+                    fn(c, begin, end);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (!batch->error) batch->error = std::current_exception();
+                }
+                if (--batch->remaining == 0) {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    batch->done.notify_all();
+                }
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            pending += chunks;
+        }
+        wake.notify_all();
+        
+        std::function<void()> task;
+        while (batch->remaining > 0) {
+            if (try_pop(0, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(batch->mutex);
+            batch->done.wait_for(lock, std::chrono::milliseconds(1), [&] { return batch->remaining == 0; });
+        }
+        if (batch->error) std::rethrow_exception(batch->error);
+    }
+};
+
+static const char* parallel_range_error =
+    "Cannot parallelize for loop: start must be an integer and the bound finite and at most 2^53";
+
+// Called from JIT-compiled parallel loops. Each chunk writes its reduction partials to its own
+// slice; the slices are folded in chunk order so results don't depend on scheduling.
+extern "C" void compfoundation_parallel_for(void (*chunk)(int64_t, int64_t, double*, double*),
+                                            double start, double bound, double step, int32_t inclusive,
+                                            double* env, double* result,
+                                            int32_t reduction_count, const char* reduction_ops) {
+    WorkStealingPool& pool = WorkStealingPool::instance();
+    int64_t count = parallel_trip_count(start, bound, step, inclusive != 0);
+    if (count < 0) throw std::runtime_error(parallel_range_error);
+    size_t chunks = pool.chunks_for(count);
+    std::vector<double> partials(chunks * reduction_count);
+    pool.parallel_for(count, chunks, [&](size_t c, int64_t begin, int64_t end) {
+        chunk(begin, end, env, partials.data() + c * reduction_count);
+    });
+    for (int32_t r = 0; r < reduction_count; r++) {
+        bool product = reduction_ops[r] == '*';
+        result[r] = product ? 1.0 : 0.0;
+        for (size_t c = 0; count > 0 && c < chunks; c++) {
+            double partial = partials[c * reduction_count + r];
+            result[r] = product ? result[r] * partial : result[r] + partial;
+        }
+    }
+}
+
+// --- String scanning ---
+// Searches hand the first byte of the needle to memchr, which the C library vectorizes, and only
+// compare the rest at the positions it finds. One scan of the haystack per call.
+inline size_t find_text(std::string_view haystack, std::string_view needle, size_t from) {
+    if (needle.empty()) return from <= haystack.size() ? from : std::string_view::npos;
+    while (from + needle.size() <= haystack.size()) {
+        size_t span = haystack.size() - needle.size() + 1 - from;
+        auto hit = static_cast<const char*>(std::memchr(haystack.data() + from, needle[0], span));
+        if (!hit) break;
+        size_t at = hit - haystack.data();
+        if (std::memcmp(hit + 1, needle.data() + 1, needle.size() - 1) == 0) return at;
+        from = at + 1;
+    }
+    return std::string_view::npos;
+}
+
+inline bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// A string position argument truncated and clamped to [0, limit]
+inline size_t clamp_position(double position, size_t limit) {
+    position = std::trunc(position);
+    if (!(position > 0)) return 0;
+    return position < static_cast<double>(limit) ? static_cast<size_t>(position) : limit;
+}
+
+// --- Data file loaders ---
+// load_f64 and load_csv memory-map their file. A raw double file is used in place as a packed
+// array that keeps the mapping alive. A CSV is cut into chunks at line boundaries and parsed on
+// the work-stealing pool: one pass counts each chunk's rows with memchr, so every chunk knows
+// where its rows go, and a second pass parses the fields straight into the column arrays with
+// std::from_chars.
+
+// The file as native-endian doubles, without copying
+Value load_f64_file(const std::string& path) {
+    auto file = std::make_shared<const MappedFile>(path);
+    if (file->size() % sizeof(double) != 0) {
+        throw std::runtime_error(path + " is not a whole number of doubles");
+    }
+    auto data = reinterpret_cast<const double*>(file->data());
+    return Value(std::make_shared<const PackedArray>(data, file->size() / sizeof(double), file));
+}
+
+class CsvLoader {
+private:
+    static const size_t min_chunk_bytes = 1 << 20;  // Smaller files parse on the calling thread
+    
+    const char* begin;
+    const char* end;
+    std::vector<std::string> names;
+    std::vector<const char*> chunk_starts;  // Line-aligned; the last entry is `end`
+    
+    // Calls fn(line_begin, line_end) for each non-empty line of [from, to), minus any trailing '\r'
+    template <typename Fn>
+    static void for_each_line(const char* from, const char* to, Fn fn) {
+        while (from < to) {
+            auto newline = static_cast<const char*>(std::memchr(from, '\n', to - from));
+            const char* line_end = newline ? newline : to;
+            const char* trimmed = line_end > from && line_end[-1] == '\r' ? line_end - 1 : line_end;
+            if (trimmed > from) fn(from, trimmed);
+            from = line_end + 1;
+        }
+    }
+    
+    static const char* skip_spaces(const char* p, const char* limit) {
+        while (p < limit && (*p == ' ' || *p == '\t')) p++;
+        return p;
+    }
+    
+    // Parses the field at `field` into `out`, leaving it NaN unless the whole field is a number.
+    // from_chars stops at the comma by itself, so numeric fields are scanned once. Returns the end
+    // of the field.
+    static const char* parse_field(const char* field, const char* line_end, double& out) {
+        const char* p = skip_spaces(field, line_end);
+        if (p < line_end && *p == '+') p++;
+        double value;
+        auto result = std::from_chars(p, line_end, value);
+        if (result.ec == std::errc()) {
+            p = skip_spaces(result.ptr, line_end);
+            if (p == line_end || *p == ',') {
+                out = value;
+                return p;
+            }
+        }
+        auto comma = static_cast<const char*>(std::memchr(p, ',', line_end - p));
+        return comma ? comma : line_end;
+    }
+    
+    void parse_rows(const char* from, const char* to, const std::vector<double*>& columns, size_t row) const {
+        const double missing = std::numeric_limits<double>::quiet_NaN();
+        for_each_line(from, to, [&](const char* line, const char* line_end) {
+            const char* field = line;
+            for (double* column : columns) {
+                column[row] = missing;
+                if (field <= line_end) field = parse_field(field, line_end, column[row]) + 1;
+            }
+            row++;
+        });
+    }
+    
+public:
+    explicit CsvLoader(const MappedFile& file) : begin(file.data()), end(file.data() + file.size()) {
+        const char* header_end = begin ? static_cast<const char*>(std::memchr(begin, '\n', end - begin)) : nullptr;
+        if (!header_end) header_end = end;
+        const char* field = begin;
+        while (field <= header_end && begin) {
+            const char* comma = static_cast<const char*>(std::memchr(field, ',', header_end - field));
+            const char* field_end = comma ? comma : header_end;
+            std::string_view name(field, field_end - field);
+            while (!name.empty() && (is_space(name.back()) || name.back() == '"')) name.remove_suffix(1);
+            while (!name.empty() && (is_space(name.front()) || name.front() == '"')) name.remove_prefix(1);
+            names.emplace_back(name);
+            field = field_end + 1;
+        }
+        
+        const char* body = header_end < end ? header_end + 1 : end;
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(WorkStealingPool::instance().size() * 4,
+                                                             (end - body) / min_chunk_bytes));
+        chunk_starts.push_back(body);
+        for (size_t c = 1; c < chunks; c++) {
+            const char* guess = body + (end - body) * c / chunks;
+            if (guess <= chunk_starts.back()) continue;
+            auto newline = static_cast<const char*>(std::memchr(guess, '\n', end - guess));
+            if (!newline) break;
+            chunk_starts.push_back(newline + 1);
+        }
+        chunk_starts.push_back(end);
+    }
+    
+    Value load() const {
+        WorkStealingPool& pool = WorkStealingPool::instance();
+        size_t chunks = chunk_starts.size() - 1;
+        std::vector<size_t> first_row(chunks + 1, 0);
+        pool.parallel_for(chunks, chunks, [&](size_t c, int64_t, int64_t) {
+            size_t rows = 0;
+            for_each_line(chunk_starts[c], chunk_starts[c + 1], [&rows](const char*, const char*) { rows++; });
+            first_row[c + 1] = rows;
+        });
+        for (size_t c = 0; c < chunks; c++) first_row[c + 1] += first_row[c];
+        
+        // Left uninitialized: every slot is written exactly once below
+        size_t rows = first_row[chunks];
+        std::vector<std::shared_ptr<double[]>> storage;
+        std::vector<double*> columns;
+        for (size_t c = 0; c < names.size(); c++) {
+            storage.emplace_back(new double[rows]);
+            columns.push_back(storage.back().get());
+        }
+        pool.parallel_for(chunks, chunks, [&](size_t c, int64_t, int64_t) {
+            parse_rows(chunk_starts[c], chunk_starts[c + 1], columns, first_row[c]);
+        });
+        
+        MapEntries result;
+        for (size_t c = 0; c < names.size(); c++) {
+            result[intern(names[c])] = Value(std::make_shared<const PackedArray>(columns[c], rows, storage[c]));
+        }
+        return Value(std::move(result));
+    }
+};
+
+// A CSV file with a header row, as a map from column name to a packed array of its values
+Value load_csv_file(const std::string& path) {
+    MappedFile file(path);
+    return CsvLoader(file).load();
+}
+
+// --- Value files ---
+// save(path, value) and load(path) store numbers, strings, arrays and maps in a compact binary
+// file. Layout: the magic "CFDATA", a format version, the byte length of the value tree and the
+// data section's alignment, then the tree in preorder, then the numeric arrays' doubles. Tags are
+// bytes, counts varints, numbers native doubles. A numeric array stores its length and its offset
+// into the data section; arrays of a page or more start on a page boundary, and so does the data
+// section when it holds any, so small files stay small. load maps the file read-only and keeps
+// it mapped for as long as any loaded array or string refers to it: numeric arrays and strings
+// point into the mapping, so loading a large array is a single mmap, and pages are only read
+// when first used. Arrays are immutable, so a script "changing" one builds a new array and the
+// mapping is never written. save writes a temporary file next to the target and renames it over
+// the path, so a file that loaded values still map is replaced rather than truncated under them.
+enum class ValueTag : uint8_t { NUMBER, STRING, ARRAY, NUMERIC_ARRAY, MAP };
+
+static const char value_file_magic[6] = {'C', 'F', 'D', 'A', 'T', 'A'};
+static const uint64_t value_file_version = 1;
+static const size_t value_file_page = 4096;
+// Arrays and maps are written and read recursively, so nesting is capped to keep a deep value or a
+// crafted file from overflowing the stack
+static const int value_file_max_depth = 10000;
+
+class ValueWriter {
+private:
+    std::string tree;
+    struct NumericArray {
+        const double* data;
+        std::vector<double> gathered;  // Numbers copied out of a non-packed array
+        size_t size;
+        size_t offset;
+    };
+    std::vector<NumericArray> arrays;
+    size_t data_size = 0;
+    size_t data_alignment = sizeof(double);
+    int depth = 0;
+    
+    static void varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+    
+    static size_t align(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+    
+    void text(std::string_view bytes) {
+        varint(tree, bytes.size());
+        tree.append(bytes.data(), bytes.size());
+    }
+    
+    void numeric_array(const double* data, std::vector<double> gathered, size_t size) {
+        size_t bytes = size * sizeof(double);
+        if (bytes >= value_file_page) data_alignment = value_file_page;
+        size_t offset = align(data_size, bytes >= value_file_page ? value_file_page : sizeof(double));
+        tree.push_back(static_cast<char>(ValueTag::NUMERIC_ARRAY));
+        varint(tree, size);
+        varint(tree, offset);
+        arrays.push_back({data, std::move(gathered), size, offset});
+        if (!data) arrays.back().data = arrays.back().gathered.data();
+        data_size = offset + bytes;
+    }
+    
+    void value(const Value& val) {
+        if (depth == value_file_max_depth) throw std::runtime_error("Cannot save a value nested this deeply");
+        depth++;
+        switch (val.type) {
+            case Value::NUMBER: {
+                tree.push_back(static_cast<char>(ValueTag::NUMBER));
+                tree.append(reinterpret_cast<const char*>(&val.number_value), sizeof(double));
+                break;
+            }
+            case Value::STRING:
+                tree.push_back(static_cast<char>(ValueTag::STRING));
+                text(val.text());
+                break;
+            case Value::ARRAY: {
+                if (val.packed_value) {
+                    numeric_array(val.packed_value->data, {}, val.packed_value->size);
+                    break;
+                }
+                const auto& elements = val.array_elements();
+                bool numeric = std::all_of(elements.begin(), elements.end(),
+                                           [](const Value& e) { return e.type == Value::NUMBER; });
+                if (numeric) {
+                    std::vector<double> gathered;
+                    gathered.reserve(elements.size());
+                    for (const auto& element : elements) gathered.push_back(element.number_value);
+                    numeric_array(nullptr, std::move(gathered), elements.size());
+                    break;
+                }
+                tree.push_back(static_cast<char>(ValueTag::ARRAY));
+                varint(tree, elements.size());
+                for (const auto& element : elements) value(element);
+                break;
+            }
+            case Value::MAP:
+                tree.push_back(static_cast<char>(ValueTag::MAP));
+                varint(tree, val.map_entries().size());
+                for (const auto& entry : val.map_entries()) {
+                    text(entry.first->text);
+                    value(entry.second);
+                }
+                break;
+            case Value::FUNCTION:
+                throw std::runtime_error("Cannot save a function");
+        }
+        depth--;
+    }
+    
+public:
+    // Writes the file and returns its size in bytes
+    size_t write(const Value& val, std::ostream& out) {
+        value(val);
+        std::string header(value_file_magic, sizeof(value_file_magic));
+        varint(header, value_file_version);
+        varint(header, tree.size());
+        varint(header, data_alignment);
+        size_t data_start = align(header.size() + tree.size(), data_alignment);
+        out.write(header.data(), header.size());
+        out.write(tree.data(), tree.size());
+        
+        size_t position = header.size() + tree.size();
+        static const char zeros[value_file_page] = {};
+        for (const auto& array : arrays) {
+            size_t target = data_start + array.offset;
+            out.write(zeros, target - position);
+            out.write(reinterpret_cast<const char*>(array.data), array.size * sizeof(double));
+            position = target + array.size * sizeof(double);
+        }
+        return position;
+    }
+};
+
+class ValueReader {
+private:
+    std::shared_ptr<const MappedFile> file;
+    const uint8_t* cursor;
+    const uint8_t* end;
+    const char* data_section = nullptr;
+    int depth = 0;
+    
+    [[noreturn]] static void corrupt(const std::string& what) {
+        throw std::runtime_error("Corrupt data file: " + what);
+    }
+    
+    struct DepthScope {
+        int& depth;
+        explicit DepthScope(int& d) : depth(d) {
+            if (depth == value_file_max_depth) corrupt("nesting too deep");
+            depth++;
+        }
+        ~DepthScope() { depth--; }
+    };
+    
+    uint8_t byte() {
+        if (cursor == end) corrupt("unexpected end of data");
+        return *cursor++;
+    }
+    
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return value;
+        }
+        corrupt("varint too long");
+    }
+    
+    // Counts are bounded by the bytes left, so a bad count can't trigger a huge allocation
+    size_t count() {
+        uint64_t n = varint();
+        if (n > static_cast<uint64_t>(end - cursor)) corrupt("count out of range");
+        return static_cast<size_t>(n);
+    }
+    
+    std::string_view text() {
+        size_t size = count();
+        std::string_view bytes(reinterpret_cast<const char*>(cursor), size);
+        cursor += size;
+        return bytes;
+    }
+    
+    Value value() {
+        DepthScope scope(depth);
+        switch (static_cast<ValueTag>(byte())) {
+            case ValueTag::NUMBER: {
+                if (static_cast<size_t>(end - cursor) < sizeof(double)) corrupt("unexpected end of data");
+                double number;
+                std::memcpy(&number, cursor, sizeof number);
+                cursor += sizeof number;
+                return Value(number);
+            }
+            case ValueTag::STRING: {
+                std::string_view bytes = text();
+                return Value(bytes.data(), bytes.size(), file);
+            }
+            case ValueTag::NUMERIC_ARRAY: {
+                uint64_t size = varint();
+                uint64_t offset = varint();
+                const char* file_end = file->data() + file->size();
+                if (offset % sizeof(double) != 0 || offset > static_cast<uint64_t>(file_end - data_section) ||
+                    size > static_cast<uint64_t>(file_end - data_section - offset) / sizeof(double)) {
+                    corrupt("array out of range");
+                }
+                auto data = reinterpret_cast<const double*>(data_section + offset);
+                return Value(std::make_shared<const PackedArray>(data, size, file));
+            }
+            case ValueTag::ARRAY: {
+                std::vector<Value> elements(count());
+                for (auto& element : elements) element = value();
+                return Value(std::move(elements));
+            }
+            case ValueTag::MAP: {
+                size_t size = count();
+                MapEntries entries;
+                for (size_t i = 0; i < size; i++) {
+                    const InternedString* key = intern(std::string(text()));
+                    entries[key] = value();
+                }
+                return Value(std::move(entries));
+            }
+        }
+        corrupt("unknown tag");
+    }
+    
+public:
+    explicit ValueReader(std::shared_ptr<const MappedFile> mapped) : file(std::move(mapped)) {
+        cursor = reinterpret_cast<const uint8_t*>(file->data());
+        end = cursor + file->size();
+    }
+    
+    Value read() {
+        if (static_cast<size_t>(end - cursor) < sizeof(value_file_magic) ||
+            std::memcmp(cursor, value_file_magic, sizeof(value_file_magic)) != 0) {
+            corrupt("bad magic");
+        }
+        cursor += sizeof(value_file_magic);
+        if (varint() != value_file_version) corrupt("unsupported version");
+        size_t tree_size = count();
+        uint64_t alignment = varint();
+        if (alignment != sizeof(double) && alignment != value_file_page) corrupt("bad alignment");
+        size_t tree_start = cursor - reinterpret_cast<const uint8_t*>(file->data());
+        size_t data_start = (tree_start + tree_size + alignment - 1) / alignment * alignment;
+        data_section = file->data() + std::min(data_start, file->size());
+        end = cursor + tree_size;
+        return value();
+    }
+};
+
+size_t save_value_file(const std::string& path, const Value& val) {
+    static std::atomic<uint64_t> saves{0};
+    std::string temp = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(saves++);
+    std::ofstream out(temp, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot write " + path);
+    try {
+        size_t bytes = ValueWriter().write(val, out);
+        out.close();
+        if (!out || std::rename(temp.c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot write " + path);
+        return bytes;
+    } catch (...) {
+        out.close();
+        std::remove(temp.c_str());
+        throw;
+    }
+}
+
+Value load_value_file(const std::string& path) {
+    return ValueReader(std::make_shared<const MappedFile>(path)).read();
+}
+
+// C++ callback callable from scripts like a builtin
+typedef std::function<Value(const std::vector<Value>&)> NativeFunction;
+
+// --- Element-wise array arithmetic ---
+// Arithmetic operators and comparisons apply element by element to numeric arrays of the same
+// length, and a number on either side is broadcast to every element, as in `a * 2 + b`. Rather
+// than running one operator at a time, the interpreter collects the whole tree of operators into
+// an ElementwiseExpression in postfix order and evaluates it in a single pass over the elements,
+// one block at a time: intermediate results live in block-sized buffers that stay in cache
+// instead of full-length temporary arrays. Each operator's inner loop is a plain loop over
+// doubles that the compiler vectorizes. Large expressions are split across the thread pool, and
+// the interpreter can JIT-compile one into a single native loop (see compile_elementwise_kernel).
+class ElementwiseExpression {
+public:
+    struct Step {
+        enum Kind : uint8_t { ARRAY, NUMBER, OPERATION } kind;
+        BinaryOp op;
+        double number;       // NUMBER
+        const double* data;  // ARRAY
+    };
+    
+    static const size_t block_size = 256;
+    static const size_t chunk_elements = 1 << 14;  // Smaller expressions run on the calling thread
+    
+private:
+    std::vector<Step> steps;  // Postfix
+    std::vector<std::shared_ptr<const PackedArray>> sources;  // Keep the ARRAY steps' data alive
+    size_t length = 0;
+    bool has_array = false;
+    const BinaryOperation* root = nullptr;
+    
+    // One entry of the evaluation stack: block-sized data, or a number when `data` is null
+    struct Slot {
+        const double* data;
+        double number;
+    };
+    
+    template <typename F>
+    static void loop(const Slot& l, const Slot& r, double* __restrict out, size_t n, F f) {
+        if (l.data && r.data) {
+            const double* __restrict x = l.data;
+            const double* __restrict y = r.data;
+            for (size_t i = 0; i < n; i++) out[i] = f(x[i], y[i]);
+        } else if (l.data) {
+            const double* __restrict x = l.data;
+            double y = r.number;
+            for (size_t i = 0; i < n; i++) out[i] = f(x[i], y);
+        } else {
+            double x = l.number;
+            const double* __restrict y = r.data;
+            for (size_t i = 0; i < n; i++) out[i] = f(x, y[i]);
+        }
+    }
+    
+    // The switch stays outside the loops so each operator gets its own vectorizable loop
+    static void apply(BinaryOp op, const Slot& l, const Slot& r, double* out, size_t n) {
+        switch (op) {
+            case BinaryOp::ADD: loop(l, r, out, n, [](double a, double b) { return a + b; }); break;
+            case BinaryOp::SUB: loop(l, r, out, n, [](double a, double b) { return a - b; }); break;
+            case BinaryOp::MUL: loop(l, r, out, n, [](double a, double b) { return a * b; }); break;
+            case BinaryOp::DIV: loop(l, r, out, n, [](double a, double b) { return a / b; }); break;
+            case BinaryOp::POW: loop(l, r, out, n, [](double a, double b) { return std::pow(a, b); }); break;
+            case BinaryOp::EQ: loop(l, r, out, n, [](double a, double b) { return a == b ? 1.0 : 0.0; }); break;
+            case BinaryOp::NE: loop(l, r, out, n, [](double a, double b) { return a != b ? 1.0 : 0.0; }); break;
+            case BinaryOp::LT: loop(l, r, out, n, [](double a, double b) { return a < b ? 1.0 : 0.0; }); break;
+            case BinaryOp::GT: loop(l, r, out, n, [](double a, double b) { return a > b ? 1.0 : 0.0; }); break;
+            case BinaryOp::LE: loop(l, r, out, n, [](double a, double b) { return a <= b ? 1.0 : 0.0; }); break;
+            case BinaryOp::GE: loop(l, r, out, n, [](double a, double b) { return a >= b ? 1.0 : 0.0; }); break;
+        }
+    }
+    
+public:
+    // `value` as an operand of `op`: a number, or an array whose elements are all numbers
+    static ElementwiseExpression operand(const Value& value, BinaryOp op) {
+        ElementwiseExpression expr;
+        if (value.type == Value::NUMBER) {
+            expr.steps.push_back({Step::NUMBER, op, value.number_value, nullptr});
+            return expr;
+        }
+        std::shared_ptr<const PackedArray> packed = value.packed_value;
+        if (!packed) {
+            std::vector<double> numbers;
+            numbers.reserve(value.array_size());
+            for (const auto& element : value.array_elements()) {
+                if (element.type != Value::NUMBER) {
+                    throw std::runtime_error(std::string("Invalid operation: ") + binary_op_symbol(op) +
+                                             " on array element " + element.to_string());
+                }
+                numbers.push_back(element.number_value);
+            }
+            packed = std::make_shared<const PackedArray>(std::move(numbers));
+        }
+        expr.steps.push_back({Step::ARRAY, op, 0, packed->data});
+        expr.length = packed->size;
+        expr.has_array = true;
+        expr.sources.push_back(std::move(packed));
+        return expr;
+    }
+    
+    static ElementwiseExpression combine(const BinaryOperation* binop, ElementwiseExpression left,
+                                         ElementwiseExpression right) {
+        if (left.has_array && right.has_array && left.length != right.length) {
+            throw std::runtime_error(std::string("Invalid operation: ") + binary_op_symbol(binop->op) +
+                                     " on arrays of length " + std::to_string(left.length) + " and " +
+                                     std::to_string(right.length));
+        }
+        ElementwiseExpression expr = std::move(left);
+        expr.steps.insert(expr.steps.end(), right.steps.begin(), right.steps.end());
+        expr.steps.push_back({Step::OPERATION, binop->op, 0, nullptr});
+        expr.sources.insert(expr.sources.end(), right.sources.begin(), right.sources.end());
+        if (!expr.has_array) expr.length = right.length;
+        expr.has_array = expr.has_array || right.has_array;
+        expr.root = binop;
+        return expr;
+    }
+    
+    const std::vector<Step>& postfix() const { return steps; }
+    size_t size() const { return length; }
+    const BinaryOperation* site() const { return root; }
+    
+    // Writes elements [begin, end) of the result to out + begin
+    void evaluate(double* out, size_t begin, size_t end) const {
+        size_t operations = 0;
+        for (const Step& step : steps) operations += step.kind == Step::OPERATION;
+        // Every operator but the last gets its own buffer, so no loop reads what it writes
+        std::vector<double> buffers((operations - 1) * block_size);
+        std::vector<Slot> stack;
+        stack.reserve(steps.size());
+        for (size_t block = begin; block < end; block += block_size) {
+            size_t n = std::min(block_size, end - block);
+            double* next_buffer = buffers.data();
+            stack.clear();
+            for (const Step& step : steps) {
+                if (step.kind == Step::ARRAY) {
+                    stack.push_back({step.data + block, 0});
+                } else if (step.kind == Step::NUMBER) {
+                    stack.push_back({nullptr, step.number});
+                } else {
+                    Slot r = stack.back();
+                    stack.pop_back();
+                    Slot l = stack.back();
+                    double* dst = &step == &steps.back() ? out + block : next_buffer;
+                    next_buffer += block_size;
+                    apply(step.op, l, r, dst, n);
+                    stack.back() = {dst, 0};
+                }
+            }
+        }
+    }
+};
+
+// A chain of range/map/filter/reduce calls run as one pass with no intermediate arrays
+struct Pipeline {
+    // Source: either an arithmetic range or the elements of an array
+    bool is_range = false;
+    double start = 0;
+    double step = 1;
+    int64_t count = 0;
+    Value source;
+    std::vector<std::pair<char, Value>> stages;  // 'm' (map) or 'f' (filter) with its callback
+    bool reduces = false;
+    Value reducer;
+    Value initial;
+};
+
+class JITEngine;
+
+// JIT-compiled fused loop for one pipeline call site, valid for the callbacks it was built with
+struct FusedKernel {
+    std::vector<const FunctionDeclaration*> callbacks;
+    // Every name the compiled functions call, with the function it named then (null for builtins),
+    // so a kernel built before one of them was rebound isn't reused
+    std::vector<std::pair<std::string, const FunctionDeclaration*>> callees;
+    std::shared_ptr<JITEngine> engine;
+    void* code = nullptr;
+};
+
+// JIT-compiled loop for one element-wise expression site and shape: which leaves were arrays and
+// which numbers. A site evaluated with several shapes keeps a kernel for each.
+struct ElementwiseKernel {
+    std::shared_ptr<JITEngine> engine;
+    void* code = nullptr;
+};
+
+// --- Script profiler ---
+// Opt-in instrumenting profiler for the interpreter. Records call counts with inclusive and
+// exclusive wall time per user function, statement hits per source line, and exclusive time per
+// distinct call stack for flamegraphs. Not thread-safe: attach one per Interpreter. Parallel loop
+// workers don't report to it, so their time shows up as exclusive time of the enclosing frame.
+class Profiler {
+public:
+    struct FunctionStats {
+        uint64_t calls = 0;
+        std::chrono::nanoseconds inclusive{0};  // Counted once for recursive calls
+        std::chrono::nanoseconds exclusive{0};
+    };
+    
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Frame {
+        std::string stack;  // "main;outer;inner"
+        std::string name;
+        Clock::time_point start;
+        std::chrono::nanoseconds children{0};
+    };
+    
+    std::vector<Frame> frames;
+    std::unordered_map<std::string, int> active;  // Frames per function currently on the stack
+    std::unordered_map<std::string, FunctionStats> function_stats;
+    std::map<int, uint64_t> line_hits;
+    std::map<std::string, std::chrono::nanoseconds> stack_times;
+    
+public:
+    void enter(const std::string& name) {
+        Frame frame;
+        frame.stack = frames.empty() ? name : frames.back().stack + ";" + name;
+        frame.name = name;
+        frame.start = Clock::now();
+        frames.push_back(std::move(frame));
+        active[name]++;
+    }
+    
+    void exit() {
+        Frame& frame = frames.back();
+        auto inclusive = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start);
+        auto exclusive = inclusive - frame.children;
+        FunctionStats& stats = function_stats[frame.name];
+        stats.calls++;
+        stats.exclusive += exclusive;
+        if (--active[frame.name] == 0) stats.inclusive += inclusive;
+        stack_times[frame.stack] += exclusive;
+        frames.pop_back();
+        if (!frames.empty()) frames.back().children += inclusive;
+    }
+    
+    void hit_line(int line) {
+        if (line > 0) line_hits[line]++;
+    }
+    
+    const std::unordered_map<std::string, FunctionStats>& functions() const { return function_stats; }
+    const std::map<int, uint64_t>& lines() const { return line_hits; }
+    
+    // One `frame;frame;frame microseconds` line per stack, the input format of flamegraph.pl
+    void write_collapsed(std::ostream& out) const {
+        for (const auto& entry : stack_times) {
+            out << entry.first << " " << std::chrono::duration_cast<std::chrono::microseconds>(entry.second).count() << "\n";
+        }
+    }
+    
+    // Functions by exclusive time, then the most executed lines
+    void write_report(std::ostream& out, size_t top_lines = 10) const {
+        std::vector<std::pair<std::string, FunctionStats>> sorted(function_stats.begin(), function_stats.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.second.exclusive > b.second.exclusive;
+        });
+        auto ms = [](std::chrono::nanoseconds t) { return std::chrono::duration<double, std::milli>(t).count(); };
+        out << std::fixed << std::setprecision(3);
+        out << "function                    calls   inclusive ms   exclusive ms" << std::endl;
+        for (const auto& entry : sorted) {
+            out << std::left << std::setw(24) << entry.first << std::right << std::setw(9) << entry.second.calls
+                << std::setw(15) << ms(entry.second.inclusive) << std::setw(15) << ms(entry.second.exclusive) << std::endl;
+        }
+        std::vector<std::pair<int, uint64_t>> hot(line_hits.begin(), line_hits.end());
+        std::sort(hot.begin(), hot.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        if (hot.size() > top_lines) hot.resize(top_lines);
+        out << "\nline        hits" << std::endl;
+        for (const auto& entry : hot) {
+            out << std::setw(4) << entry.first << std::setw(12) << entry.second << std::endl;
+        }
+    }
+};
+
+// Enters a profiler frame for the lifetime of the scope, if there is a profiler
+class ProfileScope {
+private:
+    Profiler* profiler;
+    
+public:
+    ProfileScope(Profiler* p, const std::string& name) : profiler(p) {
+        if (profiler) profiler->enter(name);
+    }
+    ~ProfileScope() {
+        if (profiler) profiler->exit();
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Return value for functions
+struct ReturnValue {
+    Value value;
+    bool has_value;
+    
+    ReturnValue() : has_value(false) {}
+    ReturnValue(const Value& v) : value(v), has_value(true) {}
+};
+
+// A local variable. One that nested functions capture moves into a shared cell when the first
+// closure over it is created; from then on reads and writes go through the cell.
+struct LocalBinding {
+    Value value;
+    std::shared_ptr<CellObject> cell;
+    
+    Value& get() { return cell ? cell->value : value; }
+    const Value& get() const { return cell ? cell->value : value; }
+};
+
+typedef std::unordered_map<std::string, LocalBinding> LocalScope;
+
+class Interpreter {
+private:
+    std::unordered_map<std::string, Value> global_variables;
+    std::vector<LocalScope> local_scopes;
+    bool in_function = false;
+    // First local scope of the running call: a function sees its own scopes and the globals only
+    size_t frame_base = 0;
+    ReturnValue return_value;
+    
+    // Parallel loop workers read outer variables through the interpreter that spawned them
+    const Interpreter* parent = nullptr;
+    bool auto_parallel = false;
+    int64_t auto_parallel_min_iterations = 4096;
+    bool jit_pipelines = true;
+    int64_t jit_pipeline_min_elements = 4096;
+    std::unordered_map<const FunctionCall*, FusedKernel> fused_kernels;
+    std::map<std::pair<const BinaryOperation*, std::string>, ElementwiseKernel> elementwise_kernels;
+    // Each string literal's entry in the intern table, looked up on its first evaluation
+    std::unordered_map<const StringLiteral*, const InternedString*> literal_strings;
+    
+    // Keeps the AST alive for as long as this execution holds FUNCTION values pointing into it
+    std::shared_ptr<const CompiledProgram> compiled;
+    std::ostream* output = &std::cout;
+    std::unordered_map<std::string, NativeFunction> native_functions;
+    Profiler* profiler = nullptr;  // Stays null in parallel loop workers
+    // Type inference assumes builtins mean what they say; a native callback shadowing one voids that
+    bool static_types = true;
+    std::vector<QuickForm> quick_forms;  // Indexed by ASTNode::quick_slot
+    // Tracks the arrays and maps this execution allocates; parallel loop workers share the spawner's
+    std::shared_ptr<Heap> heap = Heap::create();
+    
+    // Workers don't JIT pipelines: each chunk would compile its own copy
+    explicit Interpreter(const Interpreter* spawner)
+        : in_function(spawner->in_function), parent(spawner), jit_pipelines(false), output(spawner->output),
+          static_types(spawner->static_types), quick_forms(spawner->quick_forms), heap(spawner->heap) {}
+    
+    void push_scope() {
+        COMPFOUNDATION_STAT(scope_pushes++);
+        local_scopes.push_back({});
+    }
+    
+    Value& get_variable(const std::string& name) {
+        COMPFOUNDATION_STAT(variable_lookups++);
+        // Check the current call's scopes from innermost to outermost
+        for (size_t i = local_scopes.size(); i-- > frame_base;) {
+            auto found = local_scopes[i].find(name);
+            if (found != local_scopes[i].end()) return found->second.get();
+        }
+        // Check global scope
+        if (global_variables.find(name) != global_variables.end()) {
+            return global_variables[name];
+        }
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    
+    // Read-only lookup that also searches the spawning interpreter: all of its visible scopes from
+    // the loop body itself, only its globals from functions the body calls
+    const Value& lookup_variable(const std::string& name) const {
+        COMPFOUNDATION_STAT(variable_lookups++);
+        for (size_t i = local_scopes.size(); i-- > frame_base;) {
+            auto found = local_scopes[i].find(name);
+            if (found != local_scopes[i].end()) return found->second.get();
+        }
+        auto found = global_variables.find(name);
+        if (found != global_variables.end()) return found->second;
+        if (parent) return frame_base == 0 ? parent->lookup_variable(name) : parent->lookup_global(name);
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    
+    const Value& lookup_global(const std::string& name) const {
+        auto found = global_variables.find(name);
+        if (found != global_variables.end()) return found->second;
+        if (parent) return parent->lookup_global(name);
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    
+    bool has_global(const std::string& name) const {
+        return global_variables.count(name) || (parent && parent->has_global(name));
+    }
+    
+    const NativeFunction* find_native(const std::string& name) const {
+        auto found = native_functions.find(name);
+        if (found != native_functions.end()) return &found->second;
+        return parent ? parent->find_native(name) : nullptr;
+    }
+    
+    bool has_variable(const std::string& name) const {
+        COMPFOUNDATION_STAT(variable_lookups++);
+        for (size_t i = local_scopes.size(); i-- > frame_base;) {
+            if (local_scopes[i].count(name)) return true;
+        }
+        if (global_variables.count(name)) return true;
+        return parent && (frame_base == 0 ? parent->has_variable(name) : parent->has_global(name));
+    }
+    
+    void set_variable(const std::string& name, const Value& value) {
+        // If in local scope, set in the innermost scope. A closure declared earlier may already
+        // hold the cell for this name; the declaration fills it in.
+        if (!local_scopes.empty()) {
+            local_scopes.back()[name].get() = value;
+        } else {
+            global_variables[name] = value;
+        }
+    }
+    
+    // Numbers of an array argument: packed arrays are read in place, others are checked and gathered
+    static const double* numeric_elements(const Value& arr, std::vector<double>& scratch, const std::string& name) {
+        if (arr.packed_value) return arr.packed_value->data;
+        scratch.reserve(arr.array_size());
+        for (const auto& val : arr.array_elements()) {
+            if (val.type != Value::NUMBER) throw std::runtime_error(name + "() requires numeric array");
+            scratch.push_back(val.number_value);
+        }
+        return scratch.data();
+    }
+    
+    Value call_builtin_function(const std::string& name, const std::vector<Value>& args) {
+        COMPFOUNDATION_STAT(record_builtin(name));
+        // Math functions
+        if (name == "sqrt" && args.size() == 1 && args[0].type == Value::NUMBER) {
+            return Value(std::sqrt(args[0].number_value));
+        }
+        if (name == "pow" && args.size() == 2 && args[0].type == Value::NUMBER && args[1].type == Value::NUMBER) {
+            return Value(std::pow(args[0].number_value, args[1].number_value));
+        }
+        if (name == "log" && args.size() == 1 && args[0].type == Value::NUMBER) {
+            return Value(std::log(args[0].number_value));
+        }
+        if (name == "exp" && args.size() == 1 && args[0].type == Value::NUMBER) {
+            return Value(std::exp(args[0].number_value));
+        }
+        if (name == "abs" && args.size() == 1 && args[0].type == Value::NUMBER) {
+            return Value(std::abs(args[0].number_value));
+        }
+        
+        // String functions
+        if (name == "len" && args.size() == 1) {
+            if (args[0].type == Value::STRING) {
+                return Value(static_cast<double>(args[0].text().length()));
+            }
+            if (args[0].type == Value::ARRAY) {
+                return Value(static_cast<double>(args[0].array_size()));
+            }
+            if (args[0].type == Value::MAP) {
+                return Value(static_cast<double>(args[0].map_entries().size()));
+            }
+        }
+        // Data files
+        if (name == "load_csv" && args.size() == 1 && args[0].type == Value::STRING) {
+            return load_csv_file(args[0].to_string());
+        }
+        if (name == "load_f64" && args.size() == 1 && args[0].type == Value::STRING) {
+            return load_f64_file(args[0].to_string());
+        }
+        if (name == "load" && args.size() == 1 && args[0].type == Value::STRING) {
+            return load_value_file(args[0].to_string());
+        }
+        // Writes a file, so unlike the others it isn't in is_builtin_function
+        if (name == "save" && args.size() == 2 && args[0].type == Value::STRING) {
+            return Value(static_cast<double>(save_value_file(args[0].to_string(), args[1])));
+        }
+        // Slices share the argument's storage instead of copying it
+        if (name == "substr" && (args.size() == 2 || args.size() == 3) && args[0].type == Value::STRING &&
+            args[1].type == Value::NUMBER && (args.size() == 2 || args[2].type == Value::NUMBER)) {
+            size_t start = clamp_position(args[1].number_value, args[0].string_size);
+            size_t rest = args[0].string_size - start;
+            return args[0].slice(start, args.size() == 3 ? clamp_position(args[2].number_value, rest) : rest);
+        }
+        if (name == "find" && (args.size() == 2 || args.size() == 3) && args[0].type == Value::STRING &&
+            args[1].type == Value::STRING && (args.size() == 2 || args[2].type == Value::NUMBER)) {
+            size_t from = args.size() == 3 ? clamp_position(args[2].number_value, args[0].string_size) : 0;
+            size_t at = find_text(args[0].text(), args[1].text(), from);
+            return Value(at == std::string_view::npos ? -1.0 : static_cast<double>(at));
+        }
+        if (name == "starts_with" && args.size() == 2 && args[0].type == Value::STRING && args[1].type == Value::STRING) {
+            std::string_view text = args[0].text(), prefix = args[1].text();
+            return Value(text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0 ? 1 : 0);
+        }
+        if (name == "trim" && args.size() == 1 && args[0].type == Value::STRING) {
+            std::string_view text = args[0].text();
+            size_t begin = 0, end = text.size();
+            while (begin < end && is_space(text[begin])) begin++;
+            while (end > begin && is_space(text[end - 1])) end--;
+            return args[0].slice(begin, end - begin);
+        }
+        if (name == "split" && args.size() == 2 && args[0].type == Value::STRING && args[1].type == Value::STRING) {
+            std::string_view text = args[0].text(), separator = args[1].text();
+            if (separator.empty()) throw std::runtime_error("split() separator must not be empty");
+            // One scan; the first part's length estimates how many follow, capped so a short first
+            // field in a long string can't reserve far more than it needs
+            std::vector<Value> parts;
+            size_t start = 0;
+            size_t at = find_text(text, separator, 0);
+            if (at != std::string_view::npos) {
+                parts.reserve(std::min<size_t>(text.size() / (at + separator.size()) + 1, 4096));
+            }
+            for (; at != std::string_view::npos; at = find_text(text, separator, start)) {
+                parts.push_back(args[0].slice(start, at - start));
+                start = at + separator.size();
+            }
+            parts.push_back(args[0].slice(start, text.size() - start));
+            return Value(std::move(parts));
+        }
+        if (name == "join" && args.size() == 2 && args[0].type == Value::ARRAY && args[1].type == Value::STRING) {
+            std::string_view separator = args[1].text();
+            size_t count = args[0].array_size();
+            std::string result;
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0) result += separator;
+                Value part = args[0].array_element(i);
+                if (part.type == Value::STRING) {
+                    result += part.text();
+                } else if (part.type == Value::NUMBER) {
+                    append_number(result, part.number_value);
+                } else {
+                    result += part.to_string();
+                }
+            }
+            return Value(std::move(result));
+        }
+        
+        // Array statistical functions
+        if ((name == "mean" || name == "std" || name == "max" || name == "min" || name == "sum") &&
+            args.size() == 1 && args[0].type == Value::ARRAY) {
+            std::vector<double> scratch;
+            const double* arr = numeric_elements(args[0], scratch, name);
+            size_t n = args[0].array_size();
+            
+            if (name == "mean") {
+                if (n == 0) return Value(0.0);
+                double sum = 0;
+                for (size_t i = 0; i < n; i++) sum += arr[i];
+                return Value(sum / n);
+            }
+            
+            if (name == "std") {
+                if (n <= 1) return Value(0.0);
+                double mean = 0;
+                for (size_t i = 0; i < n; i++) mean += arr[i];
+                mean /= n;
+                double variance = 0;
+                for (size_t i = 0; i < n; i++) variance += (arr[i] - mean) * (arr[i] - mean);
+                variance /= (n - 1);
+                return Value(std::sqrt(variance));
+            }
+            
+            if (name == "max" || name == "min") {
+                if (n == 0) return Value(0.0);
+                double best = arr[0];
+                for (size_t i = 1; i < n; i++) {
+                    if (name == "max" ? arr[i] > best : arr[i] < best) best = arr[i];
+                }
+                return Value(best);
+            }
+            
+            double total = 0;
+            for (size_t i = 0; i < n; i++) total += arr[i];
+            return Value(total);
+        }
+        
+        // Counters collected so far, as text (see RuntimeStats)
+        if (name == "stats" && args.empty()) {
+            std::ostringstream report;
+            runtime_stats().write_report(report);
+            heap->write_report(report);
+            return Value(report.str());
+        }
+        
+        // Type conversion functions
+        if (name == "str" && args.size() == 1) {
+            return Value(args[0].to_string());
+        }
+        
+        if (name == "num" && args.size() == 1 && args[0].type == Value::STRING) {
+            try {
+                return Value(std::stod(std::string(args[0].text())));
+            } catch (...) {
+                throw std::runtime_error("Cannot convert string to number: " + args[0].to_string());
+            }
+        }
+        
+        throw std::runtime_error("Unknown function: " + name);
+    }
+    
+    // A call is pure when it names a builtin, or a user function whose body (transitively) only
+    // writes its own parameters and locals and never prints. Collects the globals and captures
+    // those bodies read into `outer_reads`.
+    bool is_pure_call(const std::string& name, std::unordered_set<std::string>& visiting,
+                      std::unordered_set<std::string>& outer_reads) const {
+        if (!has_variable(name)) return is_builtin_function(name);
+        const Value& callee = lookup_variable(name);
+        if (callee.type != Value::FUNCTION) return false;
+        if (!visiting.insert(name).second) return true;  // Recursive call, already being checked
+        const FunctionDeclaration* func = callee.function();
+        EffectSummary effects;
+        effects.add_statement(func->body.get());
+        if (effects.unknown || effects.prints || effects.declares_functions) return false;
+        auto own = [&](const std::string& var) {
+            return effects.declared.count(var) ||
+                   std::find(func->parameters.begin(), func->parameters.end(), var) != func->parameters.end();
+        };
+        for (const auto& target : effects.assigned) {
+            if (!own(target)) return false;
+        }
+        for (const auto& read : effects.read_order) {
+            if (!own(read)) outer_reads.insert(read);
+        }
+        for (const auto& callee_name : effects.calls) {
+            if (!is_pure_call(callee_name, visiting, outer_reads)) return false;
+        }
+        return true;
+    }
+    
+    static Value reduction_identity(char op, const Value& original) {
+        if (op == '*') return Value(1.0);
+        return original.type == Value::STRING ? Value(std::string()) : Value(0.0);
+    }
+    
+    static Value combine_reduction(char op, const Value& acc, const Value& partial) {
+        if (op == '+' && (acc.type == Value::STRING || partial.type == Value::STRING)) {
+            return Value(acc.to_string() + partial.to_string());
+        }
+        if (acc.type != Value::NUMBER || partial.type != Value::NUMBER) {
+            throw std::runtime_error("Invalid reduction on " + acc.to_string() + " and " + partial.to_string());
+        }
+        return Value(op == '*' ? acc.number_value * partial.number_value : acc.number_value + partial.number_value);
+    }
+    
+    // Runs the iterations of a proven-independent loop on the work-stealing pool. Each chunk gets its
+    // own worker interpreter whose scope shadows the reduction variables with identity values; the
+    // partials are folded back in chunk order.
+    bool execute_parallel_for(const ForStatement* for_stmt, const ParallelLoopPlan& plan, bool require) {
+        // Hoisted invariants live in a scope of their own that the workers read through `parent`
+        push_scope();
+        for (const auto& decl : for_stmt->hoisted_condition) execute_statement(decl.get());
+        Value start = evaluate_expression(plan.start);
+        Value bound = evaluate_expression(plan.bound);
+        if (start.type != Value::NUMBER || bound.type != Value::NUMBER) {
+            local_scopes.pop_back();
+            if (require) throw std::runtime_error("Cannot parallelize for loop: range is not numeric");
+            return false;
+        }
+        int64_t count = parallel_trip_count(start.number_value, bound.number_value, plan.step, plan.inclusive);
+        if (count < 0 && require) {
+            local_scopes.pop_back();
+            throw std::runtime_error(parallel_range_error);
+        }
+        if (!require && count < auto_parallel_min_iterations) {
+            local_scopes.pop_back();
+            return false;
+        }
+        if (count > 0) {
+            for (const auto& decl : for_stmt->hoisted_body) execute_statement(decl.get());
+        }
+        
+        std::vector<Value> originals;
+        for (const auto& reduction : plan.reductions) {
+            originals.push_back(lookup_variable(reduction.first));
+        }
+        WorkStealingPool& pool = WorkStealingPool::instance();
+        size_t chunks = pool.chunks_for(count);
+        std::vector<std::vector<Value>> partials(chunks);
+        pool.parallel_for(count, chunks, [&](size_t chunk, int64_t begin, int64_t end) {
+            Heap::Scope heap_scope(heap.get(), false);
+            Interpreter worker(this);
+            worker.push_scope();
+            auto& scope = worker.local_scopes.back();
+            for (size_t r = 0; r < plan.reductions.size(); r++) {
+                scope[plan.reductions[r].first].value = reduction_identity(plan.reductions[r].second, originals[r]);
+            }
+            for (int64_t k = begin; k < end; k++) {
+                worker.local_scopes.back()[plan.induction_variable].value = Value(start.number_value + k * plan.step);
+                worker.execute_statement(for_stmt->body.get());
+            }
+            for (const auto& reduction : plan.reductions) {
+                partials[chunk].push_back(worker.local_scopes.back()[reduction.first].get());
+            }
+        });
+        
+        // Each chunk starts a + reduction over a number from 0, which only matches the sequential loop
+        // while the sum stays a number: with strings, 0 + "a" in every chunk would leave stray "0"s.
+        // The body has no side effects, so such a loop just runs again sequentially.
+        for (size_t r = 0; r < plan.reductions.size(); r++) {
+            if (plan.reductions[r].second != '+' || originals[r].type != Value::NUMBER) continue;
+            for (size_t c = 0; count > 0 && c < chunks; c++) {
+                if (partials[c][r].type == Value::STRING) {
+                    local_scopes.pop_back();
+                    return false;
+                }
+            }
+        }
+        for (size_t r = 0; r < plan.reductions.size(); r++) {
+            Value combined = originals[r];
+            for (size_t c = 0; count > 0 && c < chunks; c++) {
+                combined = combine_reduction(plan.reductions[r].second, combined, partials[c][r]);
+            }
+            get_variable(plan.reductions[r].first) = combined;
+        }
+        local_scopes.pop_back();
+        return true;
+    }
+    
+    // map/filter/reduce/range unless the script or embedder defines a function of the same name
+    bool is_pipeline_call(const Expression* expr) const {
+        auto call = dynamic_cast<const FunctionCall*>(expr);
+        if (!call) return false;
+        const std::string& name = call->function_name;
+        size_t argc = call->arguments.size();
+        bool known = (name == "range" && argc >= 1 && argc <= 3) ||
+                     ((name == "map" || name == "filter") && argc == 2) ||
+                     (name == "reduce" && argc == 3);
+        return known && !has_variable(name) && !find_native(name);
+    }
+    
+    static const Value& expect_callback(const Value& fn, const std::string& name) {
+        if (fn.type != Value::FUNCTION) throw std::runtime_error(name + "() expects a function");
+        return fn;
+    }
+    
+    // Folds nested map/filter/range calls into `pipeline`, evaluating arguments in source order
+    void build_pipeline(const FunctionCall* call, Pipeline& pipeline) {
+        const std::string& name = call->function_name;
+        if (name == "range") {
+            std::vector<double> bounds;
+            for (const auto& arg : call->arguments) {
+                Value v = evaluate_expression(arg.get());
+                if (v.type != Value::NUMBER) throw std::runtime_error("range() requires numbers");
+                bounds.push_back(v.number_value);
+            }
+            double start = bounds.size() > 1 ? bounds[0] : 0;
+            double end = bounds.size() > 1 ? bounds[1] : bounds[0];
+            double step = bounds.size() > 2 ? bounds[2] : 1;
+            if (step == 0) throw std::runtime_error("range() step cannot be zero");
+            pipeline.is_range = true;
+            pipeline.start = start;
+            pipeline.step = step;
+            pipeline.count = step > 0 ? trip_count(start, end, step, false) : trip_count(-start, -end, -step, false);
+            if (pipeline.count < 0) throw std::runtime_error("range() has too many elements");
+            return;
+        }
+        const Expression* source = call->arguments[0].get();
+        if (is_pipeline_call(source) && static_cast<const FunctionCall*>(source)->function_name != "reduce") {
+            build_pipeline(static_cast<const FunctionCall*>(source), pipeline);
+        } else {
+            pipeline.source = evaluate_expression(source);
+            if (pipeline.source.type != Value::ARRAY) throw std::runtime_error(name + "() expects an array");
+            pipeline.count = pipeline.source.array_size();
+        }
+        Value fn = expect_callback(evaluate_expression(call->arguments[1].get()), name);
+        if (name == "reduce") {
+            pipeline.reduces = true;
+            pipeline.reducer = fn;
+            pipeline.initial = evaluate_expression(call->arguments[2].get());
+        } else {
+            pipeline.stages.push_back({name == "map" ? 'm' : 'f', fn});
+        }
+    }
+    
+    Value evaluate_pipeline(const FunctionCall* call) {
+        Pipeline pipeline;
+        build_pipeline(call, pipeline);
+        
+        if (pipeline.stages.empty() && !pipeline.reduces && pipeline.is_range) {
+            std::vector<double> values(pipeline.count);
+            for (int64_t k = 0; k < pipeline.count; k++) values[k] = pipeline.start + k * pipeline.step;
+            return Value(std::make_shared<const PackedArray>(std::move(values)));
+        }
+        
+        Value fused;
+        if (jit_pipelines && pipeline.count >= jit_pipeline_min_elements && run_fused_jit(call, pipeline, fused)) {
+            return fused;
+        }
+        
+        std::vector<Value> results;
+        Value acc = pipeline.initial;
+        std::vector<Value> unary(1);
+        std::vector<Value> binary(2);
+        for (int64_t k = 0; k < pipeline.count; k++) {
+            Value x = pipeline.is_range ? Value(pipeline.start + k * pipeline.step) : pipeline.source.array_element(k);
+            bool keep = true;
+            for (const auto& stage : pipeline.stages) {
+                unary[0] = std::move(x);
+                Value r = call_closure(stage.second, unary);
+                if (stage.first == 'm') {
+                    x = std::move(r);
+                } else if (r.is_truthy()) {
+                    x = std::move(unary[0]);
+                } else {
+                    keep = false;
+                    break;
+                }
+            }
+            if (!keep) continue;
+            if (pipeline.reduces) {
+                binary[0] = std::move(acc);
+                binary[1] = std::move(x);
+                acc = call_closure(pipeline.reducer, binary);
+            } else {
+                results.push_back(std::move(x));
+            }
+        }
+        return pipeline.reduces ? acc : Value(std::move(results));
+    }
+    
+    // Compiles the pipeline into one native loop when every callback is JIT-compilable and the
+    // source is numeric. Defined after JITEngine.
+    bool run_fused_jit(const FunctionCall* site, const Pipeline& pipeline, Value& result);
+    
+    // Native code computing elements [begin, end) of the expression, or nullptr to interpret it.
+    // Defined after JITEngine.
+    typedef void (*ElementwiseFunction)(const double* const*, const double*, double*, int64_t, int64_t);
+    ElementwiseFunction elementwise_jit(const ElementwiseExpression& expr);
+    
+    Value run_elementwise(const ElementwiseExpression& expr) {
+        size_t length = expr.size();
+        std::shared_ptr<double[]> storage(new double[length]);
+        ElementwiseFunction native = nullptr;
+        std::vector<const double*> arrays;
+        std::vector<double> numbers;
+        if (jit_pipelines && static_cast<int64_t>(length) >= jit_pipeline_min_elements) {
+            native = elementwise_jit(expr);
+            for (const auto& step : expr.postfix()) {
+                if (step.kind == ElementwiseExpression::Step::ARRAY) arrays.push_back(step.data);
+                if (step.kind == ElementwiseExpression::Step::NUMBER) numbers.push_back(step.number);
+            }
+        }
+        WorkStealingPool& pool = WorkStealingPool::instance();
+        size_t chunks = pool.chunks_for(static_cast<int64_t>(length / ElementwiseExpression::chunk_elements));
+        pool.parallel_for(static_cast<int64_t>(length), chunks, [&](size_t, int64_t begin, int64_t end) {
+            if (native) {
+                COMPFOUNDATION_TIER(NATIVE);
+                native(arrays.data(), numbers.data(), storage.get(), begin, end);
+            } else {
+                expr.evaluate(storage.get(), begin, end);
+            }
+        });
+        const double* data = storage.get();
+        return Value(std::make_shared<const PackedArray>(data, length, std::move(storage)));
+    }
+    
+    // Evaluates a binary operation into `value`, except that an operation on arrays is collected
+    // into `pending` instead, so that the tree above it can join the same pass; returns whether
+    // it was. Operands are still evaluated left to right, and errors raised where they were.
+    bool evaluate_binary(const BinaryOperation* binop, Value& value, ElementwiseExpression& pending) {
+        if (static_types && binop->static_type == StaticType::NUMBER &&
+            binop->left->static_type == StaticType::NUMBER && binop->right->static_type == StaticType::NUMBER) {
+            value = Value(evaluate_number(binop));
+            return false;
+        }
+        Value left, right;
+        ElementwiseExpression left_pending, right_pending;
+        bool left_deferred = evaluate_operand(binop->left.get(), left, left_pending);
+        bool right_deferred = evaluate_operand(binop->right.get(), right, right_pending);
+        
+        // Element-wise arithmetic
+        bool left_numeric = left_deferred || left.type == Value::NUMBER || left.type == Value::ARRAY;
+        bool right_numeric = right_deferred || right.type == Value::NUMBER || right.type == Value::ARRAY;
+        bool arrays = left_deferred || right_deferred || left.type == Value::ARRAY || right.type == Value::ARRAY;
+        if (arrays && left_numeric && right_numeric) {
+            if (!left_deferred) left_pending = ElementwiseExpression::operand(left, binop->op);
+            if (!right_deferred) right_pending = ElementwiseExpression::operand(right, binop->op);
+            pending = ElementwiseExpression::combine(binop, std::move(left_pending), std::move(right_pending));
+            return true;
+        }
+        if (left_deferred) left = run_elementwise(left_pending);
+        if (right_deferred) right = run_elementwise(right_pending);
+        
+        // String concatenation
+        if (binop->op == BinaryOp::ADD && (left.type == Value::STRING || right.type == Value::STRING)) {
+            value = Value(left.to_string() + right.to_string());
+            return false;
+        }
+        
+        // Numeric operations
+        if (left.type == Value::NUMBER && right.type == Value::NUMBER) {
+            value = Value(apply_binary(binop->op, left.number_value, right.number_value));
+            return false;
+        }
+        
+        // String comparison
+        if (left.type == Value::STRING && right.type == Value::STRING) {
+            if (binop->op == BinaryOp::EQ) {
+                value = Value(left.same_string(right) ? 1 : 0);
+                return false;
+            }
+            if (binop->op == BinaryOp::NE) {
+                value = Value(left.same_string(right) ? 0 : 1);
+                return false;
+            }
+        }
+        
+        throw std::runtime_error(std::string("Invalid operation: ") + binary_op_symbol(binop->op) + " on " + 
+                               left.to_string() + " and " + right.to_string());
+    }
+    
+    bool evaluate_operand(const Expression* expr, Value& value, ElementwiseExpression& pending) {
+        auto binop = dynamic_cast<const BinaryOperation*>(expr);
+        if (!binop) {
+            value = evaluate_expression(expr);
+            return false;
+        }
+        COMPFOUNDATION_STAT(dispatches++);
+        double number;
+        if (has_quick_slot(binop) && quick_binary(binop, number)) {
+            COMPFOUNDATION_STAT(quickened++);
+            value = Value(number);
+            return false;
+        }
+        return evaluate_binary(binop, value, pending);
+    }
+    
+    // The cell holding local `name` of the running call, moving the variable into one if it has
+    // none yet. A name not declared yet (a function or let further down, or the closure's own
+    // name) gets its cell in the innermost scope, and its declaration fills the cell in.
+    std::shared_ptr<CellObject> capture_cell(const std::string& name) {
+        LocalBinding* binding = nullptr;
+        for (size_t i = local_scopes.size(); i-- > frame_base && !binding;) {
+            auto found = local_scopes[i].find(name);
+            if (found != local_scopes[i].end()) binding = &found->second;
+        }
+        if (!binding && has_variable(name)) {
+            // Only in the spawning interpreter, which a parallel loop worker can't share cells with
+            auto cell = std::make_shared<CellObject>();
+            cell->value = lookup_variable(name);
+            Heap::track(cell);
+            return cell;
+        }
+        if (!binding) binding = &local_scopes.back()[name];
+        if (!binding->cell) {
+            binding->cell = std::make_shared<CellObject>();
+            binding->cell->value = std::move(binding->value);
+            binding->value = Value();
+            Heap::track(binding->cell);
+        }
+        return binding->cell;
+    }
+    
+    // A new function value for a declaration that is executing now, sharing the cells of the
+    // enclosing locals it captures
+    Value make_closure(const FunctionDeclaration* func) {
+        auto closure = std::make_shared<ClosureObject>(compiled, func);
+        closure->captures.reserve(func->captures.size());
+        for (const auto& name : func->captures) closure->captures.push_back(capture_cell(name));
+        Heap::track(closure);
+        return Value(closure);
+    }
+    
+    Value call_closure(const Value& callee, const std::vector<Value>& args) {
+        return call_user_function(callee.function(), args, callee.closure_object.get());
+    }
+    
+    Value call_user_function(const FunctionDeclaration* func, const std::vector<Value>& args,
+                             ClosureObject* closure = nullptr) {
+        ProfileScope frame(profiler, func->name);
+        if (args.size() != func->parameters.size()) {
+            throw std::runtime_error("Function " + func->name + " expects " + 
+                                   std::to_string(func->parameters.size()) + " arguments, got " + 
+                                   std::to_string(args.size()));
+        }
+        
+        // Create new frame for function; captures first, so parameters win
+        size_t prev_frame_base = frame_base;
+        frame_base = local_scopes.size();
+        push_scope();
+        if (closure) {
+            for (size_t i = 0; i < closure->captures.size(); i++) {
+                local_scopes.back()[func->captures[i]].cell = closure->captures[i];
+            }
+        }
+        
+        // Bind arguments to parameters
+        for (size_t i = 0; i < args.size(); i++) {
+            LocalBinding& binding = local_scopes.back()[func->parameters[i]];
+            binding.cell = nullptr;
+            binding.value = args[i];
+        }
+        
+        // Save current function state
+        bool prev_in_function = in_function;
+        ReturnValue prev_return = return_value;
+        
+        in_function = true;
+        return_value = ReturnValue();
+        
+        // Execute function body
+        try {
+            execute_statement(func->body.get());
+        } catch (...) {
+            // Clean up and rethrow
+            local_scopes.pop_back();
+            frame_base = prev_frame_base;
+            in_function = prev_in_function;
+            return_value = prev_return;
+            throw;
+        }
+        
+        // Get return value
+        Value result = return_value.has_value ? return_value.value : Value(0.0);
+        
+        // Restore previous function state
+        in_function = prev_in_function;
+        return_value = prev_return;
+        
+        // Remove function scope
+        local_scopes.pop_back();
+        frame_base = prev_frame_base;
+        
+        return result;
+    }
+    
+public:
+    Interpreter() = default;
+    
+    // A fresh execution context for a shared program; each thread should use its own Interpreter
+    explicit Interpreter(std::shared_ptr<const CompiledProgram> program)
+        : compiled(std::move(program)), quick_forms(compiled->quick_slot_count()) {}
+    
+    // Where print() writes, so concurrent executions don't interleave on stdout
+    void set_output(std::ostream& stream) {
+        output = &stream;
+    }
+    
+    // Makes a C++ callback callable from scripts under `name`, taking precedence over builtins
+    void register_function(const std::string& name, NativeFunction fn) {
+        if (is_builtin_function(name) || name == "map" || name == "filter" || name == "reduce" || name == "stats" ||
+            name == "save" || name == "load_csv" || name == "load_f64") {
+            static_types = false;
+        }
+        native_functions[name] = std::move(fn);
+    }
+    
+    bool trusts_static_types() const { return static_types; }
+    
+    // Caps the bytes of arrays and maps this execution keeps live; exceeding it throws. 0 lifts the cap.
+    void set_heap_limit(size_t bytes) {
+        heap->set_limit(bytes);
+    }
+    
+    void collect_garbage() {
+        heap->collect();
+    }
+    
+    void write_heap_report(std::ostream& out) const {
+        heap->write_report(out);
+    }
+    
+    // With quickening off every node takes the generic path; for measuring what quickening buys
+    void set_quickening(bool enabled) {
+        QuickForm form;
+        form.kind = enabled ? QuickForm::UNSEEN : QuickForm::GENERIC;
+        quick_forms.assign(quick_forms.size(), form);
+    }
+    
+    // Calls a user function, native callback or builtin by name from C++
+    Value call_function(const std::string& name, const std::vector<Value>& args) {
+        COMPFOUNDATION_TIER(INTERPRETER);
+        Heap::Scope heap_scope(heap.get(), parent == nullptr);
+        if (has_variable(name)) {
+            const Value& callee = lookup_variable(name);
+            if (callee.type == Value::FUNCTION) return call_closure(callee, args);
+        }
+        if (const NativeFunction* native = find_native(name)) {
+            ProfileScope frame(profiler, name);
+            return (*native)(args);
+        }
+        return call_builtin_function(name, args);
+    }
+    
+    Value call_function(const FunctionDeclaration* func, const std::vector<Value>& args) {
+        COMPFOUNDATION_TIER(INTERPRETER);
+        Heap::Scope heap_scope(heap.get(), parent == nullptr);
+        return call_user_function(func, args);
+    }
+    
+    // Literals are interned, so evaluating one allocates nothing and compares by address
+    const InternedString* interned_literal(const StringLiteral* literal) {
+        auto& symbol = literal_strings[literal];
+        if (!symbol) symbol = intern(literal->value);
+        return symbol;
+    }
+    
+    bool has_quick_slot(const ASTNode* node) const {
+        return static_cast<size_t>(node->quick_slot) < quick_forms.size();
+    }
+    
+    // Picks the specialized form for a node's shape; the shapes are the ones QuickeningSlots numbers
+    void quicken(const ASTNode* node, QuickForm& form) {
+        auto operand = [](const Expression* e) {
+            if (dynamic_cast<const NumberLiteral*>(e)) return QuickForm::CONSTANT;
+            if (dynamic_cast<const BinaryOperation*>(e)) return QuickForm::BINARY;
+            return dynamic_cast<const Identifier*>(e) ? QuickForm::LOCAL : QuickForm::INDEX;
+        };
+        if (auto binop = dynamic_cast<const BinaryOperation*>(node)) {
+            form.kind = QuickForm::NUMBER_BINARY;
+            form.left = operand(binop->left.get());
+            form.right = operand(binop->right.get());
+        } else if (auto access = dynamic_cast<const ArrayAccess*>(node)) {
+            form.kind = QuickForm::ARRAY_INDEX;
+            form.right = operand(access->index.get());
+        } else if (dynamic_cast<const AssignmentStatement*>(node)) {
+            form.kind = QuickForm::ASSIGN_NUMBER;
+        } else if (dynamic_cast<const ReturnStatement*>(node)) {
+            form.kind = QuickForm::RETURN_LOCAL;
+        } else {
+            form.kind = QuickForm::GENERIC;
+        }
+    }
+    
+    QuickForm& quick_form(const ASTNode* node) {
+        QuickForm& form = quick_forms[node->quick_slot];
+        if (form.kind == QuickForm::UNSEEN) quicken(node, form);
+        return form;
+    }
+    
+    void deoptimize(QuickForm& form) {
+        form.kind = QuickForm::GENERIC;
+        COMPFOUNDATION_STAT(deoptimizations++);
+    }
+    
+    // The array a quickened arr[i] reads from, or nullptr to evaluate it generically
+    const Value* quick_array(const ArrayAccess* access, size_t& index) {
+        QuickForm& form = quick_form(access);
+        if (form.kind != QuickForm::ARRAY_INDEX) return nullptr;
+        const Value& array = lookup_variable(static_cast<const Identifier*>(access->array.get())->name);
+        double position;
+        if (array.type != Value::ARRAY || !quick_operand(form.right, access->index.get(), position)) {
+            deoptimize(form);
+            return nullptr;
+        }
+        // Out-of-bounds reads take the generic path, which reports them
+        position = std::trunc(position);
+        if (!(position >= 0 && position < static_cast<double>(array.array_size()))) return nullptr;
+        index = static_cast<size_t>(position);
+        return &array;
+    }
+    
+    bool quick_operand(QuickForm::Operand kind, const Expression* expr, double& out) {
+        if (kind == QuickForm::CONSTANT) {
+            out = static_cast<const NumberLiteral*>(expr)->value;
+            return true;
+        }
+        if (kind == QuickForm::LOCAL) {
+            const Value& value = lookup_variable(static_cast<const Identifier*>(expr)->name);
+            out = value.number_value;
+            return value.type == Value::NUMBER;
+        }
+        if (kind == QuickForm::BINARY) return quick_binary(static_cast<const BinaryOperation*>(expr), out);
+        size_t index;
+        const Value* array = quick_array(static_cast<const ArrayAccess*>(expr), index);
+        if (!array) return false;
+        if (array->packed_value) {
+            out = array->packed_value->data[index];
+            return true;
+        }
+        const Value& element = array->array_object->elements[index];
+        out = element.number_value;
+        return element.type == Value::NUMBER;
+    }
+    
+    // Runs a quickened binary operation; false once its operands stop being numbers
+    bool quick_binary(const BinaryOperation* binop, double& out) {
+        QuickForm& form = quick_form(binop);
+        if (form.kind != QuickForm::NUMBER_BINARY) return false;
+        double l, r;
+        if (!quick_operand(form.left, binop->left.get(), l) || !quick_operand(form.right, binop->right.get(), r)) {
+            deoptimize(form);
+            return false;
+        }
+        out = apply_binary(binop->op, l, r);
+        return true;
+    }
+    
+    bool quick_number(const Expression* expr, double& out) {
+        QuickForm& form = quick_form(expr);
+        if (form.kind == QuickForm::NUMBER_BINARY) return quick_binary(static_cast<const BinaryOperation*>(expr), out);
+        return form.kind == QuickForm::ARRAY_INDEX && quick_operand(QuickForm::INDEX, expr, out);
+    }
+    
+    bool execute_quickened(const Statement* stmt) {
+        QuickForm& form = quick_form(stmt);
+        if (form.kind == QuickForm::ASSIGN_NUMBER) {
+            auto assignment = static_cast<const AssignmentStatement*>(stmt);
+            double number;
+            if (!quick_binary(static_cast<const BinaryOperation*>(assignment->value.get()), number)) {
+                deoptimize(form);
+                return false;
+            }
+            Value& slot = get_variable(assignment->variable_name);
+            if (slot.type == Value::NUMBER) slot.number_value = number;
+            else slot = Value(number);
+            return true;
+        }
+        if (form.kind == QuickForm::RETURN_LOCAL && in_function) {
+            auto ret_stmt = static_cast<const ReturnStatement*>(stmt);
+            return_value = ReturnValue(lookup_variable(static_cast<const Identifier*>(ret_stmt->value.get())->name));
+            return true;
+        }
+        return false;
+    }
+    
+    // Evaluates an expression type inference proved numeric without boxing intermediate results
+    double evaluate_number(const Expression* expr) {
+        double quick;
+        if (has_quick_slot(expr) && quick_number(expr, quick)) return quick;
+        if (auto num = dynamic_cast<const NumberLiteral*>(expr)) return num->value;
+        if (auto id = dynamic_cast<const Identifier*>(expr)) return lookup_variable(id->name).number_value;
+        auto binop = dynamic_cast<const BinaryOperation*>(expr);
+        if (!binop || binop->left->static_type != StaticType::NUMBER || binop->right->static_type != StaticType::NUMBER) {
+            return evaluate_expression(expr).number_value;
+        }
+        double l = evaluate_number(binop->left.get());
+        double r = evaluate_number(binop->right.get());
+        return apply_binary(binop->op, l, r);
+    }
+    
+    bool evaluate_condition(const Expression* expr) {
+        if (static_types && expr->static_type == StaticType::NUMBER) return evaluate_number(expr) != 0;
+        return evaluate_expression(expr).is_truthy();
+    }
+    
+    Value evaluate_expression(const Expression* expr) {
+        COMPFOUNDATION_STAT(dispatches++);
+        if (has_quick_slot(expr)) {
+            QuickForm& form = quick_form(expr);
+            if (form.kind == QuickForm::NUMBER_BINARY) {
+                double number;
+                if (quick_binary(static_cast<const BinaryOperation*>(expr), number)) {
+                    COMPFOUNDATION_STAT(quickened++);
+                    return Value(number);
+                }
+            } else if (form.kind == QuickForm::ARRAY_INDEX) {
+                // Reads the element in place instead of copying the whole array first
+                size_t index;
+                if (const Value* array = quick_array(static_cast<const ArrayAccess*>(expr), index)) {
+                    COMPFOUNDATION_STAT(quickened++);
+                    return array->array_element(index);
+                }
+            }
+        }
+        
+        if (auto num = dynamic_cast<const NumberLiteral*>(expr)) {
+            return Value(num->value);
+        }
+        
+        if (auto str = dynamic_cast<const StringLiteral*>(expr)) {
+            return Value(interned_literal(str));
+        }
+        
+        if (auto id = dynamic_cast<const Identifier*>(expr)) {
+            return lookup_variable(id->name);
+        }
+        
+        if (auto arr = dynamic_cast<const ArrayLiteral*>(expr)) {
+            std::vector<Value> values;
+            for (const auto& elem : arr->elements) {
+                values.push_back(evaluate_expression(elem.get()));
+            }
+            return Value(std::move(values));
+        }
+        
+        if (auto map = dynamic_cast<const MapLiteral*>(expr)) {
+            MapEntries map_val;
+            for (size_t i = 0; i < map->pairs.size(); i++) {
+                map_val[map->symbols[i]] = evaluate_expression(map->pairs[i].second.get());
+            }
+            return Value(std::move(map_val));
+        }
+        
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            Value array_val = evaluate_expression(access->array.get());
+            Value index_val = evaluate_expression(access->index.get());
+            
+            if (array_val.type != Value::ARRAY || index_val.type != Value::NUMBER) {
+                throw std::runtime_error("Invalid array access");
+            }
+            
+            // Fractional indices truncate; checking as a double first keeps huge ones from overflowing
+            double index = std::trunc(index_val.number_value);
+            if (!(index >= 0 && index < static_cast<double>(array_val.array_size()))) {
+                throw std::runtime_error("Array index out of bounds");
+            }
+            
+            return array_val.array_element(static_cast<size_t>(index));
+        }
+        
+        if (auto access = dynamic_cast<const MapAccess*>(expr)) {
+            Value map_val = evaluate_expression(access->map.get());
+            
+            if (map_val.type != Value::MAP) {
+                throw std::runtime_error("Invalid map access");
+            }
+            
+            auto it = map_val.map_entries().find(access->symbol);
+            if (it == map_val.map_entries().end()) {
+                throw std::runtime_error("Key not found in map: " + access->key);
+            }
+            
+            return it->second;
+        }
+        
+        if (auto func_call = dynamic_cast<const FunctionCall*>(expr)) {
+            if (is_pipeline_call(func_call)) {
+                return evaluate_pipeline(func_call);
+            }
+            
+            // Evaluate arguments
+            std::vector<Value> args;
+            for (const auto& arg : func_call->arguments) {
+                args.push_back(evaluate_expression(arg.get()));
+            }
+            
+            // Check if it's a user-defined function. Probe first rather than catching the lookup
+            // failure: exceptions are slow, and catching would also swallow errors from the callee.
+            if (has_variable(func_call->function_name)) {
+                const Value& func_val = lookup_variable(func_call->function_name);
+                if (func_val.type == Value::FUNCTION) {
+                    return call_closure(func_val, args);
+                }
+            }
+            
+            if (const NativeFunction* native = find_native(func_call->function_name)) {
+                ProfileScope frame(profiler, func_call->function_name);
+                return (*native)(args);
+            }
+            
+            // Try built-in function
+            return call_builtin_function(func_call->function_name, args);
+        }
+        
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            Value result;
+            ElementwiseExpression pending;
+            if (evaluate_binary(binop, result, pending)) return run_elementwise(pending);
+            return result;
+        }
+        
+        throw std::runtime_error("Unknown expression type");
+    }
+    
+    void execute_statement(const Statement* stmt) {
+        if (return_value.has_value && in_function) {
+            return; // Early exit if we've hit a return statement
+        }
+        if (profiler && !dynamic_cast<const BlockStatement*>(stmt)) {
+            profiler->hit_line(stmt->line);
+        }
+        COMPFOUNDATION_STAT(dispatches++);
+        if (has_quick_slot(stmt) && execute_quickened(stmt)) {
+            COMPFOUNDATION_STAT(quickened++);
+            return;
+        }
+        
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            Value value = evaluate_expression(vardecl->initializer.get());
+            set_variable(vardecl->name, value);
+        } 
+        else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            if (static_types && assignment->value->static_type == StaticType::NUMBER) {
+                // Overwrite a numeric slot in place instead of building and copying a Value
+                double number = evaluate_number(assignment->value.get());
+                Value& slot = get_variable(assignment->variable_name);
+                if (slot.type == Value::NUMBER) slot.number_value = number;
+                else slot = Value(number);
+                return;
+            }
+            Value value = evaluate_expression(assignment->value.get());
+            // Write to the scope that declared the variable, not the innermost block
+            get_variable(assignment->variable_name) = value;
+        }
+        else if (auto print = dynamic_cast<const PrintStatement*>(stmt)) {
+            Value result = evaluate_expression(print->expression.get());
+            *output << result.to_string() << std::endl;
+        }
+        else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            // Create new scope
+            push_scope();
+            
+            for (const auto& s : block->statements) {
+                execute_statement(s.get());
+                if (return_value.has_value && in_function) break;
+            }
+            
+            // Remove scope
+            local_scopes.pop_back();
+        }
+        else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            if (evaluate_condition(if_stmt->condition.get())) {
+                execute_statement(if_stmt->then_branch.get());
+            } else if (if_stmt->else_branch) {
+                execute_statement(if_stmt->else_branch.get());
+            }
+        }
+        else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            // Scope for the hoisted loop invariants
+            push_scope();
+            for (const auto& decl : while_stmt->hoisted_condition) {
+                execute_statement(decl.get());
+            }
+            bool first_iteration = true;
+            while (true) {
+                if (!evaluate_condition(while_stmt->condition.get())) {
+                    break;
+                }
+                if (first_iteration) {
+                    for (const auto& decl : while_stmt->hoisted_body) execute_statement(decl.get());
+                    first_iteration = false;
+                }
+                execute_statement(while_stmt->body.get());
+                if (return_value.has_value && in_function) break;
+            }
+            local_scopes.pop_back();
+        }
+        else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            if (for_stmt->is_parallel || auto_parallel) {
+                ParallelLoopPlan plan;
+                std::string reason;
+                std::unordered_set<std::string> visiting;
+                auto is_pure = [&](const std::string& name, std::unordered_set<std::string>& outer_reads) {
+                    return is_pure_call(name, visiting, outer_reads);
+                };
+                if (plan_parallel_loop(for_stmt, is_pure, plan, reason)) {
+                    if (execute_parallel_for(for_stmt, plan, for_stmt->is_parallel)) return;
+                } else if (for_stmt->is_parallel) {
+                    throw std::runtime_error("Cannot parallelize for loop: " + reason);
+                }
+            }
+            
+            // Create new scope for loop variable
+            push_scope();
+            
+            // Execute init
+            if (for_stmt->init) {
+                execute_statement(for_stmt->init.get());
+            }
+            for (const auto& decl : for_stmt->hoisted_condition) {
+                execute_statement(decl.get());
+            }
+            
+            // Loop. The profiler counts every update line, so profiled runs skip the counted path.
+            bool first_iteration = true;
+            if (for_stmt->counted.step != 0 && !profiler && run_counted_loop(for_stmt, first_iteration)) {
+                local_scopes.pop_back();
+                return;
+            }
+            while (true) {
+                // Check condition
+                if (for_stmt->condition && !evaluate_condition(for_stmt->condition.get())) break;
+                
+                // Body invariants are computed just before the body first runs
+                if (first_iteration) {
+                    for (const auto& decl : for_stmt->hoisted_body) execute_statement(decl.get());
+                    first_iteration = false;
+                }
+                
+                // Execute body
+                execute_statement(for_stmt->body.get());
+                if (return_value.has_value && in_function) break;
+                
+                // Execute update
+                if (for_stmt->update) {
+                    execute_statement(for_stmt->update.get());
+                }
+            }
+            
+            // Remove loop scope
+            local_scopes.pop_back();
+        }
+        else if (auto func_decl = dynamic_cast<const FunctionDeclaration*>(stmt)) {
+            // Top-level code declares globals; functions nested in functions are locals of the call
+            if (in_function) {
+                set_variable(func_decl->name, make_closure(func_decl));
+            } else {
+                global_variables[func_decl->name] = make_closure(func_decl);
+            }
+        }
+        else if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
+            if (!in_function) {
+                throw std::runtime_error("Return statement outside of function");
+            }
+            if (ret_stmt->value) {
+                return_value = ReturnValue(evaluate_expression(ret_stmt->value.get()));
+            } else {
+                return_value = ReturnValue(Value(0.0));
+            }
+        }
+    }
+    
+    // Runs a counted loop (see CountedLoop) on an int64 counter, storing its value into the loop
+    // variable for the body instead of evaluating the condition and update generically. Returns
+    // false to let the generic loop take over from where it left off, when the bound stops being a
+    // number or the counter would leave the range of exact doubles.
+    bool run_counted_loop(const ForStatement* loop, bool& first_iteration) {
+        auto cond = static_cast<const BinaryOperation*>(loop->condition.get());
+        const std::string& name = static_cast<const VariableDeclaration*>(loop->init.get())->name;
+        auto bound_variable = dynamic_cast<const Identifier*>(cond->right.get());
+        double bound = bound_variable ? 0 : static_cast<const NumberLiteral*>(cond->right.get())->value;
+        int64_t counter = loop->counted.start;
+        while (true) {
+            if (bound_variable) {
+                const Value& value = lookup_variable(bound_variable->name);
+                if (value.type != Value::NUMBER) return false;
+                bound = value.number_value;
+            }
+            if (apply_binary(cond->op, static_cast<double>(counter), bound) == 0) return true;
+            if (first_iteration) {
+                for (const auto& decl : loop->hoisted_body) execute_statement(decl.get());
+                first_iteration = false;
+            }
+            execute_statement(loop->body.get());
+            if (return_value.has_value && in_function) return true;
+            counter += loop->counted.step;
+            if (std::fabs(static_cast<double>(counter)) > exact_integer_limit) {
+                execute_statement(loop->update.get());
+                return false;
+            }
+            Value& slot = get_variable(name);
+            if (slot.type == Value::NUMBER) slot.number_value = static_cast<double>(counter);
+            else slot = Value(static_cast<double>(counter));
+        }
+    }
+    
+    // Runs for loops in parallel whenever the dependence check proves their iterations independent
+    // and they have at least min_iterations iterations, not only loops marked `parallel for`
+    void set_auto_parallel(bool enabled, int64_t min_iterations = 4096) {
+        auto_parallel = enabled;
+        auto_parallel_min_iterations = min_iterations;
+    }
+    
+    // Compiles map/filter/reduce chains and element-wise array expressions over at least
+    // min_elements numbers to native loops
+    void set_jit_pipelines(bool enabled, int64_t min_elements = 4096) {
+        jit_pipelines = enabled;
+        jit_pipeline_min_elements = min_elements;
+    }
+    
+    // Reports calls and line hits to `p` until reset to nullptr; the top level is the "main" frame
+    void set_profiler(Profiler* p) {
+        profiler = p;
+    }
+    
+    void execute(const Program* program) {
+        COMPFOUNDATION_TIER(INTERPRETER);
+        Heap::Scope heap_scope(heap.get(), parent == nullptr);
+        ProfileScope frame(profiler, "main");
+        for (const auto& stmt : program->statements) {
+            execute_statement(stmt.get());
+        }
+    }
+    
+    void run() {
+        if (!compiled) throw std::runtime_error("Interpreter has no compiled program");
+        execute(&compiled->program());
+    }
+};
+
+// --- perf symbol map for JIT code ---
+// Appends a `start size name` line for every function MCJIT loads to /tmp/perf-<pid>.map, where
+// `perf report` looks up addresses it can't find in any mapped binary.
+class PerfMapListener : public llvm::JITEventListener {
+private:
+    std::mutex mutex;
+    std::ofstream map;
+    
+public:
+    static PerfMapListener& instance() {
+        static PerfMapListener listener;
+        return listener;
+    }
+    
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile& object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo& info) override {
+        // The debug copy has its symbols relocated to their load addresses
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded = info.getObjectForDebug(object);
+        if (!loaded.getBinary()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!map.is_open()) map.open("/tmp/perf-" + std::to_string(::getpid()) + ".map", std::ios::app);
+        for (const auto& entry : llvm::object::computeSymbolSizes(*loaded.getBinary())) {
+            llvm::Expected<llvm::object::SymbolRef::Type> type = entry.first.getType();
+            if (!type || *type != llvm::object::SymbolRef::ST_Function) {
+                if (!type) llvm::consumeError(type.takeError());
+                continue;
+            }
+            llvm::Expected<llvm::StringRef> name = entry.first.getName();
+            llvm::Expected<uint64_t> address = entry.first.getAddress();
+            if (!name || !address) {
+                if (!name) llvm::consumeError(name.takeError());
+                if (!address) llvm::consumeError(address.takeError());
+                continue;
+            }
+            map << std::hex << *address << " " << entry.second << std::dec << " " << name->str() << "\n";
+        }
+        map.flush();
+    }
+};
+
+// --- JIT Engine for LLVM ---
+class JITEngine {
+public:
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<llvm::IRBuilder<>> builder;
+    llvm::ExecutionEngine* executionEngine;
+    // Off while generating the fallback copy of a versioned counted loop; see ForStatement
+    bool version_counted_loops = true;
+    // The i64 counters of the counted loops whose bodies are being generated, by loop variable,
+    // with the arrays each one provably indexes in bounds
+    struct CounterRange {
+        llvm::Value* slot;
+        std::set<std::string> in_bounds;
+    };
+    std::map<std::string, CounterRange> integer_counters;
+
+private:
+    // Perf listeners registered with the current engine. Both are process-wide instances (ours and
+    // LLVM's jitdump writer), so they are unregistered when the engine goes, never deleted.
+    std::vector<llvm::JITEventListener*> listeners;
+
+    // Frees the execution engine along with the module it owns
+    void release_engine() {
+        for (llvm::JITEventListener* listener : listeners) executionEngine->UnregisterJITEventListener(listener);
+        listeners.clear();
+        module.release();
+        delete executionEngine;
+        executionEngine = nullptr;
+    }
+
+public:
+    JITEngine(const std::string& moduleName) : executionEngine(nullptr) {
+        initializeNativeTarget();
+        builder = std::make_unique<llvm::IRBuilder<>>(context);
+        reset(moduleName);
+    }
+
+    ~JITEngine() {
+        release_engine();
+    }
+
+    // LLVM's target registries are process-wide; set them up exactly once even when engines
+    // are created from several threads at the same time
+    static void initializeNativeTarget() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+            llvm::InitializeNativeTargetAsmParser();
+            // Runtime entry points called from generated code
+            llvm::sys::DynamicLibrary::AddSymbol("compfoundation_parallel_for",
+                                                 reinterpret_cast<void*>(&compfoundation_parallel_for));
+            llvm::sys::DynamicLibrary::AddSymbol("compfoundation_index_error",
+                                                 reinterpret_cast<void*>(&compfoundation_index_error));
+        });
+    }
+
+    // Engines created while this is on publish their code to perf: a /tmp/perf-<pid>.map symbol
+    // map, plus a jitdump file for `perf inject --jit` when LLVM was built with perf support
+    static void set_perf_enabled(bool enabled) {
+        perf_enabled() = enabled;
+    }
+
+    static std::atomic<bool>& perf_enabled() {
+        static std::atomic<bool> enabled{false};
+        return enabled;
+    }
+
+    // Drops all compiled code and starts an empty module, keeping the LLVMContext for reuse
+    void reset(const std::string& moduleName) {
+        if (executionEngine) release_engine();
+        module = std::make_unique<llvm::Module>(moduleName, context);
+        llvm::Module* moduleHandle = module.get();
+        std::string errStr;
+        executionEngine = llvm::EngineBuilder(std::move(module))
+            .setErrorStr(&errStr)
+            .setEngineKind(llvm::EngineKind::JIT)
+            .setMCPU(llvm::sys::getHostCPUName())
+            .create();
+        if (!executionEngine) {
+            throw std::runtime_error("Failed to create ExecutionEngine: " + errStr);
+        }
+        if (perf_enabled()) {
+            listeners.push_back(&PerfMapListener::instance());
+            if (llvm::JITEventListener* jitdump = llvm::JITEventListener::createPerfJITEventListener()) {
+                listeners.push_back(jitdump);
+            }
+            for (llvm::JITEventListener* listener : listeners) executionEngine->RegisterJITEventListener(listener);
+        }
+        // Non-owning handle for codegen; the execution engine owns the module
+        module.reset(moduleHandle);
+        module->setDataLayout(executionEngine->getDataLayout());
+        builder->ClearInsertionPoint();
+    }
+
+    llvm::AllocaInst* createEntryBlockAlloca(llvm::Function* function, const std::string& name,
+                                             llvm::Type* type = nullptr, uint64_t count = 1) {
+        llvm::IRBuilder<> entryBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
+        if (!type) type = llvm::Type::getDoubleTy(context);
+        llvm::Value* arraySize = count == 1 ? nullptr : llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), count);
+        return entryBuilder.CreateAlloca(type, arraySize, name);
+    }
+
+    llvm::Function* createMainFunction() {
+        llvm::FunctionType* funcType = llvm::FunctionType::get(llvm::Type::getDoubleTy(context), false);
+        llvm::Function* func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "main_jit", module.get());
+        llvm::BasicBlock* entry = llvm::BasicBlock::Create(context, "entry", func);
+        builder->SetInsertPoint(entry);
+        return func;
+    }
+
+    // Runs LLVM's standard -O2 pipeline (inlining, loop and SLP vectorization, ...) over the module,
+    // tuned for the host CPU. Call after codegen and before getFunctionAddress.
+    void optimize() {
+        llvm::LoopAnalysisManager loopAnalyses;
+        llvm::FunctionAnalysisManager functionAnalyses;
+        llvm::CGSCCAnalysisManager cgsccAnalyses;
+        llvm::ModuleAnalysisManager moduleAnalyses;
+        llvm::PassBuilder passBuilder(executionEngine->getTargetMachine());
+        passBuilder.registerModuleAnalyses(moduleAnalyses);
+        passBuilder.registerCGSCCAnalyses(cgsccAnalyses);
+        passBuilder.registerFunctionAnalyses(functionAnalyses);
+        passBuilder.registerLoopAnalyses(loopAnalyses);
+        passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, cgsccAnalyses, moduleAnalyses);
+        llvm::ModulePassManager passes = passBuilder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+        passes.run(*module, moduleAnalyses);
+    }
+
+    // Finalizes the module and returns the native address of a compiled function
+    // The first lookup emits machine code for the whole module
+    void* getFunctionAddress(const std::string& name) {
+        COMPFOUNDATION_COMPILE_TIMER(name);
+        return reinterpret_cast<void*>(executionEngine->getFunctionAddress(name));
+    }
+
+    double runMainFunction() {
+        executionEngine->finalizeObject();
+        std::vector<llvm::GenericValue> noargs;
+        llvm::GenericValue gv = executionEngine->runFunction(module->getFunction("main_jit"), noargs);
+        return gv.DoubleVal;
+    }
+};
+
+// --- Thread-safe pool of JIT engines ---
+// Every engine owns its own LLVMContext, so leases held by different threads can compile and
+// run at the same time. Released engines are reset and kept for reuse.
+class JITContextPool {
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<JITEngine>> idle;
+
+public:
+    class Lease {
+    private:
+        JITContextPool* pool;
+        std::unique_ptr<JITEngine> engine;
+
+    public:
+        Lease(JITContextPool* p, std::unique_ptr<JITEngine> e) : pool(p), engine(std::move(e)) {}
+        Lease(Lease&& other) = default;
+        Lease& operator=(Lease&& other) = delete;
+        ~Lease() {
+            if (engine) pool->release(std::move(engine));
+        }
+        JITEngine& operator*() const { return *engine; }
+        JITEngine* operator->() const { return engine.get(); }
+    };
+
+    // Hands out an engine with an empty module named moduleName
+    Lease acquire(const std::string& moduleName) {
+        std::unique_ptr<JITEngine> engine;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idle.empty()) {
+                engine = std::move(idle.back());
+                idle.pop_back();
+            }
+        }
+        if (engine) {
+            engine->reset(moduleName);
+        } else {
+            engine = std::make_unique<JITEngine>(moduleName);
+        }
+        return Lease(this, std::move(engine));
+    }
+
+    void release(std::unique_ptr<JITEngine> engine) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(engine));
+    }
+};
+
+// --- Multi-threaded throughput benchmark ---
+// Runs one shared CompiledProgram from 1..max_threads threads, each with its own Interpreter, then
+// does the same for JIT compile+run through a JITContextPool. Reports executions per second.
+void run_concurrency_benchmark(unsigned max_threads, int runs_per_thread) {
+    const std::string code = R"(
+        function sum_squares(n) {
+            let total = 0;
+            for (let i = 1; i <= n; i = i + 1) {
+                total = total + i * i;
+            }
+            return total;
+        }
+        let record = {"name": "bench", "values": [3, 1, 4, 1, 5, 9, 2, 6]};
+        let label = record["name"] + ": " + str(mean(record["values"]));
+        print(label + " " + str(sum_squares(200)));
+    )";
+    std::shared_ptr<const CompiledProgram> program = CompiledProgram::compile(code);
+    const FunctionDeclaration* kernel = program->find_function("sum_squares");
+    JITContextPool pool;
+
+    auto measure = [&](unsigned threads, const std::function<void()>& execution) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        std::vector<std::exception_ptr> errors(threads);  // An exception escaping a thread would terminate
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                try {
+                    for (int r = 0; r < runs_per_thread; r++) execution();
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return threads * runs_per_thread / seconds;
+    };
+
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    std::cout << "threads  interpreter runs/s  jit compile+run/s" << std::endl;
+    for (unsigned threads : thread_counts) {
+        double interpreted = measure(threads, [&] {
+            std::ostringstream out;
+            Interpreter interpreter(program);
+            interpreter.set_output(out);
+            interpreter.run();
+        });
+        double jitted = measure(threads, [&] {
+            JITContextPool::Lease jit = pool.acquire("bench");
+            kernel->codegen(*jit);
+            auto fn = reinterpret_cast<double (*)(double)>(jit->getFunctionAddress(kernel->name));
+            if (fn(200) != 2686700) throw std::runtime_error("JIT benchmark produced a wrong result");
+        });
+        std::cout << std::setw(7) << threads << std::setw(21) << static_cast<long>(interpreted)
+                  << std::setw(19) << static_cast<long>(jitted) << std::endl;
+    }
+}
+
+// --- JIT compatibility check ---
+// Finds the parameters a function uses as arrays: indexed, passed to len(), or passed on where a
+// compiled callee takes an array. JITCompatibility checks they are used in no other way.
+class ArrayParameters {
+private:
+    const FunctionDeclaration* func;
+    const ArrayArgumentPredicate& callee_takes_array;
+    std::vector<bool> arrays;
+    
+    void mark(const Expression* expr) {
+        auto id = dynamic_cast<const Identifier*>(expr);
+        if (!id) return;
+        auto param = std::find(func->parameters.begin(), func->parameters.end(), id->name);
+        if (param != func->parameters.end()) arrays[param - func->parameters.begin()] = true;
+    }
+    
+    void visit(const Expression* expr) {
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            mark(access->array.get());
+            visit(access->index.get());
+        } else if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            for (size_t i = 0; i < call->arguments.size(); i++) {
+                if ((call->function_name == "len" && call->arguments.size() == 1) ||
+                    callee_takes_array(call->function_name, i)) {
+                    mark(call->arguments[i].get());
+                }
+                visit(call->arguments[i].get());
+            }
+        } else if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            visit(binop->left.get());
+            visit(binop->right.get());
+        }
+    }
+    
+    void visit(const Statement* stmt) {
+        if (!stmt) return;
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            visit(vardecl->initializer.get());
+        } else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            visit(assignment->value.get());
+        } else if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
+            if (ret_stmt->value) visit(ret_stmt->value.get());
+        } else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) visit(s.get());
+        } else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            visit(if_stmt->condition.get());
+            visit(if_stmt->then_branch.get());
+            visit(if_stmt->else_branch.get());
+        } else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            for (const auto& decl : while_stmt->hoisted_condition) visit(decl.get());
+            for (const auto& decl : while_stmt->hoisted_body) visit(decl.get());
+            visit(while_stmt->condition.get());
+            visit(while_stmt->body.get());
+        } else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            visit(for_stmt->init.get());
+            for (const auto& decl : for_stmt->hoisted_condition) visit(decl.get());
+            for (const auto& decl : for_stmt->hoisted_body) visit(decl.get());
+            if (for_stmt->condition) visit(for_stmt->condition.get());
+            visit(for_stmt->update.get());
+            visit(for_stmt->body.get());
+        }
+    }
+    
+public:
+    ArrayParameters(const FunctionDeclaration* f, const ArrayArgumentPredicate& predicate)
+        : func(f), callee_takes_array(predicate), arrays(f->parameters.size(), false) {}
+    
+    std::vector<bool> run() {
+        visit(func->body.get());
+        return arrays;
+    }
+};
+
+std::vector<bool> jit_array_parameters(const FunctionDeclaration* func, const ArrayArgumentPredicate& callee_takes_array) {
+    return ArrayParameters(func, callee_takes_array).run();
+}
+
+// The JIT only handles numeric code: number literals, arithmetic and comparisons, lets,
+// assignments, returns, blocks, ifs, for and while loops, calls to other compilable functions, and
+// calls that type inference resolved to the sqrt/abs/exp/log/pow builtins. Parameters may also be
+// packed numeric arrays that the function only indexes, takes len() of and passes on as arrays.
+// A function is compilable when its body stays inside that subset and only reads names it has declared.
+class JITCompatibility {
+private:
+    std::unordered_map<std::string, std::vector<bool>> compiled;  // name -> which parameters are arrays
+    std::unordered_map<const FunctionDeclaration*, std::vector<bool>> signatures;
+    const FunctionDeclaration* current = nullptr;
+    std::vector<bool> current_arrays;
+    std::unordered_set<std::string> arrays;  // The current function's array parameters
+    bool math_builtins;
+
+    bool is_array(const Expression* expr) const {
+        auto id = dynamic_cast<const Identifier*>(expr);
+        return id && arrays.count(id->name);
+    }
+
+    bool check_expression(const Expression* expr, const std::unordered_set<std::string>& declared) const {
+        if (dynamic_cast<const NumberLiteral*>(expr)) return true;
+        if (auto id = dynamic_cast<const Identifier*>(expr)) return declared.count(id->name) > 0 && !arrays.count(id->name);
+        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
+            return check_expression(binop->left.get(), declared) && check_expression(binop->right.get(), declared);
+        }
+        if (auto access = dynamic_cast<const ArrayAccess*>(expr)) {
+            return is_array(access->array.get()) && check_expression(access->index.get(), declared);
+        }
+        if (auto call = dynamic_cast<const FunctionCall*>(expr)) {
+            std::vector<bool> takes_array;
+            // Captured function values aren't known statically, and recursion would need the captures
+            const auto& captures = current->captures;
+            if (std::find(captures.begin(), captures.end(), call->function_name) != captures.end()) {
+                return false;
+            }
+            if (call->function_name == current->name) {
+                if (!captures.empty()) return false;
+                takes_array = current_arrays;
+            } else {
+                auto callee = compiled.find(call->function_name);
+                if (callee != compiled.end()) {
+                    takes_array = callee->second;
+                } else if (math_builtins && call->function_name == "len" && call->arguments.size() == 1) {
+                    return is_array(call->arguments[0].get());
+                } else if (math_builtins && call->static_type == StaticType::NUMBER &&
+                           FunctionCall::is_math_builtin(call->function_name, call->arguments.size())) {
+                    takes_array.assign(call->arguments.size(), false);
+                } else {
+                    return false;
+                }
+            }
+            if (call->arguments.size() != takes_array.size()) return false;
+            for (size_t i = 0; i < takes_array.size(); i++) {
+                const Expression* arg = call->arguments[i].get();
+                if (takes_array[i] ? !is_array(arg) : !check_expression(arg, declared)) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool check_hoisted(const std::vector<std::unique_ptr<VariableDeclaration>>& decls,
+                       std::unordered_set<std::string>& declared) const {
+        for (const auto& decl : decls) {
+            if (!check_statement(decl.get(), declared)) return false;
+        }
+        return true;
+    }
+
+    bool check_statement(const Statement* stmt, std::unordered_set<std::string>& declared) const {
+        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+            if (arrays.count(vardecl->name) || !check_expression(vardecl->initializer.get(), declared)) return false;
+            declared.insert(vardecl->name);
+            return true;
+        }
+        if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
+            // Native code can't write a capture back into its closure
+            const auto& captures = current->captures;
+            if (std::find(captures.begin(), captures.end(), assignment->variable_name) != captures.end()) return false;
+            return declared.count(assignment->variable_name) && !arrays.count(assignment->variable_name) &&
+                   check_expression(assignment->value.get(), declared);
+        }
+        if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
+            return !ret_stmt->value || check_expression(ret_stmt->value.get(), declared);
+        }
+        if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
+            for (const auto& s : block->statements) {
+                if (!check_statement(s.get(), declared)) return false;
+            }
+            return true;
+        }
+        if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
+            if (for_stmt->is_parallel) {
+                ParallelLoopPlan plan;
+                std::string reason;
+                auto pure = [](const std::string&, std::unordered_set<std::string>&) { return true; };
+                if (!plan_parallel_loop(for_stmt, pure, plan, reason)) return false;
+                // The outlined chunk only receives numbers
+                for (const auto& capture : plan.captures) {
+                    if (arrays.count(capture)) return false;
+                }
+            }
+            if (for_stmt->init && !check_statement(for_stmt->init.get(), declared)) return false;
+            return check_hoisted(for_stmt->hoisted_condition, declared) &&
+                   check_hoisted(for_stmt->hoisted_body, declared) &&
+                   (!for_stmt->condition || check_expression(for_stmt->condition.get(), declared)) &&
+                   check_statement(for_stmt->body.get(), declared) &&
+                   (!for_stmt->update || check_statement(for_stmt->update.get(), declared));
+        }
+        if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
+            return check_expression(if_stmt->condition.get(), declared) &&
+                   check_statement(if_stmt->then_branch.get(), declared) &&
+                   (!if_stmt->else_branch || check_statement(if_stmt->else_branch.get(), declared));
+        }
+        if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
+            return check_hoisted(while_stmt->hoisted_condition, declared) &&
+                   check_hoisted(while_stmt->hoisted_body, declared) &&
+                   check_expression(while_stmt->condition.get(), declared) &&
+                   check_statement(while_stmt->body.get(), declared);
+        }
+        return false;
+    }
+
+public:
+    // Pass false when native callbacks may shadow builtins, so calls to sqrt etc. stay interpreted
+    explicit JITCompatibility(bool allow_math_builtins = true) : math_builtins(allow_math_builtins) {}
+
+    // Decides `func` given the functions accepted so far (callees must be accepted first).
+    // Captures are read-only extra parameters; closures can't be called by name from other code.
+    bool accept(const FunctionDeclaration* func) {
+        current = func;
+        current_arrays = jit_array_parameters(func, [this](const std::string& callee, size_t i) {
+            auto it = compiled.find(callee);
+            return it != compiled.end() && i < it->second.size() && it->second[i];
+        });
+        arrays.clear();
+        for (size_t i = 0; i < current_arrays.size(); i++) {
+            if (current_arrays[i]) arrays.insert(func->parameters[i]);
+        }
+        if (!arrays.empty() && !func->captures.empty()) return false;
+        std::unordered_set<std::string> declared(func->parameters.begin(), func->parameters.end());
+        declared.insert(func->captures.begin(), func->captures.end());
+        if (!check_statement(func->body.get(), declared)) return false;
+        if (func->captures.empty()) compiled[func->name] = current_arrays;
+        signatures[func] = current_arrays;
+        return true;
+    }
+
+    // Which parameters of an accepted function are passed as (data, length) arrays
+    const std::vector<bool>& array_parameters(const FunctionDeclaration* func) const {
+        return signatures.at(func);
+    }
+
+    bool takes_arrays(const FunctionDeclaration* func) const {
+        const std::vector<bool>& params = array_parameters(func);
+        return std::find(params.begin(), params.end(), true) != params.end();
+    }
+};
+
+// --- Fused pipeline compilation ---
+// Emits `double fused_pipeline(const double* in, i64 n, double start, double step, double init,
+// double* out, i64* out_count, const double* captures)`: one loop that produces each source element, runs it through the
+// map/filter callbacks and either folds it into the accumulator or appends it to `out`. The
+// callbacks are marked always-inline and the module goes through the -O2 pipeline, so simple
+// loops get inlined and vectorized. Floating-point reductions stay in order to keep results
+// identical to the interpreter.
+void* compile_fused_pipeline(JITEngine& jit, const Pipeline& pipeline,
+                             const std::vector<const FunctionDeclaration*>& functions) {
+    for (const FunctionDeclaration* func : functions) {
+        llvm::Function* compiled = func->codegen(jit);
+        compiled->addFnAttr(llvm::Attribute::AlwaysInline);
+    }
+    llvm::LLVMContext& ctx = jit.context;
+    llvm::IRBuilder<>& b = *jit.builder;
+    llvm::Type* doubleTy = llvm::Type::getDoubleTy(ctx);
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(ctx);
+    llvm::Type* doublePtrTy = llvm::PointerType::getUnqual(doubleTy);
+    llvm::FunctionType* kernelTy = llvm::FunctionType::get(doubleTy,
+        {doublePtrTy, i64Ty, doubleTy, doubleTy, doubleTy, doublePtrTy, llvm::PointerType::getUnqual(i64Ty),
+         doublePtrTy}, false);
+    llvm::Function* kernel = llvm::Function::Create(kernelTy, llvm::Function::ExternalLinkage, "fused_pipeline", jit.module.get());
+    auto arg = kernel->arg_begin();
+    llvm::Value* in = &*arg++;
+    llvm::Value* n = &*arg++;
+    llvm::Value* start = &*arg++;
+    llvm::Value* step = &*arg++;
+    llvm::Value* init = &*arg++;
+    llvm::Value* out = &*arg++;
+    llvm::Value* outCount = &*arg++;
+    llvm::Value* captures = &*arg;
+
+    llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(ctx, "entry", kernel);
+    llvm::BasicBlock* condBB = llvm::BasicBlock::Create(ctx, "loop.cond", kernel);
+    llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(ctx, "loop.body", kernel);
+    llvm::BasicBlock* nextBB = llvm::BasicBlock::Create(ctx, "loop.next", kernel);
+    llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(ctx, "loop.exit", kernel);
+    b.SetInsertPoint(entryBB);
+    llvm::AllocaInst* acc = b.CreateAlloca(doubleTy, nullptr, "acc");
+    llvm::AllocaInst* produced = b.CreateAlloca(i64Ty, nullptr, "produced");
+    llvm::AllocaInst* counter = b.CreateAlloca(i64Ty, nullptr, "k");
+    b.CreateStore(init, acc);
+    b.CreateStore(llvm::ConstantInt::get(i64Ty, 0), produced);
+    b.CreateStore(llvm::ConstantInt::get(i64Ty, 0), counter);
+    b.CreateBr(condBB);
+
+    b.SetInsertPoint(condBB);
+    llvm::Value* k = b.CreateLoad(i64Ty, counter, "k");
+    b.CreateCondBr(b.CreateICmpSLT(k, n), bodyBB, exitBB);
+
+    b.SetInsertPoint(bodyBB);
+    llvm::Value* x = pipeline.is_range
+        ? b.CreateFAdd(start, b.CreateFMul(b.CreateSIToFP(k, doubleTy), step), "x")
+        : b.CreateLoad(doubleTy, b.CreateGEP(doubleTy, in, k), "x");
+    // Each callback's captured numbers follow its arguments; `captures` holds them in callback order
+    uint64_t captureOffset = 0;
+    auto call = [&](const FunctionDeclaration* func, std::vector<llvm::Value*> args) {
+        for (size_t c = 0; c < func->captures.size(); c++) {
+            args.push_back(b.CreateLoad(doubleTy, b.CreateConstGEP1_64(doubleTy, captures, captureOffset++)));
+        }
+        return b.CreateCall(jit.module->getFunction(func->name), args);
+    };
+    for (const auto& stage : pipeline.stages) {
+        llvm::Value* r = call(stage.second.function(), {x});
+        if (stage.first == 'm') {
+            x = r;
+        } else {
+            llvm::BasicBlock* keepBB = llvm::BasicBlock::Create(ctx, "filter.keep", kernel);
+            b.CreateCondBr(b.CreateFCmpUNE(r, llvm::ConstantFP::get(ctx, llvm::APFloat(0.0))), keepBB, nextBB);
+            b.SetInsertPoint(keepBB);
+        }
+    }
+    if (pipeline.reduces) {
+        b.CreateStore(call(pipeline.reducer.function(), {b.CreateLoad(doubleTy, acc), x}), acc);
+    } else {
+        llvm::Value* slot = b.CreateLoad(i64Ty, produced);
+        b.CreateStore(x, b.CreateGEP(doubleTy, out, slot));
+        b.CreateStore(b.CreateAdd(slot, llvm::ConstantInt::get(i64Ty, 1)), produced);
+    }
+    b.CreateBr(nextBB);
+
+    b.SetInsertPoint(nextBB);
+    b.CreateStore(b.CreateAdd(k, llvm::ConstantInt::get(i64Ty, 1)), counter);
+    b.CreateBr(condBB);
+
+    b.SetInsertPoint(exitBB);
+    b.CreateStore(b.CreateLoad(i64Ty, produced), outCount);
+    b.CreateRet(b.CreateLoad(doubleTy, acc));
+
+    if (llvm::verifyFunction(*kernel, &llvm::errs())) return nullptr;
+    jit.optimize();
+    return jit.getFunctionAddress("fused_pipeline");
+}
+
+bool Interpreter::run_fused_jit(const FunctionCall* site, const Pipeline& pipeline, Value& result) {
+    std::vector<const FunctionDeclaration*> callbacks;
+    for (const auto& stage : pipeline.stages) callbacks.push_back(stage.second.function());
+    if (pipeline.reduces) {
+        if (pipeline.initial.type != Value::NUMBER) return false;
+        callbacks.push_back(pipeline.reducer.function());
+    }
+    // Captured values are passed per run; only numbers fit the kernel
+    std::vector<double> captures;
+    std::vector<const Value*> closures;
+    for (const auto& stage : pipeline.stages) closures.push_back(&stage.second);
+    if (pipeline.reduces) closures.push_back(&pipeline.reducer);
+    for (const Value* closure : closures) {
+        for (const auto& captured : closure->closure_object->captures) {
+            if (captured->value.type != Value::NUMBER) return false;
+            captures.push_back(captured->value.number_value);
+        }
+    }
+
+    auto resolve = [this](const std::string& name) -> const FunctionDeclaration* {
+        if (!has_variable(name)) return nullptr;
+        const Value& callee = lookup_variable(name);
+        return callee.type == Value::FUNCTION ? callee.function() : nullptr;
+    };
+    auto cached = fused_kernels.find(site);
+    bool stale = cached == fused_kernels.end() || cached->second.callbacks != callbacks;
+    for (size_t i = 0; !stale && i < cached->second.callees.size(); i++) {
+        stale = resolve(cached->second.callees[i].first) != cached->second.callees[i].second;
+    }
+    if (stale) {
+        FusedKernel kernel;
+        kernel.callbacks = callbacks;
+        bool arity_ok = true;
+        for (size_t i = 0; i < callbacks.size(); i++) {
+            size_t expected = pipeline.reduces && i + 1 == callbacks.size() ? 2 : 1;
+            arity_ok = arity_ok && callbacks[i]->parameters.size() == expected;
+        }
+        // Callbacks and everything they call, callees first
+        std::vector<const FunctionDeclaration*> ordered;
+        std::unordered_set<const FunctionDeclaration*> seen;
+        std::function<void(const FunctionDeclaration*)> visit = [&](const FunctionDeclaration* func) {
+            if (!seen.insert(func).second) return;
+            EffectSummary effects;
+            effects.add_statement(func->body.get());
+            for (const auto& name : effects.calls) {
+                const FunctionDeclaration* callee = resolve(name);
+                kernel.callees.push_back({name, callee});
+                if (callee) visit(callee);
+            }
+            ordered.push_back(func);
+        };
+        for (const FunctionDeclaration* callback : callbacks) visit(callback);
+        JITCompatibility compatibility(static_types);
+        bool compilable = arity_ok;
+        std::unordered_set<std::string> names;
+        for (const FunctionDeclaration* func : ordered) {
+            // Only the callbacks get their captures passed in; the module needs unique names
+            bool is_callback = std::find(callbacks.begin(), callbacks.end(), func) != callbacks.end();
+            compilable = compilable && (is_callback || func->captures.empty()) && names.insert(func->name).second &&
+                         compatibility.accept(func) && !(is_callback && compatibility.takes_arrays(func));
+        }
+        if (compilable) {
+            kernel.engine = std::make_shared<JITEngine>("pipeline");
+            kernel.code = compile_fused_pipeline(*kernel.engine, pipeline, ordered);
+        }
+        // Failures are cached too, so the interpreter doesn't retry on every call
+        cached = fused_kernels.insert_or_assign(site, std::move(kernel)).first;
+    }
+    if (!cached->second.code) return false;
+
+    std::vector<double> scratch;
+    const double* input = nullptr;
+    if (!pipeline.is_range) {
+        if (pipeline.source.packed_value) {
+            input = pipeline.source.packed_value->data;
+        } else {
+            scratch.reserve(pipeline.count);
+            for (const auto& v : pipeline.source.array_elements()) {
+                if (v.type != Value::NUMBER) return false;
+                scratch.push_back(v.number_value);
+            }
+            input = scratch.data();
+        }
+    }
+    typedef double (*Kernel)(const double*, int64_t, double, double, double, double*, int64_t*, const double*);
+    auto kernel = reinterpret_cast<Kernel>(cached->second.code);
+    std::vector<double> out(pipeline.reduces ? 0 : pipeline.count);
+    int64_t produced = 0;
+    double init = pipeline.reduces ? pipeline.initial.number_value : 0;
+    double acc;
+    {
+        COMPFOUNDATION_TIER(NATIVE);
+        acc = kernel(input, pipeline.count, pipeline.start, pipeline.step, init, out.data(), &produced,
+                     captures.data());
+    }
+    if (pipeline.reduces) {
+        result = Value(acc);
+    } else {
+        out.resize(produced);
+        result = Value(std::make_shared<const PackedArray>(std::move(out)));
+    }
+    return true;
+}
+
+// --- Element-wise kernel compilation ---
+// Emits `void elementwise(const double* const* arrays, const double* numbers, double* out,
+// i64 begin, i64 end)`: one loop computing the expression for each element, reading the array
+// leaves from `arrays` and the number leaves from `numbers` in postfix order. The operators are
+// the ones BinaryOperation::codegen emits, and the -O2 pipeline vectorizes the loop.
+void* compile_elementwise_kernel(JITEngine& jit, const ElementwiseExpression& expr) {
+    llvm::LLVMContext& ctx = jit.context;
+    llvm::IRBuilder<>& b = *jit.builder;
+    llvm::Type* doubleTy = llvm::Type::getDoubleTy(ctx);
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(ctx);
+    llvm::Type* doublePtrTy = llvm::PointerType::getUnqual(doubleTy);
+    llvm::FunctionType* kernelTy = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+        {llvm::PointerType::getUnqual(doublePtrTy), doublePtrTy, doublePtrTy, i64Ty, i64Ty}, false);
+    llvm::Function* kernel = llvm::Function::Create(kernelTy, llvm::Function::ExternalLinkage, "elementwise", jit.module.get());
+    auto arg = kernel->arg_begin();
+    llvm::Value* arrays = &*arg++;
+    llvm::Value* numbers = &*arg++;
+    llvm::Value* out = &*arg++;
+    llvm::Value* begin = &*arg++;
+    llvm::Value* end = &*arg;
+    // The result is a fresh allocation, so stores to it can't change the inputs
+    kernel->addParamAttr(2, llvm::Attribute::NoAlias);
+
+    llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(ctx, "entry", kernel);
+    llvm::BasicBlock* condBB = llvm::BasicBlock::Create(ctx, "loop.cond", kernel);
+    llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(ctx, "loop.body", kernel);
+    llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(ctx, "loop.exit", kernel);
+    b.SetInsertPoint(entryBB);
+    llvm::AllocaInst* counter = b.CreateAlloca(i64Ty, nullptr, "k");
+    b.CreateStore(begin, counter);
+    // Leaf pointers and numbers are loop-invariant; load them once
+    std::vector<llvm::Value*> leaves;
+    uint64_t arrayIndex = 0, numberIndex = 0;
+    for (const auto& step : expr.postfix()) {
+        if (step.kind == ElementwiseExpression::Step::ARRAY) {
+            leaves.push_back(b.CreateLoad(doublePtrTy, b.CreateConstGEP1_64(doublePtrTy, arrays, arrayIndex++)));
+        } else if (step.kind == ElementwiseExpression::Step::NUMBER) {
+            leaves.push_back(b.CreateLoad(doubleTy, b.CreateConstGEP1_64(doubleTy, numbers, numberIndex++)));
+        }
+    }
+    b.CreateBr(condBB);
+
+    b.SetInsertPoint(condBB);
+    llvm::Value* k = b.CreateLoad(i64Ty, counter, "k");
+    b.CreateCondBr(b.CreateICmpSLT(k, end), bodyBB, exitBB);
+
+    b.SetInsertPoint(bodyBB);
+    std::vector<llvm::Value*> stack;
+    size_t leaf = 0;
+    for (const auto& step : expr.postfix()) {
+        if (step.kind == ElementwiseExpression::Step::ARRAY) {
+            stack.push_back(b.CreateLoad(doubleTy, b.CreateGEP(doubleTy, leaves[leaf++], k)));
+        } else if (step.kind == ElementwiseExpression::Step::NUMBER) {
+            stack.push_back(leaves[leaf++]);
+        } else {
+            llvm::Value* r = stack.back();
+            stack.pop_back();
+            stack.back() = BinaryOperation::emit(jit, step.op, stack.back(), r);
+        }
+    }
+    b.CreateStore(stack.back(), b.CreateGEP(doubleTy, out, k));
+    b.CreateStore(b.CreateAdd(k, llvm::ConstantInt::get(i64Ty, 1)), counter);
+    b.CreateBr(condBB);
+
+    b.SetInsertPoint(exitBB);
+    b.CreateRetVoid();
+
+    if (llvm::verifyFunction(*kernel, &llvm::errs())) return nullptr;
+    jit.optimize();
+    return jit.getFunctionAddress("elementwise");
+}
+
+Interpreter::ElementwiseFunction Interpreter::elementwise_jit(const ElementwiseExpression& expr) {
+    std::string shape;
+    for (const auto& step : expr.postfix()) {
+        shape.push_back(step.kind == ElementwiseExpression::Step::ARRAY ? 'a'
+                        : step.kind == ElementwiseExpression::Step::NUMBER ? 'n'
+                        : static_cast<char>('0' + static_cast<int>(step.op)));
+    }
+    ElementwiseKernel& kernel = elementwise_kernels[{expr.site(), shape}];
+    if (!kernel.engine) {  // Failed builds stay cached with null code
+        kernel.engine = std::make_shared<JITEngine>("elementwise");
+        kernel.code = compile_elementwise_kernel(*kernel.engine, expr);
+    }
+    return reinterpret_cast<ElementwiseFunction>(kernel.code);
+}
+
+// --- Embedding API ---
+class Script;
+
+// Emits `double <name>.entry(const double* numbers, const double* const* data, const int64_t* lengths)`
+// for a compiled function that takes arrays. Argument i comes from numbers[i], or from data[i] and
+// lengths[i] when it is an array, so the host needs one signature for any mix of parameters.
+void codegen_array_entry(JITEngine& jit, const FunctionDeclaration* func, const std::vector<bool>& arrays) {
+    llvm::Type* doubleTy = llvm::Type::getDoubleTy(jit.context);
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(jit.context);
+    llvm::Type* doublePtrTy = llvm::PointerType::getUnqual(doubleTy);
+    llvm::FunctionType* entryTy = llvm::FunctionType::get(doubleTy,
+        {doublePtrTy, llvm::PointerType::getUnqual(doublePtrTy), llvm::PointerType::getUnqual(i64Ty)}, false);
+    llvm::Function* entry = llvm::Function::Create(entryTy, llvm::Function::ExternalLinkage, func->name + ".entry", jit.module.get());
+    llvm::IRBuilder<>& builder = *jit.builder;
+    builder.SetInsertPoint(llvm::BasicBlock::Create(jit.context, "entry", entry));
+    auto arg = entry->arg_begin();
+    llvm::Value* numbers = &*arg++;
+    llvm::Value* data = &*arg++;
+    llvm::Value* lengths = &*arg;
+    std::vector<llvm::Value*> args;
+    for (size_t i = 0; i < arrays.size(); i++) {
+        if (arrays[i]) {
+            args.push_back(builder.CreateLoad(doublePtrTy, builder.CreateConstGEP1_64(doublePtrTy, data, i)));
+            args.push_back(builder.CreateLoad(i64Ty, builder.CreateConstGEP1_64(i64Ty, lengths, i)));
+        } else {
+            args.push_back(builder.CreateLoad(doubleTy, builder.CreateConstGEP1_64(doubleTy, numbers, i)));
+        }
+    }
+    builder.CreateRet(builder.CreateCall(jit.module->getFunction(func->name), args));
+}
+
+// Pre-resolved handle to a script function. Calls whose arguments are numbers, or numeric arrays
+// where the function indexes them, go straight to JIT-compiled code when the function is
+// compilable; everything else runs in the interpreter.
+class ScriptFunction {
+private:
+    Script* script;
+    const FunctionDeclaration* declaration;
+    void* native;
+    std::vector<bool> arrays;  // Empty unless `native` is an array entry; see codegen_array_entry
+
+public:
+    ScriptFunction(Script* owner, const FunctionDeclaration* decl, void* code, std::vector<bool> array_params = {})
+        : script(owner), declaration(decl), native(code), arrays(std::move(array_params)) {}
+
+    Value operator()(const std::vector<Value>& args) const;
+
+    bool is_native() const { return native != nullptr; }
+
+    // Direct call for numeric arguments; costs an indirect call when the function is JIT-compiled
+    template <typename... Args>
+    double number(Args... args) const {
+        if (native && arrays.empty() && sizeof...(Args) == declaration->parameters.size()) {
+            typedef double (*NativeSignature)(typename std::conditional<true, double, Args>::type...);
+            return reinterpret_cast<NativeSignature>(native)(static_cast<double>(args)...);
+        }
+        Value result = (*this)({Value(static_cast<double>(args))...});
+        if (result.type != Value::NUMBER) throw std::runtime_error(declaration->name + " did not return a number");
+        return result.number_value;
+    }
+};
+
+// A script compiled once and called many times from C++. The top level runs on first use, so
+// callbacks should be registered before the first call. Not thread-safe: use one Script per
+// thread, or share the CompiledProgram and create a Script from it in each thread.
+class Script {
+private:
+    std::shared_ptr<const CompiledProgram> program;
+    Interpreter context;
+    bool initialized = false;
+    bool use_jit = true;
+    std::unique_ptr<JITEngine> jit;
+    std::unordered_map<std::string, void*> native_code;
+    std::unordered_map<std::string, std::vector<bool>> native_arrays;  // Functions reached through array entries
+
+    void ensure_initialized() {
+        if (initialized) return;
+        initialized = true;
+        context.run();
+        if (use_jit) compile_natives();
+    }
+
+    // JIT-compiles every compilable top-level function into one module
+    void compile_natives() {
+        JITCompatibility compatibility(context.trusts_static_types());
+        std::vector<const FunctionDeclaration*> compilable;
+        for (const FunctionDeclaration* func : program->functions()) {
+            if (program->find_function(func->name) == func && compatibility.accept(func)) {
+                compilable.push_back(func);
+            }
+        }
+        if (compilable.empty()) return;
+        jit = std::make_unique<JITEngine>("script");
+        for (const FunctionDeclaration* func : compilable) {
+            func->codegen(*jit);
+        }
+        for (const FunctionDeclaration* func : compilable) {
+            if (compatibility.takes_arrays(func)) {
+                native_arrays[func->name] = compatibility.array_parameters(func);
+                codegen_array_entry(*jit, func, native_arrays[func->name]);
+            }
+        }
+        for (const FunctionDeclaration* func : compilable) {
+            bool entry = native_arrays.count(func->name) > 0;
+            native_code[func->name] = jit->getFunctionAddress(entry ? func->name + ".entry" : func->name);
+        }
+    }
+
+public:
+    explicit Script(std::shared_ptr<const CompiledProgram> compiled)
+        : program(compiled), context(compiled) {}
+    explicit Script(const std::string& source) : Script(CompiledProgram::compile(source)) {}
+
+    // Register before the first call so the top level can use the callback too
+    void register_function(const std::string& name, NativeFunction fn) {
+        context.register_function(name, std::move(fn));
+    }
+
+    // Interpret everything, e.g. to compare against the JIT
+    void set_jit_enabled(bool enabled) { use_jit = enabled; }
+    
+    // Runs the top level now rather than on the first call
+    void run() { ensure_initialized(); }
+
+    void set_output(std::ostream& stream) { context.set_output(stream); }
+
+    // Looks the function up once; keep the handle for repeated calls
+    ScriptFunction function(const std::string& name) {
+        ensure_initialized();
+        const FunctionDeclaration* decl = program->find_function(name);
+        if (!decl) throw std::runtime_error("Unknown script function: " + name);
+        auto code = native_code.find(name);
+        if (code == native_code.end()) return ScriptFunction(this, decl, nullptr);
+        auto arrays = native_arrays.find(name);
+        return ScriptFunction(this, decl, code->second, arrays == native_arrays.end() ? std::vector<bool>() : arrays->second);
+    }
+
+    Value call(const std::string& name, const std::vector<Value>& args) {
+        ensure_initialized();
+        return context.call_function(name, args);
+    }
+
+    Value call(const FunctionDeclaration* func, const std::vector<Value>& args) {
+        ensure_initialized();
+        return context.call_function(func, args);
+    }
+};
+
+Value ScriptFunction::operator()(const std::vector<Value>& args) const {
+    if (native && !arrays.empty() && args.size() == arrays.size()) {
+        // Packed arrays are passed in place; other arrays of numbers are packed for the call
+        std::vector<double> numbers(args.size());
+        std::vector<const double*> data(args.size());
+        std::vector<int64_t> lengths(args.size());
+        std::vector<std::vector<double>> packed;
+        packed.reserve(args.size());
+        bool numeric = true;
+        for (size_t i = 0; i < args.size() && numeric; i++) {
+            const Value& arg = args[i];
+            if (!arrays[i]) {
+                numeric = arg.type == Value::NUMBER;
+                numbers[i] = arg.number_value;
+            } else if (arg.type != Value::ARRAY) {
+                numeric = false;
+            } else if (arg.packed_value) {
+                data[i] = arg.packed_value->data;
+                lengths[i] = static_cast<int64_t>(arg.packed_value->size);
+            } else {
+                packed.emplace_back();
+                for (const Value& element : arg.array_elements()) {
+                    numeric = numeric && element.type == Value::NUMBER;
+                    packed.back().push_back(element.number_value);
+                }
+                data[i] = packed.back().data();
+                lengths[i] = static_cast<int64_t>(packed.back().size());
+            }
+        }
+        if (numeric) {
+            COMPFOUNDATION_TIER(NATIVE);
+            typedef double (*ArrayEntry)(const double*, const double* const*, const int64_t*);
+            return Value(reinterpret_cast<ArrayEntry>(native)(numbers.data(), data.data(), lengths.data()));
+        }
+        return script->call(declaration, args);
+    }
+    if (native && arrays.empty() && args.size() == declaration->parameters.size() && args.size() <= 4 &&
+        std::all_of(args.begin(), args.end(), [](const Value& v) { return v.type == Value::NUMBER; })) {
+        COMPFOUNDATION_TIER(NATIVE);
+        double a[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < args.size(); i++) a[i] = args[i].number_value;
+        switch (args.size()) {
+            case 0: return Value(reinterpret_cast<double (*)()>(native)());
+            case 1: return Value(reinterpret_cast<double (*)(double)>(native)(a[0]));
+            case 2: return Value(reinterpret_cast<double (*)(double, double)>(native)(a[0], a[1]));
+            case 3: return Value(reinterpret_cast<double (*)(double, double, double)>(native)(a[0], a[1], a[2]));
+            case 4: return Value(reinterpret_cast<double (*)(double, double, double, double)>(native)(a[0], a[1], a[2], a[3]));
+        }
+    }
+    return script->call(declaration, args);
+}
+
+// --- Ahead-of-time compilation ---
+// Runs a command without a shell and waits for it. With `output`, the command's stdout is
+// captured there instead of inherited. Returns the exit status, or -1 if it didn't exit normally.
+int run_process(const std::vector<std::string>& command, std::string* output = nullptr) {
+    int pipe_fds[2];
+    if (output && pipe(pipe_fds) != 0) throw std::runtime_error("Cannot create pipe for " + command[0]);
+    std::vector<char*> argv;
+    for (const std::string& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("Cannot start " + command[0]);
+    if (pid == 0) {
+        if (output) {
+            dup2(pipe_fds[1], STDOUT_FILENO);
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    if (output) {
+        close(pipe_fds[1]);
+        output->clear();
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) output->append(buffer, n);
+        }
+        close(pipe_fds[0]);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) throw std::runtime_error("Lost track of " + command[0]);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runtime linked into AOT executables: a pthread version of compfoundation_parallel_for with the
+// same chunking contract and chunk-order reduction as the in-process one. AOTCompiler appends a
+// main() that parses the entry point's arguments from the command line and prints its result.
+static const char* aot_runtime_source = R"(#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef void (*compfoundation_chunk)(int64_t, int64_t, double*, double*);
+
+struct compfoundation_task {
+    compfoundation_chunk chunk;
+    int64_t begin, end;
+    double* env;
+    double* partials;
+};
+
+static void* compfoundation_run_task(void* arg) {
+    struct compfoundation_task* task = (struct compfoundation_task*)arg;
+    task->chunk(task->begin, task->end, task->env, task->partials);
+    return NULL;
+}
+
+void compfoundation_parallel_for(compfoundation_chunk chunk, double start, double bound, double step,
+                                 int32_t inclusive, double* env, double* result,
+                                 int32_t reduction_count, const char* reduction_ops) {
+    int64_t count = 0;
+    if (step > 0 && bound >= start) {
+        double span = (bound - start) / step;
+        if (!(span < 0x1p62) || trunc(start) != start || trunc(step) != step ||
+            !(fabs(start) <= 9007199254740992.0) || !(bound <= 9007199254740992.0)) {
+            fprintf(stderr, "Error: Cannot parallelize for loop: start must be an integer and the bound finite and at most 2^53\n");
+            exit(1);
+        }
+        count = inclusive ? (int64_t)floor(span) + 1 : (int64_t)ceil(span);
+    }
+    int64_t chunks = sysconf(_SC_NPROCESSORS_ONLN);
+    if (chunks > count) chunks = count;
+    if (chunks < 1) chunks = 1;
+    struct compfoundation_task* tasks = calloc(chunks, sizeof(*tasks));
+    pthread_t* threads = calloc(chunks, sizeof(*threads));
+    char* started = calloc(chunks, 1);
+    double* partials = calloc(chunks * reduction_count + 1, sizeof(double));
+    for (int64_t c = 0; c < chunks; c++) {
+        tasks[c].chunk = chunk;
+        tasks[c].begin = count * c / chunks;
+        tasks[c].end = count * (c + 1) / chunks;
+        tasks[c].env = env;
+        tasks[c].partials = partials + c * reduction_count;
+        if (c > 0) started[c] = pthread_create(&threads[c], NULL, compfoundation_run_task, &tasks[c]) == 0;
+    }
+    for (int64_t c = 0; c < chunks; c++) {
+        if (started[c]) pthread_join(threads[c], NULL);
+        else compfoundation_run_task(&tasks[c]);
+    }
+    for (int32_t r = 0; r < reduction_count; r++) {
+        int product = reduction_ops[r] == '*';
+        result[r] = product ? 1.0 : 0.0;
+        for (int64_t c = 0; count > 0 && c < chunks; c++) {
+            double partial = partials[c * reduction_count + r];
+            result[r] = product ? result[r] * partial : result[r] + partial;
+        }
+    }
+    free(partials);
+    free(started);
+    free(threads);
+    free(tasks);
+}
+
+void compfoundation_index_error(void) {
+    fprintf(stderr, "Error: Array index out of bounds\n");
+    exit(1);
+}
+
+/* Parses a command-line argument that must be a number and nothing else */
+static int compfoundation_number_argument(const char* text, double* out) {
+    char* end;
+    *out = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+)";
+
+// Compiles a program's numeric functions ahead of time through the same codegen and -O2 pipeline
+// as the JIT, for the host CPU. Every top-level function JITCompatibility accepts goes into the
+// object file as `double cf_<name>(double...)` (the prefix keeps script names like `abs` clear of
+// libc), with each array parameter passed as `const double*, int64_t length`; the rest of the
+// program, including its top-level statements, stays interpreter-only.
+class AOTCompiler {
+private:
+    std::shared_ptr<const CompiledProgram> program;
+    std::vector<const FunctionDeclaration*> compilable;
+    JITCompatibility compatibility;
+
+public:
+    explicit AOTCompiler(std::shared_ptr<const CompiledProgram> compiled) : program(compiled) {
+        for (const FunctionDeclaration* func : program->functions()) {
+            if (program->find_function(func->name) == func && compatibility.accept(func)) {
+                compilable.push_back(func);
+            }
+        }
+    }
+
+    static std::string symbol(const std::string& name) { return "cf_" + name; }
+
+    const FunctionDeclaration* compiled_function(const std::string& name) const {
+        for (const FunctionDeclaration* func : compilable) {
+            if (func->name == name) return func;
+        }
+        return nullptr;
+    }
+
+    // Writes a relocatable, position-independent object file
+    void write_object(const std::string& path) const {
+        if (compilable.empty()) throw std::runtime_error("No function in the program can be compiled ahead of time");
+        JITEngine::initializeNativeTarget();
+        std::string triple = llvm::sys::getProcessTriple();
+        std::string error;
+        const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) throw std::runtime_error("No target for " + triple + ": " + error);
+        std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(
+            triple, llvm::sys::getHostCPUName(), "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+
+        JITEngine engine("aot");
+        engine.module->setTargetTriple(triple);
+        engine.module->setDataLayout(machine->createDataLayout());
+        for (const FunctionDeclaration* func : compilable) func->codegen(engine);
+        // Calls were resolved while generating code, so renaming afterwards is safe
+        for (const FunctionDeclaration* func : compilable) {
+            engine.module->getFunction(func->name)->setName(symbol(func->name));
+        }
+        if (llvm::verifyModule(*engine.module, &llvm::errs())) {
+            throw std::runtime_error("AOT module failed verification");
+        }
+        engine.optimize();
+
+        std::error_code ec;
+        llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::OF_None);
+        if (ec) throw std::runtime_error("Cannot write " + path + ": " + ec.message());
+        llvm::legacy::PassManager passes;
+        if (machine->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+            throw std::runtime_error("Target " + triple + " cannot emit object files");
+        }
+        passes.run(*engine.module);
+        out.flush();
+    }
+
+    // Links the object file with the runtime into an executable that calls `entry` with its
+    // numeric command-line arguments and prints the result like `print` would. Uses $CC, or cc.
+    void write_executable(const std::string& path, const std::string& entry) const {
+        const FunctionDeclaration* func = compiled_function(entry);
+        if (!func) throw std::runtime_error("Entry point " + entry + " is not an AOT-compilable function");
+        if (compatibility.takes_arrays(func)) {
+            throw std::runtime_error("Entry point " + entry + " takes arrays; link the object file from C instead");
+        }
+        std::ostringstream runtime;
+        runtime << aot_runtime_source << "\nextern double " << symbol(entry) << "(";
+        for (size_t i = 0; i < func->parameters.size(); i++) runtime << (i ? ", " : "") << "double";
+        runtime << (func->parameters.empty() ? "void" : "") << ");\n\nint main(int argc, char** argv) {\n";
+        if (!func->parameters.empty()) runtime << "    double args[" << func->parameters.size() << "];\n";
+        runtime << "    if (argc != " << func->parameters.size() + 1;
+        for (size_t i = 0; i < func->parameters.size(); i++) {
+            runtime << " || !compfoundation_number_argument(argv[" << i + 1 << "], &args[" << i << "])";
+        }
+        runtime << ") {\n        fprintf(stderr, \"usage: %s";
+        for (const std::string& param : func->parameters) runtime << " " << param;
+        runtime << "\\n\", argv[0]);\n        return 2;\n    }\n    printf(\"%f\\n\", " << symbol(entry) << "(";
+        for (size_t i = 0; i < func->parameters.size(); i++) {
+            runtime << (i ? ", " : "") << "args[" << i << "]";
+        }
+        runtime << "));\n    return 0;\n}\n";
+
+        std::filesystem::path scratch = std::filesystem::temp_directory_path() /
+            ("compfoundation_aot_" + std::to_string(getpid()) + "_" + std::filesystem::path(path).filename().string());
+        std::string object_path = scratch.string() + ".o";
+        std::string runtime_path = scratch.string() + ".c";
+        std::ofstream(runtime_path) << runtime.str();
+        int status = -1;
+        try {
+            write_object(object_path);
+            const char* cc = std::getenv("CC");
+            status = run_process({cc && *cc ? cc : "cc", "-O2", "-o", path, runtime_path, object_path, "-lm", "-lpthread"});
+        } catch (...) {
+            std::filesystem::remove(object_path);
+            std::filesystem::remove(runtime_path);
+            throw;
+        }
+        std::filesystem::remove(object_path);
+        std::filesystem::remove(runtime_path);
+        if (status != 0) throw std::runtime_error("Linking " + path + " failed (exit status " + std::to_string(status) + ")");
+    }
+};
+
+// --- Embedding call-overhead benchmark ---
+// Average cost of one call from C++ into a script function through each path, plus a script
+// calling back into a C++ function.
+void run_embedding_benchmark(long iterations) {
+    Script script(R"(
+        function add(a, b) {
+            return a + b;
+        }
+        function total(values) {
+            return sum(values);
+        }
+        function twice(x) {
+            return native_double(x) + native_double(x);
+        }
+    )");
+    script.register_function("native_double", [](const std::vector<Value>& args) {
+        return Value(args[0].number_value * 2);
+    });
+    std::vector<double> data(1024, 1.0);
+
+    auto time_ns = [iterations](const std::function<double(long)>& body) {
+        double sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) sink += body(i);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (sink == -1) std::cout << sink;  // Keep the calls observable
+        return ns / iterations;
+    };
+
+    ScriptFunction add = script.function("add");
+    ScriptFunction total = script.function("total");
+    ScriptFunction twice = script.function("twice");
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "call by name (interpreted):   "
+              << time_ns([&](long i) { return script.call("add", {Value(double(i)), Value(1.0)}).number_value; })
+              << " ns/call" << std::endl;
+    std::cout << "handle, Value args:           "
+              << time_ns([&](long i) { return add({Value(double(i)), Value(1.0)}).number_value; })
+              << " ns/call" << (add.is_native() ? " (JIT)" : " (interpreted)") << std::endl;
+    std::cout << "handle, native doubles:       "
+              << time_ns([&](long i) { return add.number(double(i), 1.0); })
+              << " ns/call" << (add.is_native() ? " (JIT)" : " (interpreted)") << std::endl;
+    std::cout << "zero-copy array (1024 items): "
+              << time_ns([&](long) { return total({Value::view(data.data(), data.size())}).number_value; })
+              << " ns/call" << std::endl;
+    std::cout << "script -> C++ callback x2:    "
+              << time_ns([&](long i) { return twice.number(double(i)); })
+              << " ns/call" << std::endl;
+}
+
+// Writes a generated CSV of about `megabytes` MB and the same values as raw doubles to the temp
+// directory, then reports how fast load_csv and load_f64 read them back
+void run_load_benchmark(size_t megabytes) {
+    namespace fs = std::filesystem;
+    fs::path csv_path = fs::temp_directory_path() / ("compfoundation-bench-" + std::to_string(getpid()) + ".csv");
+    fs::path f64_path = fs::path(csv_path).replace_extension(".f64");
+    {
+        std::ofstream csv(csv_path, std::ios::binary);
+        std::ofstream raw(f64_path, std::ios::binary);
+        csv << "id,price,quantity,score\n";
+        std::string line;
+        size_t written = 0;
+        for (size_t row = 0; written < megabytes << 20; row++) {
+            double price = (row * 7919 % 100000) / 100.0;
+            line = std::to_string(row) + "," + std::to_string(price) + "," + std::to_string(row % 97) + "," +
+                   std::to_string(std::sin(static_cast<double>(row))) + "\n";
+            csv << line;
+            raw.write(reinterpret_cast<const char*>(&price), sizeof price);
+            written += line.size();
         }
-        
-        if (auto access = dynamic_cast<const MapAccess*>(expr)) {
-            Value map_val = evaluate_expression(access->map.get());
-            
-            if (map_val.type != Value::MAP) {
-                throw std::runtime_error("Invalid map access");
-            }
-            
-            auto it = map_val.map_value.find(access->key);
-            if (it == map_val.map_value.end()) {
-                throw std::runtime_error("Key not found in map: " + access->key);
-            }
-            
-            return it->second;
+    }
+    
+    auto time_best = [](const std::function<size_t()>& load) {
+        double best = 1e300;
+        size_t sink = 0;
+        for (int run = 0; run < 5; run++) {
+            auto start = std::chrono::steady_clock::now();
+            sink += load();
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
         }
-        
-        if (auto func_call = dynamic_cast<const FunctionCall*>(expr)) {
-            // Evaluate arguments
-            std::vector<Value> args;
-            for (const auto& arg : func_call->arguments) {
-                args.push_back(evaluate_expression(arg.get()));
+        if (sink == 0) std::cout << "(empty)" << std::endl;
+        return best;
+    };
+    double csv_bytes = static_cast<double>(fs::file_size(csv_path));
+    double f64_bytes = static_cast<double>(fs::file_size(f64_path));
+    double csv_seconds = time_best([&] { return load_csv_file(csv_path.string()).map_entries().size(); });
+    double f64_seconds = time_best([&] { return load_f64_file(f64_path.string()).array_size(); });
+    fs::remove(csv_path);
+    fs::remove(f64_path);
+    
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "load_csv: " << csv_bytes / 1e6 << " MB in " << csv_seconds * 1e3 << " ms, "
+              << csv_bytes / csv_seconds / 1e9 << " GB/s on " << WorkStealingPool::instance().size() << " threads"
+              << std::endl;
+    std::cout << "load_f64: " << f64_bytes / 1e6 << " MB in " << f64_seconds * 1e3 << " ms (mapped in place)"
+              << std::endl;
+}
+
+// --- Benchmark suite ---
+// Times each phase of a corpus of representative scripts separately: lexing, parsing alone (which
+// drives its own lexer), parsing plus the optimization passes run by CompiledProgram, loading the
+// same program from a snapshot file instead, interpreting, and JIT compile+run of the script's numeric `bench()` entry point where the JIT accepts it.
+// For those scripts it also builds `bench()` ahead of time into an executable once and times running
+// it, process startup included, so the three tiers can be compared.
+// Results go to `out` as JSON with per-phase percentiles in milliseconds, for tracking over time.
+struct BenchmarkCase {
+    std::string name;
+    std::string source;
+    bool jit;  // bench() and everything it calls are expected to be JIT-compilable
+};
+
+std::vector<BenchmarkCase> benchmark_corpus() {
+    std::vector<BenchmarkCase> corpus;
+    corpus.push_back({"recursive_fib", R"(
+        function fib(n) {
+            if (n < 2) {
+                return n;
             }
-            
-            // Check if it's a user-defined function
-            try {
-                Value func_val = get_variable(func_call->function_name);
-                if (func_val.type == Value::FUNCTION) {
-                    return call_user_function(func_val.function_value, args);
+            return fib(n - 1) + fib(n - 2);
+        }
+        function bench() {
+            return fib(18);
+        }
+        print(bench());
+    )", true});
+    corpus.push_back({"nested_loops", R"(
+        function bench() {
+            let total = 0;
+            for (let i = 0; i < 120; i = i + 1) {
+                for (let j = 0; j < 120; j = j + 1) {
+                    total = total + i * j - (i + j) / 2;
                 }
-            } catch (...) {
-                // Not a variable, try built-in function
             }
-            
-            // Try built-in function
-            return call_builtin_function(func_call->function_name, args);
+            return total;
         }
-        
-        if (auto binop = dynamic_cast<const BinaryOperation*>(expr)) {
-            Value left = evaluate_expression(binop->left.get());
-            Value right = evaluate_expression(binop->right.get());
-            
-            // String concatenation
-            if (binop->operator_ == "+" && (left.type == Value::STRING || right.type == Value::STRING)) {
-                return Value(left.to_string() + right.to_string());
+        print(bench());
+    )", true});
+    // The loops from the main() demo, scaled up: counting, factorial, fibonacci and array_sum
+    corpus.push_back({"demo_loops", R"(
+        function factorial(n) {
+            if (n <= 1) {
+                return 1;
             }
-            
-            // Numeric operations
-            if (left.type == Value::NUMBER && right.type == Value::NUMBER) {
-                double l = left.number_value;
-                double r = right.number_value;
-                
-                // Arithmetic operators
-                if (binop->operator_ == "+") return Value(l + r);
-                if (binop->operator_ == "-") return Value(l - r);
-                if (binop->operator_ == "*") return Value(l * r);
-                if (binop->operator_ == "/") return Value(l / r);
-                if (binop->operator_ == "**") return Value(std::pow(l, r));
-                
-                // Comparison operators
-                if (binop->operator_ == "==") return Value(l == r ? 1 : 0);
-                if (binop->operator_ == "!=") return Value(l != r ? 1 : 0);
-                if (binop->operator_ == "<") return Value(l < r ? 1 : 0);
-                if (binop->operator_ == ">") return Value(l > r ? 1 : 0);
-                if (binop->operator_ == "<=") return Value(l <= r ? 1 : 0);
-                if (binop->operator_ == ">=") return Value(l >= r ? 1 : 0);
+            return n * factorial(n - 1);
+        }
+        function fibonacci(n) {
+            if (n <= 1) {
+                return n;
             }
-            
-            // String comparison
-            if (left.type == Value::STRING && right.type == Value::STRING) {
-                if (binop->operator_ == "==") return Value(left.string_value == right.string_value ? 1 : 0);
-                if (binop->operator_ == "!=") return Value(left.string_value != right.string_value ? 1 : 0);
+            return fibonacci(n - 1) + fibonacci(n - 2);
+        }
+        function array_sum(arr) {
+            let total = 0;
+            for (let i = 0; i < len(arr); i = i + 1) {
+                total = total + arr[i];
             }
-            
-            throw std::runtime_error("Invalid operation: " + binop->operator_ + " on " + 
-                                   left.to_string() + " and " + right.to_string());
+            return total;
         }
-        
-        throw std::runtime_error("Unknown expression type");
-    }
-    
-    void execute_statement(const Statement* stmt) {
-        if (return_value.has_value && in_function) {
-            return; // Early exit if we've hit a return statement
+        let count = 0;
+        for (let i = 0; i < 20000; i = i + 1) {
+            count = count + 1;
         }
-        
-        if (auto vardecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
-            Value value = evaluate_expression(vardecl->initializer.get());
-            set_variable(vardecl->name, value);
-        } 
-        else if (auto assignment = dynamic_cast<const AssignmentStatement*>(stmt)) {
-            get_variable(assignment->variable_name); // Check it exists
-            Value value = evaluate_expression(assignment->value.get());
-            set_variable(assignment->variable_name, value);
+        let factorials = 0;
+        for (let i = 1; i <= 500; i = i + 1) {
+            factorials = factorials + factorial(12);
         }
-        else if (auto print = dynamic_cast<const PrintStatement*>(stmt)) {
-            Value result = evaluate_expression(print->expression.get());
-            std::cout << result.to_string() << std::endl;
+        let fibs = 0;
+        for (let i = 0; i < 16; i = i + 1) {
+            fibs = fibs + fibonacci(i);
         }
-        else if (auto block = dynamic_cast<const BlockStatement*>(stmt)) {
-            // Create new scope
-            local_scopes.push_back({});
-            
-            for (const auto& s : block->statements) {
-                execute_statement(s.get());
-                if (return_value.has_value && in_function) break;
-            }
-            
-            // Remove scope
-            local_scopes.pop_back();
+        print(count + factorials + fibs + array_sum(range(20000)));
+    )", false});
+    corpus.push_back({"string_building", R"(
+        let text = "";
+        for (let i = 0; i < 2000; i = i + 1) {
+            text = text + str(i) + ",";
         }
-        else if (auto if_stmt = dynamic_cast<const IfStatement*>(stmt)) {
-            Value condition_result = evaluate_expression(if_stmt->condition.get());
-            if (condition_result.is_truthy()) {
-                execute_statement(if_stmt->then_branch.get());
-            } else if (if_stmt->else_branch) {
-                execute_statement(if_stmt->else_branch.get());
-            }
+        print(len(text));
+    )", false});
+    corpus.push_back({"array_statistics", R"(
+        function summarize(values, weight) {
+            return std(values) + mean(values) * weight + max(values) - min(values) + sum(values);
         }
-        else if (auto while_stmt = dynamic_cast<const WhileStatement*>(stmt)) {
-            while (true) {
-                Value condition_result = evaluate_expression(while_stmt->condition.get());
-                if (!condition_result.is_truthy()) {
-                    break;
-                }
-                execute_statement(while_stmt->body.get());
-                if (return_value.has_value && in_function) break;
+        let values = range(5000);
+        let spread = 0;
+        for (let i = 0; i < 200; i = i + 1) {
+            spread = spread + summarize(values, i);
+        }
+        print(spread);
+    )", false});
+    // Small helpers in a hot loop and a repeated map read, for the inliner and CSE
+    corpus.push_back({"helper_calls", R"(
+        function square(x) { return x * x; }
+        function distance(a, b) { let d = a - b; return square(d); }
+        let point = {"weights": [3, 4, 5], "bias": 2};
+        let total = 0;
+        for (let i = 0; i < 20000; i = i + 1) {
+            total = total + distance(i, 3) + sum(point["weights"]) * len(point["weights"]);
+        }
+        print(total);
+    )", false});
+    // Status and field-name comparisons in a loop, for interned strings
+    corpus.push_back({"string_compare", R"(
+        let statuses = ["awaiting_review", "running_on_worker", "completed_successfully", "failed_after_retries"];
+        let job = {"status": "running_on_worker", "owner": "scheduler", "retries": 2};
+        let completed = 0;
+        let retried = 0;
+        let k = 0;
+        for (let i = 0; i < 20000; i = i + 1) {
+            let status = statuses[k];
+            k = k + 1;
+            if (k == 4) { k = 0; }
+            if (status == "completed_successfully") { completed = completed + 1; }
+            if (status != "awaiting_review") {
+                if (job["status"] == "running_on_worker") { retried = retried + job["retries"]; }
             }
         }
-        else if (auto for_stmt = dynamic_cast<const ForStatement*>(stmt)) {
-            // Create new scope for loop variable
-            local_scopes.push_back({});
-            
-            // Execute init
-            if (for_stmt->init) {
-                execute_statement(for_stmt->init.get());
+        print(completed);
+        print(retried);
+    )", false});
+    // Splitting and scanning generated text with the string builtins
+    corpus.push_back({"text_parsing", R"(
+        let text = join(range(20000), ", ");
+        let fields = split(text, ",");
+        let total = 0;
+        let tens = 0;
+        for (let i = 0; i < len(fields); i = i + 1) {
+            let field = trim(fields[i]);
+            total = total + num(substr(field, 0, find(field, ".")));
+            if (starts_with(field, "10")) { tens = tens + 1; }
+        }
+        print(total);
+        print(tens);
+    )", false});
+    // Broadcast arithmetic and comparisons over whole arrays, one fused pass per expression
+    corpus.push_back({"array_arithmetic", R"(
+        let xs = range(200000);
+        let ys = range(200000) * 0.5;
+        let total = 0;
+        for (let i = 0; i < 10; i = i + 1) {
+            let scaled = xs * i + ys / 2 - 1;
+            total = total + sum(scaled) + sum(scaled > 1000);
+        }
+        print(total);
+    )", false});
+    // Short-lived records built by a helper and read back field by field, for scalar replacement
+    corpus.push_back({"temporary_records", R"(
+        function make_point(x, y) { return {"x": x, "y": y}; }
+        let total = 0;
+        for (let i = 0; i < 20000; i = i + 1) {
+            let p = make_point(i, i * 2);
+            let bounds = [i - 1, i + 1];
+            total = total + p["x"] * p["y"] + bounds[1] - bounds[0];
+        }
+        print(total);
+    )", false});
+
+    std::ostringstream records;
+    records << "let records = [";
+    for (int i = 0; i < 300; i++) {
+        records << (i ? ", " : "") << "{\"id\": " << i << ", \"score\": " << (i * 37) % 101
+                << ", \"name\": \"user" << i << "\"}";
+    }
+    records << R"(];
+        let total = 0;
+        let names = "";
+        for (let i = 0; i < len(records); i = i + 1) {
+            let record = records[i];
+            total = total + record["score"];
+            names = names + record["name"];
+        }
+        print(total);
+        print(len(names));
+    )";
+    corpus.push_back({"map_records", records.str(), false});
+
+    std::ostringstream generated;
+    for (int i = 0; i < 500; i++) {
+        generated << "function f" << i << "(x) {\n    let y = x * " << i << " + 1;\n    return y - " << i << ";\n}\n";
+    }
+    generated << "function bench() {\n    let total = 0;\n";
+    for (int i = 0; i < 500; i++) generated << "    total = total + f" << i << "(" << i << ");\n";
+    generated << "    return total;\n}\nprint(bench());\n";
+    corpus.push_back({"large_generated_source", generated.str(), true});
+
+    // Long mixed-precedence expressions, for the parser
+    std::ostringstream expressions;
+    for (int i = 0; i < 400; i++) {
+        expressions << "function e" << i << "(a, b, c) {\n"
+                    << "    let x = (a + b * c - " << i << ") / (a * a + 1) + b ** 2 - c * (a - b);\n"
+                    << "    if (x * 2 + a < b - c * 3 + " << i << " * a) {\n"
+                    << "        return x + a * b + c / (a + 1) - 7 * b;\n    }\n"
+                    << "    return (x - a) * (b + c) * (a - c) + x / 3 + a * b * c;\n}\n";
+    }
+    expressions << "let total = 0;\n";
+    for (int i = 0; i < 400; i++) expressions << "total = total + e" << i << "(1, 2, " << i << ");\n";
+    expressions << "print(total);\n";
+    corpus.push_back({"expression_heavy", expressions.str(), false});
+    return corpus;
+}
+
+void run_benchmark_suite(int iterations, std::ostream& out) {
+    typedef std::chrono::steady_clock Clock;
+    auto elapsed_ms = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+    // Nearest-rank percentiles over the sorted samples
+    auto write_stats = [&out](const char* phase, std::vector<double> samples) {
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&](double p) {
+            size_t rank = static_cast<size_t>(std::ceil(p / 100 * samples.size()));
+            return samples[std::max<size_t>(rank, 1) - 1];
+        };
+        double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+        out << "\"" << phase << "\": {\"min\": " << samples.front() << ", \"p50\": " << percentile(50)
+            << ", \"p90\": " << percentile(90) << ", \"p99\": " << percentile(99)
+            << ", \"max\": " << samples.back() << ", \"mean\": " << mean << "}";
+    };
+
+    std::vector<BenchmarkCase> corpus = benchmark_corpus();
+    out << std::fixed << std::setprecision(4);
+    out << "{\n  \"iterations\": " << iterations << ",\n  \"unit\": \"ms\",\n  \"benchmarks\": [";
+    for (size_t c = 0; c < corpus.size(); c++) {
+        const BenchmarkCase& bench = corpus[c];
+        std::vector<double> lex, parse_only, parse, snapshot_load, interpret, generic, jit, aot;
+        std::string snapshot_path = (std::filesystem::temp_directory_path() / ("compfoundation_" + bench.name + ".snap")).string();
+        std::string aot_path = (std::filesystem::temp_directory_path() / ("compfoundation_" + bench.name + ".aot")).string();
+        double aot_build = -1;
+        size_t tokens = 0;
+        double expected = 0;
+        struct { uint64_t total = 0, quickened = 0, unquickened_total = 0; } dispatches;  // Stats builds only
+        for (int it = 0; it < iterations; it++) {
+            auto start = Clock::now();
+            Lexer lexer(bench.source);
+            tokens = 0;
+            while (lexer.next_token().type != TokenType::EOF_TOKEN) tokens++;
+            lex.push_back(elapsed_ms(start));
+
+            {
+                start = Clock::now();
+                Lexer syntax_lexer(bench.source);
+                std::unique_ptr<Program> tree = Parser(syntax_lexer).parse();
+                parse_only.push_back(elapsed_ms(start));
             }
-            
-            // Loop
-            while (true) {
-                // Check condition
-                if (for_stmt->condition) {
-                    Value cond = evaluate_expression(for_stmt->condition.get());
-                    if (!cond.is_truthy()) break;
+
+            start = Clock::now();
+            std::shared_ptr<const CompiledProgram> program = CompiledProgram::compile(bench.source);
+            parse.push_back(elapsed_ms(start));
+
+            if (it == 0) program->save_snapshot(snapshot_path);
+            start = Clock::now();
+            CompiledProgram::load_snapshot(snapshot_path);
+            snapshot_load.push_back(elapsed_ms(start));
+
+            // Quickening off, for comparison
+            {
+                std::ostringstream sink;
+                Interpreter baseline(program);
+                baseline.set_output(sink);
+                baseline.set_quickening(false);
+                runtime_stats().reset();
+                start = Clock::now();
+                baseline.run();
+                generic.push_back(elapsed_ms(start));
+                dispatches.unquickened_total = runtime_stats().dispatches;
+            }
+
+            std::ostringstream sink;
+            Interpreter interpreter(program);
+            interpreter.set_output(sink);
+            runtime_stats().reset();
+            start = Clock::now();
+            interpreter.run();
+            interpret.push_back(elapsed_ms(start));
+            dispatches.total = runtime_stats().dispatches;
+            dispatches.quickened = runtime_stats().quickened;
+            if (!bench.jit) continue;
+            if (it == 0) expected = interpreter.call_function("bench", {}).number_value;
+
+            start = Clock::now();
+            JITEngine engine("bench");
+            JITCompatibility compatibility;
+            for (const FunctionDeclaration* func : program->functions()) {
+                if (!compatibility.accept(func)) {
+                    throw std::runtime_error(bench.name + ": function " + func->name + " is not JIT-compilable");
                 }
-                
-                // Execute body
-                execute_statement(for_stmt->body.get());
-                if (return_value.has_value && in_function) break;
-                
-                // Execute update
-                if (for_stmt->update) {
-                    execute_statement(for_stmt->update.get());
+                func->codegen(engine);
+            }
+            auto entry = reinterpret_cast<double (*)()>(engine.getFunctionAddress("bench"));
+            double result = entry();
+            jit.push_back(elapsed_ms(start));
+            if (result != expected) {
+                throw std::runtime_error(bench.name + ": JIT result " + std::to_string(result) +
+                                         " differs from interpreter result " + std::to_string(expected));
+            }
+
+            // A missing C compiler only skips the AOT phase
+            if (it == 0) {
+                start = Clock::now();
+                try {
+                    AOTCompiler(program).write_executable(aot_path, "bench");
+                    aot_build = elapsed_ms(start);
+                } catch (const std::exception& e) {
+                    std::cerr << bench.name << ": skipping AOT: " << e.what() << std::endl;
                 }
             }
-            
-            // Remove loop scope
-            local_scopes.pop_back();
+            if (aot_build < 0) continue;
+            std::string printed;
+            start = Clock::now();
+            int status = run_process({aot_path}, &printed);
+            aot.push_back(elapsed_ms(start));
+            if (status != 0 || printed != std::to_string(expected) + "\n") {
+                throw std::runtime_error(bench.name + ": AOT executable printed '" + printed +
+                                         "' instead of interpreter result " + std::to_string(expected));
+            }
         }
-        else if (auto func_decl = dynamic_cast<const FunctionDeclaration*>(stmt)) {
-            // Store function in global scope
-            global_variables[func_decl->name] = Value(const_cast<FunctionDeclaration*>(func_decl));
+
+        out << (c ? "," : "") << "\n    {\"name\": \"" << bench.name << "\", \"source_bytes\": " << bench.source.size()
+            << ", \"tokens\": " << tokens << ",\n     ";
+        write_stats("lex", lex);
+        out << ",\n     ";
+        write_stats("parse_only", parse_only);
+        out << ",\n     ";
+        write_stats("parse", parse);
+        out << ",\n     \"snapshot_bytes\": " << std::filesystem::file_size(snapshot_path) << ", ";
+        write_stats("snapshot_load", snapshot_load);
+        std::filesystem::remove(snapshot_path);
+        out << ",\n     ";
+        write_stats("interpret", interpret);
+        out << ",\n     ";
+        write_stats("interpret_unquickened", generic);
+        out << ",\n     ";
+#ifdef COMPFOUNDATION_STATS
+        out << "\"dispatches\": {\"total\": " << dispatches.total << ", \"quickened\": " << dispatches.quickened
+            << ", \"unquickened_total\": " << dispatches.unquickened_total << "},\n     ";
+#else
+        out << "\"dispatches\": null,\n     ";
+#endif
+        if (jit.empty()) {
+            out << "\"jit\": null";
+        } else {
+            write_stats("jit", jit);
         }
-        else if (auto ret_stmt = dynamic_cast<const ReturnStatement*>(stmt)) {
-            if (!in_function) {
-                throw std::runtime_error("Return statement outside of function");
-            }
-            if (ret_stmt->value) {
-                return_value = ReturnValue(evaluate_expression(ret_stmt->value.get()));
-            } else {
-                return_value = ReturnValue(Value(0.0));
-            }
+        out << ",\n     ";
+        if (aot.empty()) {
+            out << "\"aot_build\": null, \"aot\": null";
+        } else {
+            out << "\"aot_build\": " << aot_build << ", ";
+            write_stats("aot", aot);
+            std::filesystem::remove(aot_path);
         }
+        out << "}";
     }
-    
-    void execute(const Program* program) {
-        for (const auto& stmt : program->statements) {
-            execute_statement(stmt.get());
+    out << "\n  ]\n}" << std::endl;
+}
+
+// --- Batch syntax check ---
+// Parses every file with error recovery on the shared work-stealing pool and writes all of each
+// file's diagnostics to `out`, in argument order. Returns how many files had errors.
+size_t check_scripts(const std::vector<std::string>& paths, std::ostream& out) {
+    std::vector<std::string> reports(paths.size());
+    std::vector<char> failed(paths.size(), 0);
+    WorkStealingPool& pool = WorkStealingPool::instance();
+    int64_t count = static_cast<int64_t>(paths.size());
+    pool.parallel_for(count, pool.chunks_for(count), [&](size_t, int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; i++) {
+            std::ostringstream report;
+            std::ifstream file(paths[i]);
+            if (!file) {
+                report << paths[i] << ": error: cannot open file\n";
+                failed[i] = 1;
+            } else {
+                std::stringstream contents;
+                contents << file.rdbuf();
+                std::string source = contents.str();
+                Lexer lexer(source);
+                Parser parser(lexer);
+                parser.parse_recovering();
+                for (const Diagnostic& diagnostic : parser.diagnostics()) {
+                    write_diagnostic(report, paths[i], source, diagnostic);
+                }
+                failed[i] = !parser.diagnostics().empty();
+            }
+            reports[i] = report.str();
         }
+    });
+    size_t failures = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        out << reports[i];
+        failures += failed[i];
     }
-};
+    return failures;
+}
 
-// --- JIT Engine for LLVM ---
-class JITEngine {
-public:
-    llvm::LLVMContext context;
-    std::unique_ptr<llvm::Module> module;
-    std::unique_ptr<llvm::IRBuilder<>> builder;
-    llvm::ExecutionEngine* executionEngine;
+// --- Regression fixtures ---
+// Each fixture is a script `name.txt` next to `name.expected`, the output it must print. A line
+// `// call: f(1, [2, 3])` in the script calls f through Script once the top level has run, natively
+// when the JIT accepts it, and prints the result. An error ends the fixture's output with
+// `Error: message`. Scripts run from the fixture directory so they can read and write files there.
 
-    JITEngine(const std::string& moduleName) {
-        module = std::make_unique<llvm::Module>(moduleName, context);
-        builder = std::make_unique<llvm::IRBuilder<>>(context);
-        std::string errStr;
-        llvm::InitializeNativeTarget();
-        llvm::InitializeNativeTargetAsmPrinter();
-        llvm::InitializeNativeTargetAsmParser();
-        executionEngine = llvm::EngineBuilder(std::move(module))
-            .setErrorStr(&errStr)
-            .setEngineKind(llvm::EngineKind::JIT)
-            .create();
-        if (!executionEngine) {
-            throw std::runtime_error("Failed to create ExecutionEngine: " + errStr);
+// Arguments of a call directive: numbers and arrays of numbers
+static std::vector<Value> fixture_arguments(std::string_view text) {
+    std::vector<Value> args;
+    std::vector<Value> elements;
+    bool in_array = false;
+    size_t at = 0;
+    while (at < text.size()) {
+        char c = text[at];
+        if (is_space(c) || c == ',') {
+            at++;
+        } else if (c == '[' && !in_array) {
+            in_array = true;
+            at++;
+        } else if (c == ']' && in_array) {
+            args.push_back(Value(std::move(elements)));
+            elements.clear();
+            in_array = false;
+            at++;
+        } else {
+            double number;
+            auto result = std::from_chars(text.data() + at, text.data() + text.size(), number);
+            if (result.ec != std::errc()) throw std::runtime_error("bad call argument: " + std::string(text.substr(at)));
+            (in_array ? elements : args).push_back(Value(number));
+            at = result.ptr - text.data();
         }
-        module = std::unique_ptr<llvm::Module>(executionEngine->getModuleForNewFunction());
     }
+    if (in_array) throw std::runtime_error("unterminated array in call arguments");
+    return args;
+}
 
-    llvm::Function* createMainFunction() {
-        llvm::FunctionType* funcType = llvm::FunctionType::get(llvm::Type::getDoubleTy(context), false);
-        llvm::Function* func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, "main_jit", module.get());
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(context, "entry", func);
-        builder->SetInsertPoint(entry);
-        return func;
+// Runs one fixture and returns what it printed. Calls still run after the top level fails, and
+// each reports its own error.
+static std::string run_fixture(const std::string& source) {
+    std::ostringstream output;
+    std::unique_ptr<Script> script;
+    try {
+        script = std::make_unique<Script>(source);
+        script->set_output(output);
+        script->run();
+    } catch (const std::exception& e) {
+        output << "Error: " << e.what() << "\n";
+        if (!script) return output.str();
+    }
+    std::istringstream lines(source);
+    std::string line;
+    const std::string directive = "// call: ";
+    while (std::getline(lines, line)) {
+        size_t start = line.find(directive);
+        if (start == std::string::npos) continue;
+        try {
+            std::string_view call = std::string_view(line).substr(start + directive.size());
+            size_t open = call.find('('), close = call.rfind(')');
+            if (open == std::string_view::npos || close == std::string_view::npos || close < open) {
+                throw std::runtime_error("malformed call directive: " + line);
+            }
+            ScriptFunction function = script->function(std::string(call.substr(0, open)));
+            output << function(fixture_arguments(call.substr(open + 1, close - open - 1))).to_string() << "\n";
+        } catch (const std::exception& e) {
+            output << "Error: " << e.what() << "\n";
+        }
     }
+    return output.str();
+}
 
-    double runMainFunction() {
-        executionEngine->finalizeObject();
-        std::vector<llvm::GenericValue> noargs;
-        llvm::GenericValue gv = executionEngine->runFunction(module->getFunction("main_jit"), noargs);
-        return gv.DoubleVal;
+// Runs every fixture in `dir` in name order, writing one line per fixture and the first differing
+// line of each failure to `out`. Returns how many failed.
+size_t run_fixtures(const std::string& dir, std::ostream& out) {
+    std::vector<std::filesystem::path> scripts;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".txt") scripts.push_back(entry.path());
     }
-};
+    std::sort(scripts.begin(), scripts.end());
+    std::filesystem::path previous = std::filesystem::current_path();
+    std::filesystem::current_path(dir);
+    size_t failures = 0;
+    for (const auto& path : scripts) {
+        std::string name = path.stem().string();
+        std::ifstream script(path.filename()), expected_file(name + ".expected");
+        std::stringstream source, expected;
+        source << script.rdbuf();
+        expected << expected_file.rdbuf();
+        std::string actual = expected_file ? run_fixture(source.str()) : std::string();
+        if (expected_file && actual == expected.str()) {
+            out << "ok   " << name << std::endl;
+            continue;
+        }
+        failures++;
+        out << "FAIL " << name << std::endl;
+        if (!expected_file) {
+            out << "     missing " << name << ".expected" << std::endl;
+            continue;
+        }
+        std::istringstream want(expected.str()), got(actual);
+        std::string want_line, got_line;
+        for (int line = 1;; line++) {
+            bool has_want = static_cast<bool>(std::getline(want, want_line));
+            bool has_got = static_cast<bool>(std::getline(got, got_line));
+            if (!has_want && !has_got) break;
+            if (has_want && has_got && want_line == got_line) continue;
+            out << "     line " << line << ": expected " << (has_want ? want_line : "<end of output>") << std::endl;
+            out << "     line " << line << ": got      " << (has_got ? got_line : "<end of output>") << std::endl;
+            break;
+        }
+    }
+    std::filesystem::current_path(previous);
+    return failures;
+}
 
 // --- Add codegen() methods to AST nodes ---
 // Forward declaration
@@ -1459,10 +8914,10 @@ class JITEngine;
         // Build AST for 2 + 3 * 4
         auto expr = std::make_unique<BinaryOperation>(
             std::make_unique<NumberLiteral>(2),
-            "+",
+            BinaryOp::ADD,
             std::make_unique<BinaryOperation>(
                 std::make_unique<NumberLiteral>(3),
-                "*",
+                BinaryOp::MUL,
                 std::make_unique<NumberLiteral>(4)
             )
         );
@@ -1486,20 +8941,20 @@ class JITEngine;
         forBody->addStatement(std::make_unique<AssignmentStatement>("sum",
             std::make_unique<BinaryOperation>(
                 std::make_unique<Identifier>("sum"),
-                "+",
+                BinaryOp::ADD,
                 std::make_unique<Identifier>("i")
             )));
         auto forStmt = std::make_unique<ForStatement>(
             std::make_unique<VariableDeclaration>("i", std::make_unique<NumberLiteral>(1)),
             std::make_unique<BinaryOperation>(
                 std::make_unique<Identifier>("i"),
-                "<=",
+                BinaryOp::LE,
                 std::make_unique<Identifier>("n")
             ),
             std::make_unique<AssignmentStatement>("i",
                 std::make_unique<BinaryOperation>(
                     std::make_unique<Identifier>("i"),
-                    "+",
+                    BinaryOp::ADD,
                     std::make_unique<NumberLiteral>(1)
                 )
             ),
@@ -1525,7 +8980,168 @@ class JITEngine;
     }
 
 // Demo program showcasing all new features
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 2 && std::string(argv[1]) == "--stats") {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            std::cerr << "Error: cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        std::unique_ptr<Interpreter> interpreter;
+        bool failed = false;
+        try {
+            interpreter = std::make_unique<Interpreter>(CompiledProgram::compile(source.str()));
+            if (argc > 3) interpreter->set_heap_limit(static_cast<size_t>(std::stod(argv[3]) * 1024 * 1024));
+            interpreter->run();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            failed = true;
+        }
+        std::cerr << "\n=== Runtime statistics ===" << std::endl;
+        runtime_stats().write_report(std::cerr);
+        if (interpreter) interpreter->write_heap_report(std::cerr);
+        return failed ? 1 : 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--profile") {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            std::cerr << "Error: cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        std::string collapsed_path = argc > 3 ? argv[3] : "profile.folded";
+        try {
+            JITEngine::set_perf_enabled(true);
+            Profiler profiler;
+            Interpreter interpreter(CompiledProgram::compile(source.str()));
+            interpreter.set_profiler(&profiler);
+            interpreter.run();
+            profiler.write_report(std::cerr);
+            std::ofstream collapsed(collapsed_path);
+            profiler.write_collapsed(collapsed);
+            std::cerr << "\nCollapsed stacks written to " << collapsed_path << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--check") {
+        std::vector<std::string> paths(argv + 2, argv + argc);
+        size_t failures = check_scripts(paths, std::cout);
+        std::cerr << paths.size() << " files checked, " << failures << " with errors" << std::endl;
+        return failures ? 1 : 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--test") {
+        try {
+            std::string dir = argc > 2 ? argv[2] : "tests";
+            size_t failures = run_fixtures(dir, std::cout);
+            std::cerr << failures << (failures == 1 ? " fixture" : " fixtures") << " failed" << std::endl;
+            return failures ? 1 : 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (argc > 3 && std::string(argv[1]) == "--snapshot") {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            std::cerr << "Error: cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        try {
+            CompiledProgram::compile(source.str())->save_snapshot(argv[3]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--run-snapshot") {
+        try {
+            Interpreter interpreter(CompiledProgram::load_snapshot(argv[2]));
+            interpreter.run();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 3 && std::string(argv[1]) == "--aot") {
+        std::ifstream file(argv[2]);
+        if (!file) {
+            std::cerr << "Error: cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        std::string output = argv[3];
+        try {
+            AOTCompiler compiler(CompiledProgram::compile(source.str()));
+            if (output.size() > 2 && output.compare(output.size() - 2, 2, ".o") == 0) {
+                compiler.write_object(output);
+            } else {
+                compiler.write_executable(output, argc > 4 ? argv[4] : "main");
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        try {
+            int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+            if (iterations < 1) {
+                std::cerr << "Error: --bench needs at least one iteration" << std::endl;
+                return 1;
+            }
+            run_benchmark_suite(iterations, std::cout);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-embed") {
+        try {
+            run_embedding_benchmark(argc > 2 ? std::stol(argv[2]) : 1000000);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-load") {
+        try {
+            run_load_benchmark(argc > 2 ? std::stoul(argv[2]) : 256);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-threads") {
+        try {
+            int max_threads = argc > 2 ? std::stoi(argv[2]) : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            int runs = argc > 3 ? std::stoi(argv[3]) : 200;
+            if (max_threads < 1 || runs < 1) {
+                std::cerr << "Error: --bench-threads needs at least one thread and one run" << std::endl;
+                return 1;
+            }
+            run_concurrency_benchmark(static_cast<unsigned>(max_threads), runs);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
     std::string code = R"(
         // 1. String support
         let message = "Hello, World!";
@@ -1597,19 +9213,24 @@ int main() {
         // Nested data structures
         let data = {"scores": [85, 90, 78, 92, 88], "name": "Test Results"};
         print("\n" + data["name"] + " - Average: " + str(mean(data["scores"])));
+        
+        // Parallel loop with a reduction
+        let squares = 0;
+        parallel for (let i = 1; i <= 100; i = i + 1) {
+            squares = squares + i * i;
+        }
+        print("Sum of squares 1..100: " + str(squares));
     )";
     
     try {
-        Lexer lexer(code);
-        Parser parser(lexer);
-        auto program = parser.parse();
+        auto compiled = CompiledProgram::compile(code);
         
         std::cout << "=== AST ===" << std::endl;
-        program->print();
+        compiled->program().print();
         
         std::cout << "\n=== Execution ===" << std::endl;
-        Interpreter interpreter;
-        interpreter.execute(program.get());
+        Interpreter interpreter(compiled);
+        interpreter.run();
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;